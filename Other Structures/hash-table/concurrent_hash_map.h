@@ -1,17 +1,67 @@
 #pragma once
 
+#include <algorithm>
 #include <atomic>
+#include <bit>
 #include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <numeric>
+#include <optional>
+#include <span>
 #include <stdexcept>
+#include <type_traits>
+#include <utility>
 #include <unordered_map>
 #include <mutex>
 #include <functional>
-#include <list>
-#include<iostream>
+#include <vector>
 
+// Whether a key or a value can be read while a writer changes it: loads and stores of it
+// through std::atomic_ref are single instructions
+template <class T>
+constexpr bool IsSeqlockReadable() {
+    if constexpr (std::is_trivially_copyable_v<T>) {
+        return std::atomic_ref<T>::is_always_lock_free &&
+               std::atomic_ref<T>::required_alignment == alignof(T);
+    } else {
+        return false;
+    }
+}
+
+// Finalizer of MurmurHash3: the maps take indices from the low bits of the hash, and
+// std::hash of an integer is the integer itself
+inline uint64_t MixHash(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return h;
+}
+
+// Hash map with striped locks that grows online.
+// Table sizes are powers of two and never smaller than the number of stripes, and the stripe
+// of a key is taken from the low bits of its hash like the bucket is. So a bucket and the two
+// buckets it splits into on growth belong to the same stripe, and a resize moves the table
+// bucket by bucket under one stripe lock at a time: a full table links a twice larger one,
+// inserting threads migrate chunks of buckets into it and the thread finishing the last chunk
+// makes it the current table. A moved bucket forwards operations to the next table.
+//
+// There are kStripesPerThread stripes per expected thread, but no more than expected entries,
+// rounded up to a power of two. Every stripe has a cache line of its own, with the count of its
+// entries: writers of different stripes share no memory they write, except for a total that a
+// stripe adds its count changes to in batches and the resize is driven by.
+//
+// Writers of a stripe are serialized by its lock and make its version odd while they change
+// it. When the key and the value are word-sized, Find and At do not lock: they walk the bucket
+// and read the entry, then retry if the version has moved meanwhile, so readers write no
+// shared memory. A node such a reader may stand on is never freed while the map lives, erased
+// nodes are kept on a free list of their stripe for the next inserts.
 template <class K, class V, class Hash = std::hash<K>>
 class ConcurrentHashMap {
 public:
+    // Whether Find and At read without locking
+    static constexpr bool kOptimisticReads = IsSeqlockReadable<K>() && IsSeqlockReadable<V>();
+
     ConcurrentHashMap(const Hash& hasher = Hash()) : ConcurrentHashMap(kUndefinedSize, hasher) {
     }
 
@@ -20,152 +70,565 @@ public:
     }
 
     ConcurrentHashMap(int expected_size, int expected_threads_count, const Hash& hasher = Hash())
-        : hash_(hasher), mutex_(std::vector <std::mutex> (50)){ // NOLINT
-        if (expected_size != kUndefinedSize) {
-            data_.resize(expected_size);
-        } else {
-            data_.resize(1);
+        : stripes_(StripesFor(expected_size, expected_threads_count)),
+          stripe_mask_(stripes_.size() - 1),
+          hash_(hasher) {  // NOLINT
+        size_t buckets = stripes_.size();
+        while (expected_size != kUndefinedSize &&
+               buckets * kMaxLoadFactor < size_t(expected_size)) {
+            buckets *= 2;
         }
-        bucket_size_.store(data_.size());
-        size_ = 0;
+        oldest_ = new Table(buckets);
+        table_.store(oldest_);
     }
 
-    void LockAll() {
-        for (auto &u: mutex_) {
-            u.lock();
+    ConcurrentHashMap(const ConcurrentHashMap&) = delete;
+    ConcurrentHashMap& operator=(const ConcurrentHashMap&) = delete;
+
+    ~ConcurrentHashMap() {
+        for (auto table = oldest_; table;) {
+            for (auto& bucket : table->buckets) {
+                DeleteList(bucket.load());
+            }
+            delete std::exchange(table, table->next.load());
+        }
+        for (auto& stripe : stripes_) {
+            DeleteList(stripe.free);
         }
     }
 
-    void UnLockAll() {
-        for (auto &u: mutex_) {
-            u.unlock();
+    bool Insert(const K& key, const V& value) {
+        size_t h = HashOf(key);
+        auto& stripe = stripes_[StripeOf(h)];
+        {
+            std::scoped_lock lock(stripe.mutex);
+            auto& bucket = Locate(h);
+            if (LinkOf(bucket, key).load(std::memory_order_relaxed)) {
+                return false;
+            }
+            Link(stripe, bucket, MakeNode(stripe, key, [&value] { return value; }));
         }
+        Grow();
+        return true;
     }
 
-    void Rehash(size_t bucket_ind) {
-        if (!(data_[bucket_ind].size() > 50)) {
-            return;
-        }
-        LockAll();
-        std::vector <std::list<std::pair<K, V>>> new_data(data_.size() * 3);
-        for (auto &bucket : data_) {
-            for (auto &u: bucket) {
-                size_t hash = hash_(u.first);
-                size_t bucket_ind = hash % new_data.size();
-                new_data[bucket_ind].push_back(u);
+    // Inserts the key with the value constructed from args right in its node, so V may be
+    // move-only. Does nothing to args if the key is already there. Returns whether the key
+    // was inserted.
+    template <class... Args>
+    bool TryEmplace(const K& key, Args&&... args) {
+        return Upsert(
+            key, std::in_place, [&args...] { return V(std::forward<Args>(args)...); },
+            [](V&) {});
+    }
+
+    // Returns whether the key was inserted rather than assigned
+    bool InsertOrAssign(const K& key, const V& value) {
+        return Upsert(key, value, [&value](V& current) { current = value; });
+    }
+
+    // Inserts the key with the init value, or calls fn(V&) on the value it has, under one
+    // acquisition of the stripe lock. Returns whether the key was inserted.
+    template <class F>
+    bool Upsert(const K& key, const V& init, F&& fn) {
+        return Upsert(key, std::in_place, [&init] { return init; }, std::forward<F>(fn));
+    }
+
+    // Upsert that builds an inserted value in its node from make(), called only if the key
+    // is not there yet
+    template <class Make, class F>
+    bool Upsert(const K& key, std::in_place_t, Make&& make, F&& fn) {
+        size_t h = HashOf(key);
+        auto& stripe = stripes_[StripeOf(h)];
+        {
+            std::scoped_lock lock(stripe.mutex);
+            auto& bucket = Locate(h);
+            if (auto node = LinkOf(bucket, key).load(std::memory_order_relaxed)) {
+                Modify(node, fn);
+                return false;
             }
+            Link(stripe, bucket, MakeNode(stripe, key, make));
         }
-        data_.swap(new_data);
-        UnLockAll();
+        Grow();
+        return true;
     }
 
-    bool Insert(const K& key, const V& value) {
-        size_t h = hash_(key);
-        size_t bucket_ind = h % bucket_size_.load();
-        size_t mutex_ind = bucket_ind % mutex_.size();
-        bool ans = true;
+    // Calls fn(const V*) with the value of the key, or nullptr if there is none, and makes the
+    // std::optional<V> it returns the value of the key: an empty one erases the key.
+    // Returns what fn returned.
+    template <class F>
+    std::optional<V> Compute(const K& key, F&& fn) {
+        size_t h = HashOf(key);
+        auto& stripe = stripes_[StripeOf(h)];
+        std::optional<V> result;
         {
-            std::scoped_lock lock(mutex_[mutex_ind]);
-
-//            size_t bucket_ind = h % data_.size();
-
-            /// add class bucket
-            for (auto &u: data_[bucket_ind]) {
-                if (u.first == key) {
-                    ans = false;
+            std::scoped_lock lock(stripe.mutex);
+            auto& bucket = Locate(h);
+            auto& link = LinkOf(bucket, key);
+            auto node = link.load(std::memory_order_relaxed);
+            result = fn(node ? &std::as_const(node->value) : nullptr);
+            if (!result) {
+                if (node) {
+                    Unlink(stripe, link);
                 }
+                return result;
             }
-
-            if (ans) {
-                ++size_;
-                data_[bucket_ind].push_back({key, value});
+            if (node) {
+                Modify(node, [&result](V& current) { current = *result; });
+                return result;
             }
+            Link(stripe, bucket, MakeNode(stripe, key, [&result] { return *result; }));
         }
-//        lock.unlock();
-
-//        if (data_[bucket_ind].size() > 50) {
-//            Rehash(bucket_ind);
-//        }
-
-        return ans;
+        Grow();
+        return result;
     }
 
     bool Erase(const K& key) {
-        size_t h = hash_(key);
-        size_t mutex_ind = h % mutex_.size();
-        std::unique_lock<std::mutex> lock(mutex_[mutex_ind]);
+        return EraseIf(key, [](const V&) { return true; });
+    }
 
-        size_t bucket_ind = h % data_.size();
+    // Erases the key if pred(const V&) holds for its value
+    template <class Predicate>
+    bool EraseIf(const K& key, Predicate&& pred) {
+        size_t h = HashOf(key);
+        auto& stripe = stripes_[StripeOf(h)];
+        std::scoped_lock lock(stripe.mutex);
 
-        auto it = data_[bucket_ind].begin();
-        while (it != data_[bucket_ind].end() && it->first != key) {
-            ++it;
-        }
-        if (it == data_[bucket_ind].end()) {
+        auto& link = LinkOf(Locate(h), key);
+        auto node = link.load(std::memory_order_relaxed);
+        if (!node || !pred(std::as_const(node->value))) {
             return false;
         }
-
-        data_[bucket_ind].erase(it);
+        Unlink(stripe, link);
         return true;
     }
 
+    // Keeps the capacity, like std::unordered_map::clear
     void Clear() {
         LockAll();
-        data_.clear();
-        data_.resize(1);
-        size_ = 0;
+        for (auto& stripe : stripes_) {
+            stripe.version.store(stripe.version.load(std::memory_order_relaxed) + 1,
+                                 std::memory_order_relaxed);
+        }
+        std::atomic_thread_fence(std::memory_order_release);
+        for (auto table = table_.load(); table; table = table->next.load()) {
+            for (size_t i = 0; i < table->buckets.size(); ++i) {
+                auto node = table->buckets[i].exchange(nullptr, std::memory_order_relaxed);
+                while (node) {
+                    Retire(stripes_[StripeOf(i)],
+                           std::exchange(node, node->next.load(std::memory_order_relaxed)));
+                }
+            }
+        }
+        for (auto& stripe : stripes_) {
+            stripe.size.store(0, std::memory_order_relaxed);
+            stripe.unreported = 0;
+        }
+        approximate_size_.store(0, std::memory_order_relaxed);
+        for (auto& stripe : stripes_) {
+            stripe.version.store(stripe.version.load(std::memory_order_relaxed) + 1,
+                                 std::memory_order_release);
+        }
         UnLockAll();
     }
 
     std::pair<bool, V> Find(const K& key) const {
-        size_t h = hash_(key);
-        size_t mutex_ind = h % mutex_.size();
-        std::scoped_lock<std::mutex> lock(mutex_[mutex_ind]);
+        size_t h = HashOf(key);
+        if constexpr (kOptimisticReads) {
+            std::pair<bool, V> result;
+            if (TryFindOptimistic(h, key, result)) {
+                return result;
+            }
+        }
 
-        size_t bucket_ind = h % data_.size();
+        std::scoped_lock<std::mutex> lock(stripes_[StripeOf(h)].mutex);
+        return FindLocked(h, key);
+    }
 
-        auto it = data_[bucket_ind].begin();
-        while (it != data_[bucket_ind].end() && it->first != key) {
-            ++it;
+    // Finds keys[i] into out[i] for every i. The keys go in chunks: all keys of a chunk are
+    // hashed and their buckets and first nodes prefetched before any is resolved, so their
+    // cache misses overlap, and the locked lookups of a chunk take every stripe lock once.
+    void FindMany(std::span<const K> keys, std::span<std::pair<bool, V>> out) const {
+        if (out.size() < keys.size()) {
+            throw std::invalid_argument("FindMany needs an output per key");
         }
-        if (it == data_[bucket_ind].end()) {
-            return {false, V()};
+        for (size_t begin = 0; begin < keys.size(); begin += kBatchChunk) {
+            auto count = std::min(kBatchChunk, keys.size() - begin);
+            FindChunk(keys.subspan(begin, count), out.subspan(begin, count));
         }
-        return {true, it->second};
     }
 
     const V At(const K& key) const {
-        size_t h = hash_(key);
-        size_t mutex_ind = h % mutex_.size();
-        std::unique_lock<std::mutex> lock(mutex_[mutex_ind]);
-
-        size_t bucket_ind = h % data_.size();
-
-        auto it = data_[bucket_ind].begin();
-        while (it != data_[bucket_ind].end() && it->first != key) {
-            ++it;
-        }
-        if (it == data_[bucket_ind].end()) {
+        auto [found, value] = Find(key);
+        if (!found) {
             throw std::out_of_range("");
         }
-        return it->second;
+        return value;
     }
 
+    // Sums the counts of the stripes, exact when no writer runs
     size_t Size() const {
-        return size_;
+        size_t size = 0;
+        for (const auto& stripe : stripes_) {
+            size += stripe.size.load(std::memory_order_relaxed);
+        }
+        return size;
+    }
+
+    // In O(1), differs from Size by less than BucketCount() / kSizeSlack
+    size_t ApproximateSize() const {
+        return approximate_size_.load(std::memory_order_relaxed);
+    }
+
+    // Buckets of the current table
+    size_t BucketCount() const {
+        return table_.load()->buckets.size();
+    }
+
+    size_t StripeCount() const {
+        return stripes_.size();
     }
 
     static const int kDefaultConcurrencyLevel;
     static const int kUndefinedSize;
-    static const int kMutexCount;
-
 
 private:
-    std::vector <std::list<std::pair<K, V>>> data_;
-    mutable std::vector <std::mutex> mutex_;
+    static constexpr size_t kStripesPerThread = 8;
+    static constexpr size_t kMaxStripes = 1024;
+    static constexpr size_t kCacheLine = 64;
+    // The table grows once it holds this many entries per bucket
+    static constexpr size_t kMaxLoadFactor = 1;
+    // Buckets moved by one inserting thread at a time. Doubling takes size / kMigrationChunk
+    // inserts, so the load factor stays under kMaxLoadFactor * (1 + 1 / kMigrationChunk).
+    static constexpr size_t kMigrationChunk = 16;
+    // Lock-free tries of a read before it takes the lock
+    static constexpr int kOptimisticAttempts = 64;
+    // A stripe reports its count changes to the total once they reach 1 / kSizeSlack of its
+    // share of buckets
+    static constexpr size_t kSizeSlack = 8;
+    // Keys of FindMany with prefetches in flight at once
+    static constexpr size_t kBatchChunk = 32;
+
+    struct Node {
+        // The value is initialized right from what make() returns, without a copy or a move
+        template <class Make>
+        Node(const K& key, Make& make) : key(key), value(make()) {
+        }
+
+        std::atomic<Node*> next{nullptr};
+        K key;
+        V value;
+    };
+
+    using Bucket = std::atomic<Node*>;
+
+    struct Table {
+        explicit Table(size_t size) : buckets(size), moved(size) {
+        }
+
+        std::vector<Bucket> buckets;
+        // Set under the stripe lock of the bucket
+        std::vector<std::atomic<bool>> moved;
+        // Twice larger table the entries move to, never unlinked. Old tables are kept until
+        // the map is destroyed: a thread may still hold a pointer to one, and all of them
+        // together have fewer buckets than the current table.
+        std::atomic<Table*> next{nullptr};
+        std::atomic<bool> growing{false};
+        // Migration progress, in buckets of this table
+        std::atomic<size_t> next_chunk{0};
+        std::atomic<size_t> migrated{0};
+    };
+
+    // Padded, so that writers of neighbouring stripes do not invalidate each other's lines
+    struct alignas(kCacheLine) Stripe {
+        std::mutex mutex;
+        // Odd while a writer changes the buckets of the stripe
+        std::atomic<uint64_t> version{0};
+        // Erased nodes, reused by inserts when the reads are optimistic
+        Node* free = nullptr;
+        // Written under the lock, read by Size without it
+        std::atomic<size_t> size{0};
+        // Change of the count not yet added to approximate_size_
+        int64_t unreported = 0;
+    };
+
+    // Makes the version of the stripe odd for its lifetime, the stripe lock has to be held
+    class WriteGuard {
+    public:
+        explicit WriteGuard(Stripe& stripe) : version_(stripe.version) {
+            version_.store(version_.load(std::memory_order_relaxed) + 1,
+                           std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+        }
+
+        ~WriteGuard() {
+            version_.store(version_.load(std::memory_order_relaxed) + 1,
+                           std::memory_order_release);
+        }
+
+    private:
+        std::atomic<uint64_t>& version_;
+    };
+
+    // No more stripes than expected entries, a stripe per entry already keeps writers apart
+    static size_t StripesFor(int expected_size, int expected_threads_count) {
+        auto stripes = size_t(std::max(expected_threads_count, 1)) * kStripesPerThread;
+        if (expected_size != kUndefinedSize) {
+            stripes = std::min(stripes, size_t(std::max(expected_size, 1)));
+        }
+        return std::bit_ceil(std::min(stripes, kMaxStripes));
+    }
+
+    size_t HashOf(const K& key) const {
+        return MixHash(hash_(key));
+    }
+
+    size_t StripeOf(size_t h) const {
+        return h & stripe_mask_;
+    }
+
+    // Bucket of the key in the newest table that has it. Under the stripe lock it is exact,
+    // an optimistic reader validates it with the version.
+    Bucket& Locate(size_t h) const {
+        auto table = table_.load(std::memory_order_acquire);
+        auto index = h & (table->buckets.size() - 1);
+        while (table->moved[index].load(std::memory_order_acquire)) {
+            table = table->next.load(std::memory_order_acquire);
+            index = h & (table->buckets.size() - 1);
+        }
+        return table->buckets[index];
+    }
+
+    template <class T>
+    static T Load(const T& field) {
+        return std::atomic_ref<T>(const_cast<T&>(field)).load(std::memory_order_relaxed);
+    }
+
+    // The stripe lock has to be held
+    std::pair<bool, V> FindLocked(size_t h, const K& key) const {
+        for (auto node = Locate(h).load(std::memory_order_relaxed); node;
+             node = node->next.load(std::memory_order_relaxed)) {
+            if (node->key == key) {
+                return {true, node->value};
+            }
+        }
+        return {false, V()};
+    }
+
+    void FindChunk(std::span<const K> keys, std::span<std::pair<bool, V>> out) const {
+        size_t hashes[kBatchChunk];
+        // Only hints: the buckets of a resized table may have moved, lookups locate them again
+        auto table = table_.load(std::memory_order_acquire);
+        auto mask = table->buckets.size() - 1;
+        for (size_t i = 0; i < keys.size(); ++i) {
+            hashes[i] = HashOf(keys[i]);
+            __builtin_prefetch(&table->buckets[hashes[i] & mask]);
+        }
+        for (size_t i = 0; i < keys.size(); ++i) {
+            __builtin_prefetch(table->buckets[hashes[i] & mask].load(std::memory_order_relaxed));
+        }
+
+        if constexpr (kOptimisticReads) {
+            for (size_t i = 0; i < keys.size(); ++i) {
+                if (!TryFindOptimistic(hashes[i], keys[i], out[i])) {
+                    std::scoped_lock lock(stripes_[StripeOf(hashes[i])].mutex);
+                    out[i] = FindLocked(hashes[i], keys[i]);
+                }
+            }
+            return;
+        }
+
+        size_t order[kBatchChunk];
+        std::iota(order, order + keys.size(), 0);
+        std::sort(order, order + keys.size(), [this, &hashes](size_t lhs, size_t rhs) {
+            return StripeOf(hashes[lhs]) < StripeOf(hashes[rhs]);
+        });
+        for (size_t j = 0; j < keys.size();) {
+            auto stripe = StripeOf(hashes[order[j]]);
+            std::scoped_lock lock(stripes_[stripe].mutex);
+            for (; j < keys.size() && StripeOf(hashes[order[j]]) == stripe; ++j) {
+                out[order[j]] = FindLocked(hashes[order[j]], keys[order[j]]);
+            }
+        }
+    }
+
+    // Seqlock read, fails if writers kept the stripe busy for all the attempts
+    bool TryFindOptimistic(size_t h, const K& key, std::pair<bool, V>& result) const {
+        auto& version = stripes_[StripeOf(h)].version;
+        for (int attempt = 0; attempt < kOptimisticAttempts; ++attempt) {
+            auto before = version.load(std::memory_order_acquire);
+            if (before & 1) {
+                continue;
+            }
+            result = {false, V()};
+            auto node = Locate(h).load(std::memory_order_acquire);
+            while (node) {
+                if (Load(node->key) == key) {
+                    result = {true, Load(node->value)};
+                    break;
+                }
+                node = node->next.load(std::memory_order_acquire);
+                // A node that was unlinked meanwhile may lead anywhere, even in a cycle
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (version.load(std::memory_order_relaxed) != before) {
+                    break;
+                }
+            }
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (version.load(std::memory_order_relaxed) == before) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Link in the bucket to the node of the key, to nullptr if there is no such node.
+    // The stripe lock has to be held.
+    static Bucket& LinkOf(Bucket& bucket, const K& key) {
+        auto link = &bucket;
+        for (auto node = link->load(std::memory_order_relaxed); node && node->key != key;
+             node = link->load(std::memory_order_relaxed)) {
+            link = &node->next;
+        }
+        return *link;
+    }
+
+    // Puts a new node in front of the bucket, the stripe lock has to be held
+    void Link(Stripe& stripe, Bucket& bucket, Node* node) {
+        WriteGuard guard(stripe);
+        node->next.store(bucket.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        bucket.store(node, std::memory_order_release);
+        Count(stripe, 1);
+    }
+
+    // Takes the node the link points to out of its bucket, the stripe lock has to be held
+    void Unlink(Stripe& stripe, Bucket& link) {
+        auto node = link.load(std::memory_order_relaxed);
+        WriteGuard guard(stripe);
+        link.store(node->next.load(std::memory_order_relaxed), std::memory_order_release);
+        Retire(stripe, node);
+        Count(stripe, -1);
+    }
+
+    // The stripe lock has to be held
+    void Count(Stripe& stripe, int64_t delta) {
+        stripe.size.store(stripe.size.load(std::memory_order_relaxed) + delta,
+                          std::memory_order_relaxed);
+        stripe.unreported += delta;
+        auto share = table_.load(std::memory_order_relaxed)->buckets.size() / stripes_.size();
+        if (uint64_t(std::abs(stripe.unreported)) * kSizeSlack >= share) {
+            approximate_size_.fetch_add(stripe.unreported, std::memory_order_relaxed);
+            stripe.unreported = 0;
+        }
+    }
+
+    // Changes the value of a linked node in place, the stripe lock has to be held.
+    // An optimistic reader may load the value meanwhile, so it gets the result in one store:
+    // the reader sees either value whole and no version bump is needed.
+    template <class F>
+    static void Modify(Node* node, F&& fn) {
+        if constexpr (kOptimisticReads) {
+            auto value = node->value;
+            fn(value);
+            std::atomic_ref<V>(node->value).store(value, std::memory_order_relaxed);
+        } else {
+            fn(node->value);
+        }
+    }
+
+    // Node outside of any bucket, the stripe lock has to be held
+    template <class Make>
+    static Node* MakeNode(Stripe& stripe, const K& key, Make&& make) {
+        if constexpr (kOptimisticReads) {
+            if (auto node = stripe.free) {
+                stripe.free = node->next.load(std::memory_order_relaxed);
+                // A reader that stood on the node when it was erased may still read it
+                std::atomic_ref<K>(node->key).store(key, std::memory_order_relaxed);
+                std::atomic_ref<V>(node->value).store(make(), std::memory_order_relaxed);
+                return node;
+            }
+        }
+        return new Node(key, make);
+    }
+
+    // Takes a node unlinked from its bucket, the stripe lock has to be held
+    static void Retire(Stripe& stripe, Node* node) {
+        if constexpr (kOptimisticReads) {
+            node->next.store(stripe.free, std::memory_order_relaxed);
+            stripe.free = node;
+        } else {
+            delete node;
+        }
+    }
+
+    static void DeleteList(Node* node) {
+        while (node) {
+            delete std::exchange(node, node->next.load(std::memory_order_relaxed));
+        }
+    }
+
+    // Starts a resize once the current table is full and helps the one in progress
+    void Grow() {
+        auto table = table_.load();
+        auto next = table->next.load();
+        if (!next) {
+            if (ApproximateSize() <= table->buckets.size() * kMaxLoadFactor ||
+                table->growing.exchange(true)) {
+                return;
+            }
+            next = new Table(table->buckets.size() * 2);
+            table->next.store(next);
+        }
+        Migrate(table, next);
+    }
+
+    void Migrate(Table* table, Table* next) {
+        auto size = table->buckets.size();
+        auto begin = table->next_chunk.fetch_add(kMigrationChunk);
+        if (begin >= size) {
+            return;
+        }
+        auto end = std::min(begin + kMigrationChunk, size);
+        for (auto i = begin; i < end; ++i) {
+            auto& stripe = stripes_[StripeOf(i)];
+            std::scoped_lock lock(stripe.mutex);
+            WriteGuard guard(stripe);
+            auto& low = next->buckets[i];
+            auto& high = next->buckets[i + size];
+            auto node = table->buckets[i].exchange(nullptr, std::memory_order_relaxed);
+            while (node) {
+                auto& target = HashOf(node->key) & size ? high : low;
+                auto rest = node->next.load(std::memory_order_relaxed);
+                node->next.store(target.load(std::memory_order_relaxed), std::memory_order_relaxed);
+                target.store(node, std::memory_order_release);
+                node = rest;
+            }
+            table->moved[i].store(true, std::memory_order_release);
+        }
+        if (table->migrated.fetch_add(end - begin) + (end - begin) == size) {
+            table_.store(next);
+        }
+    }
+
+    void LockAll() {
+        for (auto& stripe : stripes_) {
+            stripe.mutex.lock();
+        }
+    }
+
+    void UnLockAll() {
+        for (auto& stripe : stripes_) {
+            stripe.mutex.unlock();
+        }
+    }
+
+    mutable std::vector<Stripe> stripes_;
+    size_t stripe_mask_;
     Hash hash_;
-    std::atomic <size_t> size_;
-    std::atomic<size_t> bucket_size_;
+    // Sum of the reported count changes of the stripes
+    std::atomic<size_t> approximate_size_{0};
+    std::atomic<Table*> table_;
+    Table* oldest_;
 };
 
 template <class K, class V, class Hash>
@@ -173,6 +636,3 @@ const int ConcurrentHashMap<K, V, Hash>::kDefaultConcurrencyLevel = 8;
 
 template <class K, class V, class Hash>
 const int ConcurrentHashMap<K, V, Hash>::kUndefinedSize = -1;
-
-template <class K, class V, class Hash>
-const int ConcurrentHashMap<K, V, Hash>::kMutexCount = -1;
\ No newline at end of file
@@ -0,0 +1,347 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "concurrent_hash_map.h"
+
+// Hash map with striped locks and open addressing, a drop-in alternative to
+// ConcurrentHashMap. Every stripe owns its own table: an array of control bytes and a
+// contiguous array of slots, probed linearly. A control byte of a full slot holds 7 bits of
+// the hash of its key, so a lookup scans control bytes that share a cache line and compares
+// keys only in the slots that match, usually one. Entries up to kMaxInlineEntry bytes are
+// stored in the slots, larger ones are allocated and the slot holds a pointer to them.
+// A stripe grows on its own under its lock, so a resize stalls the keys of one stripe only.
+template <class K, class V, class Hash = std::hash<K>>
+class FlatHashMap {
+    using Entry = std::pair<K, V>;
+
+    static constexpr size_t kMaxInlineEntry = 64;
+
+public:
+    // Whether the entries live in the slots or behind pointers
+    static constexpr bool kInlineEntries =
+        sizeof(Entry) <= kMaxInlineEntry && std::is_nothrow_move_constructible_v<Entry>;
+
+    FlatHashMap(const Hash& hasher = Hash()) : FlatHashMap(kUndefinedSize, hasher) {
+    }
+
+    explicit FlatHashMap(int expected_size, const Hash& hasher = Hash())
+        : FlatHashMap(expected_size, kDefaultConcurrencyLevel, hasher) {
+    }
+
+    // Every stripe owns a whole table, so their count does not depend on the threads
+    FlatHashMap(int expected_size, [[maybe_unused]] int expected_threads_count,
+                const Hash& hasher = Hash())
+        : stripes_(kStripes), hash_(hasher) {  // NOLINT
+        size_t capacity = kMinCapacity;
+        if (expected_size != kUndefinedSize) {
+            auto per_stripe = size_t(expected_size) / kStripes + 1;
+            while (capacity * kMaxLoadNumerator < per_stripe * kMaxLoadDenominator) {
+                capacity *= 2;
+            }
+        }
+        for (auto& stripe : stripes_) {
+            Allocate(stripe, capacity);
+        }
+    }
+
+    FlatHashMap(const FlatHashMap&) = delete;
+    FlatHashMap& operator=(const FlatHashMap&) = delete;
+
+    ~FlatHashMap() {
+        for (auto& stripe : stripes_) {
+            DestroyEntries(stripe);
+        }
+    }
+
+    bool Insert(const K& key, const V& value) {
+        auto h = HashOf(key);
+        auto& stripe = StripeOf(h);
+        std::scoped_lock lock(stripe.mutex);
+
+        auto mask = stripe.capacity - 1;
+        auto tag = TagOf(h);
+        auto deleted = kNotFound;
+        auto i = HomeOf(h, mask);
+        for (;; i = (i + 1) & mask) {
+            auto control = stripe.control[i];
+            if (control == kEmpty) {
+                break;
+            }
+            if (control == kDeleted) {
+                if (deleted == kNotFound) {
+                    deleted = i;
+                }
+            } else if (control == tag && Get(stripe.slots[i]).first == key) {
+                return false;
+            }
+        }
+
+        if (deleted != kNotFound) {
+            i = deleted;
+        } else if ((stripe.used + 1) * kMaxLoadDenominator > stripe.capacity * kMaxLoadNumerator) {
+            Rehash(stripe);
+            i = FindEmpty(stripe, h);
+            ++stripe.used;
+        } else {
+            ++stripe.used;
+        }
+        Construct(stripe, i, tag, key, value);
+        stripe.size.store(stripe.size.load(std::memory_order_relaxed) + 1,
+                          std::memory_order_relaxed);
+        return true;
+    }
+
+    bool Erase(const K& key) {
+        auto h = HashOf(key);
+        auto& stripe = StripeOf(h);
+        std::scoped_lock lock(stripe.mutex);
+
+        auto i = FindSlot(stripe, key, h);
+        if (i == kNotFound) {
+            return false;
+        }
+        Destroy(stripe.slots[i]);
+        // No probe passes through a slot followed by an empty one, it can be empty as well
+        if (stripe.control[(i + 1) & (stripe.capacity - 1)] == kEmpty) {
+            stripe.control[i] = kEmpty;
+            --stripe.used;
+        } else {
+            stripe.control[i] = kDeleted;
+        }
+        stripe.size.store(stripe.size.load(std::memory_order_relaxed) - 1,
+                          std::memory_order_relaxed);
+        return true;
+    }
+
+    // Keeps the capacity, like std::unordered_map::clear
+    void Clear() {
+        for (auto& stripe : stripes_) {
+            stripe.mutex.lock();
+        }
+        for (auto& stripe : stripes_) {
+            DestroyEntries(stripe);
+            std::memset(stripe.control.get(), kEmpty, stripe.capacity);
+            stripe.used = 0;
+            stripe.size.store(0, std::memory_order_relaxed);
+        }
+        for (auto& stripe : stripes_) {
+            stripe.mutex.unlock();
+        }
+    }
+
+    std::pair<bool, V> Find(const K& key) const {
+        auto h = HashOf(key);
+        auto& stripe = StripeOf(h);
+        std::scoped_lock lock(stripe.mutex);
+
+        auto i = FindSlot(stripe, key, h);
+        if (i == kNotFound) {
+            return {false, V()};
+        }
+        return {true, Get(stripe.slots[i]).second};
+    }
+
+    const V At(const K& key) const {
+        auto h = HashOf(key);
+        auto& stripe = StripeOf(h);
+        std::scoped_lock lock(stripe.mutex);
+
+        auto i = FindSlot(stripe, key, h);
+        if (i == kNotFound) {
+            throw std::out_of_range("");
+        }
+        return Get(stripe.slots[i]).second;
+    }
+
+    size_t Size() const {
+        size_t size = 0;
+        for (const auto& stripe : stripes_) {
+            size += stripe.size.load(std::memory_order_relaxed);
+        }
+        return size;
+    }
+
+    // Slots of all stripes
+    size_t BucketCount() const {
+        size_t count = 0;
+        for (auto& stripe : stripes_) {
+            std::scoped_lock lock(stripe.mutex);
+            count += stripe.capacity;
+        }
+        return count;
+    }
+
+    static const int kDefaultConcurrencyLevel;
+    static const int kUndefinedSize;
+
+private:
+    // A power of two, the stripe is taken from the low bits of the hash
+    static constexpr size_t kStripes = 64;
+    static constexpr size_t kStripeBits = 6;
+    static_assert(kStripes == size_t(1) << kStripeBits);
+    static constexpr size_t kMinCapacity = 16;
+    // Full and deleted slots of a stripe take at most 3/4 of it
+    static constexpr size_t kMaxLoadNumerator = 3;
+    static constexpr size_t kMaxLoadDenominator = 4;
+    static constexpr size_t kNotFound = SIZE_MAX;
+
+    // Control bytes, a full slot has the high bit set and 7 bits of the hash in the rest
+    static constexpr uint8_t kEmpty = 0;
+    static constexpr uint8_t kDeleted = 1;
+
+    using Stored = std::conditional_t<kInlineEntries, Entry, std::unique_ptr<Entry>>;
+
+    // Constructed only when the control byte says the slot is full
+    union Slot {
+        Slot() {
+        }
+        ~Slot() {
+        }
+
+        Stored stored;
+    };
+
+    struct alignas(64) Stripe {
+        std::mutex mutex;
+        // Written under the lock, read by Size without it
+        std::atomic<size_t> size{0};
+        // Full and deleted slots
+        size_t used = 0;
+        size_t capacity = 0;
+        std::unique_ptr<uint8_t[]> control;
+        std::unique_ptr<Slot[]> slots;
+    };
+
+    static Entry& Get(Slot& slot) {
+        if constexpr (kInlineEntries) {
+            return slot.stored;
+        } else {
+            return *slot.stored;
+        }
+    }
+
+    static const Entry& Get(const Slot& slot) {
+        return Get(const_cast<Slot&>(slot));
+    }
+
+    size_t HashOf(const K& key) const {
+        return MixHash(hash_(key));
+    }
+
+    Stripe& StripeOf(size_t h) const {
+        return stripes_[h & (kStripes - 1)];
+    }
+
+    static size_t HomeOf(size_t h, size_t mask) {
+        return (h >> kStripeBits) & mask;
+    }
+
+    static uint8_t TagOf(size_t h) {
+        return 0x80 | uint8_t(h >> 57);
+    }
+
+    // Slot of the key or kNotFound, the stripe lock has to be held
+    size_t FindSlot(const Stripe& stripe, const K& key, size_t h) const {
+        auto mask = stripe.capacity - 1;
+        auto tag = TagOf(h);
+        for (auto i = HomeOf(h, mask);; i = (i + 1) & mask) {
+            auto control = stripe.control[i];
+            if (control == kEmpty) {
+                return kNotFound;
+            }
+            if (control == tag && Get(stripe.slots[i]).first == key) {
+                return i;
+            }
+        }
+    }
+
+    static size_t FindEmpty(const Stripe& stripe, size_t h) {
+        auto mask = stripe.capacity - 1;
+        auto i = HomeOf(h, mask);
+        while (stripe.control[i] != kEmpty) {
+            i = (i + 1) & mask;
+        }
+        return i;
+    }
+
+    static void Allocate(Stripe& stripe, size_t capacity) {
+        stripe.control.reset(new uint8_t[capacity]);
+        std::memset(stripe.control.get(), kEmpty, capacity);
+        stripe.slots.reset(new Slot[capacity]);
+        stripe.capacity = capacity;
+        stripe.used = 0;
+    }
+
+    static void Construct(Stripe& stripe, size_t i, uint8_t tag, const K& key, const V& value) {
+        if constexpr (kInlineEntries) {
+            new (&stripe.slots[i].stored) Stored(key, value);
+        } else {
+            new (&stripe.slots[i].stored) Stored(std::make_unique<Entry>(key, value));
+        }
+        stripe.control[i] = tag;
+    }
+
+    static void Destroy(Slot& slot) {
+        slot.stored.~Stored();
+    }
+
+    static void DestroyEntries(Stripe& stripe) {
+        for (size_t i = 0; i < stripe.capacity; ++i) {
+            if (stripe.control[i] & 0x80) {
+                Destroy(stripe.slots[i]);
+            }
+        }
+    }
+
+    // Drops the deleted slots, and doubles the stripe unless they were most of its load
+    void Rehash(Stripe& stripe) {
+        auto capacity = stripe.capacity;
+        auto size = stripe.size.load(std::memory_order_relaxed);
+        if ((size + 1) * 2 * kMaxLoadDenominator > capacity * kMaxLoadNumerator) {
+            capacity *= 2;
+        }
+        Stripe old;
+        std::swap(old.control, stripe.control);
+        std::swap(old.slots, stripe.slots);
+        old.capacity = stripe.capacity;
+        try {
+            Allocate(stripe, capacity);
+        } catch (...) {
+            std::swap(old.control, stripe.control);
+            std::swap(old.slots, stripe.slots);
+            throw;
+        }
+
+        for (size_t i = 0; i < old.capacity; ++i) {
+            if (!(old.control[i] & 0x80)) {
+                continue;
+            }
+            auto h = HashOf(Get(old.slots[i]).first);
+            auto j = FindEmpty(stripe, h);
+            new (&stripe.slots[j].stored) Stored(std::move(old.slots[i].stored));
+            Destroy(old.slots[i]);
+            stripe.control[j] = old.control[i];
+        }
+        stripe.used = size;
+    }
+
+    mutable std::vector<Stripe> stripes_;
+    Hash hash_;
+};
+
+template <class K, class V, class Hash>
+const int FlatHashMap<K, V, Hash>::kDefaultConcurrencyLevel = 8;
+
+template <class K, class V, class Hash>
+const int FlatHashMap<K, V, Hash>::kUndefinedSize = -1;
@@ -1,8 +1,14 @@
+#include <algorithm>
+#include <random>
 #include <thread>
 #include <vector>
 
+#include <malloc.h>
+
 #include <benchmark/benchmark.h>
 #include <concurrent_hash_map.h>
+#include <flat_hash_map.h>
+#include <swiss_hash_map.h>
 
 #include "commons.h"
 
@@ -58,7 +64,7 @@ void ManySearches(benchmark::State& state) {
         if (state.thread_index == 0) {
             test_table->Insert(rnd(), 1);
         } else {
-            test_table->Find(rnd());
+            benchmark::DoNotOptimize(test_table->Find(rnd()));
         }
     }
 
@@ -86,9 +92,279 @@ void Deletions(benchmark::State& state) {
     }
 }
 
+// Counts random keys of a small range, the way it had to be done before Upsert: a lookup,
+// then an erase and an insert, each under its own lock, and racy
+void CountersFindInsert(benchmark::State& state) {
+    if (state.thread_index == 0) {
+        test_table.reset(new ConcurrentHashMap<int, int>(undefined_size, state.threads));
+    }
+
+    Random rnd(kSeed + state.thread_index, 0, 10000);
+    while (state.KeepRunning()) {
+        auto key = rnd();
+        auto [found, count] = test_table->Find(key);
+        if (found) {
+            test_table->Erase(key);
+        }
+        test_table->Insert(key, count + 1);
+    }
+
+    if (state.thread_index == 0) {
+        test_table.reset();
+    }
+}
+
+void CountersUpsert(benchmark::State& state) {
+    if (state.thread_index == 0) {
+        test_table.reset(new ConcurrentHashMap<int, int>(undefined_size, state.threads));
+    }
+
+    Random rnd(kSeed + state.thread_index, 0, 10000);
+    while (state.KeepRunning()) {
+        test_table->Upsert(rnd(), 1, [](int& count) { ++count; });
+    }
+
+    if (state.thread_index == 0) {
+        test_table.reset();
+    }
+}
+
+// Smallest key that the table puts into the stripe
+int KeyOfStripe(const ConcurrentHashMap<int, int>& table, size_t stripe) {
+    int key = 0;
+    while ((MixHash(std::hash<int>()(key)) & (table.StripeCount() - 1)) != stripe) {
+        ++key;
+    }
+    return key;
+}
+
+// Every thread inserts a key that is already there, so it writes only the lock of its stripe.
+// The stripes of the threads are neighbours and would share cache lines without padding.
+void DisjointStripes(benchmark::State& state) {
+    if (state.thread_index == 0) {
+        test_table.reset(new ConcurrentHashMap<int, int>(undefined_size, state.threads));
+    }
+
+    int key = -1;
+    while (state.KeepRunning()) {
+        if (key < 0) {
+            key = KeyOfStripe(*test_table, state.thread_index);
+        }
+        test_table->Insert(key, 1);
+    }
+
+    if (state.thread_index == 0) {
+        test_table.reset();
+    }
+}
+
+// Table of 1M keys, larger than the caches, filled once for the batch benchmarks
+const ConcurrentHashMap<int, int>& BatchTable() {
+    static auto table = [] {
+        auto table = std::make_unique<ConcurrentHashMap<int, int>>(1 << 20);
+        for (int i = 0; i < (1 << 20); ++i) {
+            table->Insert(i, i);
+        }
+        return table;
+    }();
+    return *table;
+}
+
+// Random keys, half of them missing, a multiple of every batch size
+std::vector<int> BatchKeys() {
+    std::vector<int> keys(1 << 16);
+    std::generate(keys.begin(), keys.end(), Random(kSeed, 0, 1 << 21));
+    return keys;
+}
+
+// Batches of range(0) keys looked up one by one
+void BatchFind(benchmark::State& state) {
+    const auto& table = BatchTable();
+    auto keys = BatchKeys();
+    size_t batch = state.range(0);
+    std::vector<std::pair<bool, int>> out(batch);
+    size_t begin = 0;
+    for (auto _ : state) {
+        for (size_t i = 0; i < batch; ++i) {
+            out[i] = table.Find(keys[begin + i]);
+        }
+        benchmark::DoNotOptimize(out.data());
+        begin = (begin + batch) % keys.size();
+    }
+    state.SetItemsProcessed(state.iterations() * batch);
+}
+
+void BatchFindMany(benchmark::State& state) {
+    const auto& table = BatchTable();
+    auto keys = BatchKeys();
+    size_t batch = state.range(0);
+    std::vector<std::pair<bool, int>> out(batch);
+    size_t begin = 0;
+    for (auto _ : state) {
+        table.FindMany(std::span(keys).subspan(begin, batch), out);
+        benchmark::DoNotOptimize(out.data());
+        begin = (begin + batch) % keys.size();
+    }
+    state.SetItemsProcessed(state.iterations() * batch);
+}
+
+// Every thread only reads, the table is filled once
+template <class Map>
+void Readers(benchmark::State& state) {
+    static std::unique_ptr<Map> table;
+    if (state.thread_index == 0) {
+        table.reset(new Map(undefined_size, state.threads));
+        for (int i = 0; i < 100000; ++i) {
+            table->Insert(i, 1);
+        }
+    }
+
+    Random rnd(kSeed - state.thread_index - 1, 0, 200000);
+    int64_t found = 0;
+    while (state.KeepRunning()) {
+        found += table->Find(rnd()).first;
+    }
+    benchmark::DoNotOptimize(found);
+
+    if (state.thread_index == 0) {
+        table.reset();
+    }
+}
+
+// One thread fills an empty table with range(0) keys, the table grows all the way
+template <class Map>
+void GrowingInsertions(benchmark::State& state) {
+    for (auto _ : state) {
+        // Frees the heap left by the previous benchmark, which glibc would otherwise
+        // consolidate at the first large allocation here
+        state.PauseTiming();
+        malloc_trim(0);
+        auto table = std::make_unique<Map>();
+        state.ResumeTiming();
+
+        Random random(kSeed);
+        for (int i = 0; i < state.range(0); ++i) {
+            table->Insert(random(), 1);
+        }
+
+        state.PauseTiming();
+        table.reset();
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+// Heap bytes in use, glibc only
+size_t HeapInUse() {
+    return mallinfo2().uordblks;
+}
+
+// Fills a table with range(0) distinct keys and reports its heap bytes per entry. Each value
+// is the index of the next key to look up, so the lookups are dependent and the time is the
+// latency of one Find rather than the throughput of overlapping ones.
+template <class Map>
+void LookupLatency(benchmark::State& state) {
+    auto count = static_cast<int>(state.range(0));
+    std::vector<int> keys(count);
+    for (int i = 0; i < count; ++i) {
+        keys[i] = static_cast<int>(static_cast<uint32_t>(i) * 2654435761u);
+    }
+    std::shuffle(keys.begin(), keys.end(), std::mt19937(kSeed));
+
+    auto before = HeapInUse();
+    auto table = std::make_unique<Map>();
+    for (int i = 0; i < count; ++i) {
+        table->Insert(keys[i], (i + 1) % count);
+    }
+    state.counters["bytes_per_entry"] = double(HeapInUse() - before) / count;
+
+    int next = 0;
+    for (auto _ : state) {
+        next = table->Find(keys[next]).second;
+    }
+    benchmark::DoNotOptimize(next);
+}
+
+// Independent lookups of present keys, which the CPU overlaps
+template <class Map>
+void LookupThroughput(benchmark::State& state) {
+    auto count = static_cast<int>(state.range(0));
+    std::vector<int> keys(count);
+    for (int i = 0; i < count; ++i) {
+        keys[i] = static_cast<int>(static_cast<uint32_t>(i) * 2654435761u);
+    }
+    Map table;
+    for (auto key : keys) {
+        table.Insert(key, 1);
+    }
+    std::shuffle(keys.begin(), keys.end(), std::mt19937(kSeed));
+
+    int64_t found = 0;
+    size_t i = 0;
+    for (auto _ : state) {
+        found += table.Find(keys[i]).second;
+        i = i + 1 == keys.size() ? 0 : i + 1;
+    }
+    benchmark::DoNotOptimize(found);
+    state.SetItemsProcessed(state.iterations());
+}
+
 BENCHMARK(RandomInsertions)->Threads(4)->Threads(8)->UseRealTime();
 BENCHMARK(SpecialInsertions)->Threads(4)->Threads(8)->UseRealTime();
 BENCHMARK(ManySearches)->Threads(4)->Threads(8)->UseRealTime();
 BENCHMARK(Deletions)->Threads(4)->Threads(8)->UseRealTime();
+BENCHMARK(DisjointStripes)->ThreadRange(1, 8)->UseRealTime();
+BENCHMARK(CountersFindInsert)->ThreadRange(1, 8)->UseRealTime();
+BENCHMARK(CountersUpsert)->ThreadRange(1, 8)->UseRealTime();
+BENCHMARK(BatchFind)->RangeMultiplier(4)->Range(4, 1024);
+BENCHMARK(BatchFindMany)->RangeMultiplier(4)->Range(4, 1024);
+BENCHMARK_TEMPLATE(Readers, ConcurrentHashMap<int, int>)->ThreadRange(1, 8)->UseRealTime();
+BENCHMARK_TEMPLATE(Readers, FlatHashMap<int, int>)->ThreadRange(1, 8)->UseRealTime();
+BENCHMARK_TEMPLATE(Readers, SwissHashMap<int, int>)->ThreadRange(1, 8)->UseRealTime();
+BENCHMARK_TEMPLATE(GrowingInsertions, ConcurrentHashMap<int, int>)
+    ->Arg(1 << 16)
+    ->Arg(1 << 20)
+    ->Arg(1 << 23)
+    ->Unit(benchmark::kMillisecond)
+    ->Iterations(3);
+BENCHMARK_TEMPLATE(GrowingInsertions, FlatHashMap<int, int>)
+    ->Arg(1 << 16)
+    ->Arg(1 << 20)
+    ->Arg(1 << 23)
+    ->Unit(benchmark::kMillisecond)
+    ->Iterations(3);
+BENCHMARK_TEMPLATE(GrowingInsertions, SwissHashMap<int, int>)
+    ->Arg(1 << 16)
+    ->Arg(1 << 20)
+    ->Arg(1 << 23)
+    ->Unit(benchmark::kMillisecond)
+    ->Iterations(3);
+BENCHMARK_TEMPLATE(LookupLatency, ConcurrentHashMap<int, int>)
+    ->Arg(1 << 10)
+    ->Arg(1 << 16)
+    ->Arg(1 << 20)
+    ->Arg(1 << 22);
+BENCHMARK_TEMPLATE(LookupLatency, FlatHashMap<int, int>)
+    ->Arg(1 << 10)
+    ->Arg(1 << 16)
+    ->Arg(1 << 20)
+    ->Arg(1 << 22);
+BENCHMARK_TEMPLATE(LookupLatency, SwissHashMap<int, int>)
+    ->Arg(1 << 10)
+    ->Arg(1 << 16)
+    ->Arg(1 << 20)
+    ->Arg(1 << 22);
+BENCHMARK_TEMPLATE(LookupThroughput, ConcurrentHashMap<int, int>)
+    ->Arg(1 << 10)
+    ->Arg(1 << 16)
+    ->Arg(1 << 20);
+BENCHMARK_TEMPLATE(LookupThroughput, FlatHashMap<int, int>)
+    ->Arg(1 << 10)
+    ->Arg(1 << 16)
+    ->Arg(1 << 20);
+BENCHMARK_TEMPLATE(LookupThroughput, SwissHashMap<int, int>)
+    ->Arg(1 << 10)
+    ->Arg(1 << 16)
+    ->Arg(1 << 20);
 
 BENCHMARK_MAIN();
@@ -0,0 +1,459 @@
+#pragma once
+
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#if defined(__SSE2__) && !defined(SWISS_HASH_MAP_NO_SIMD)
+#include <emmintrin.h>
+#define SWISS_HASH_MAP_SSE2 1
+#endif
+
+#include "concurrent_hash_map.h"
+
+// Concurrent Swiss table for word-sized keys and values, the same interface as
+// ConcurrentHashMap. Like FlatHashMap, the low bits of the hash pick one of the segments and
+// every segment owns its own table, grown under the segment lock that serializes writers.
+// A table is an array of groups of 16 slots with a control byte per slot: empty, deleted or
+// 7 bits of the hash of the key. Groups are probed quadratically and a lookup matches all
+// 16 control bytes against the hash at once, with SSE2 or with bit tricks on two words.
+// Each group has a version word, odd while a writer changes it, and readers lock nothing:
+// they read a group and retry it if its version has moved. A grown table leaves the old one
+// frozen for the readers still in it, old tables are freed with the map.
+template <class K, class V, class Hash = std::hash<K>>
+class SwissHashMap {
+    static_assert(IsSeqlockReadable<K>() && IsSeqlockReadable<V>(),
+                  "SwissHashMap reads keys and values while they are written, "
+                  "use ConcurrentHashMap or FlatHashMap for larger types");
+
+public:
+    SwissHashMap(const Hash& hasher = Hash()) : SwissHashMap(kUndefinedSize, hasher) {
+    }
+
+    explicit SwissHashMap(int expected_size, const Hash& hasher = Hash())
+        : SwissHashMap(expected_size, kDefaultConcurrencyLevel, hasher) {
+    }
+
+    // Every segment owns a whole table, so their count does not depend on the threads
+    SwissHashMap(int expected_size, [[maybe_unused]] int expected_threads_count,
+                 const Hash& hasher = Hash())
+        : segments_(kSegments), hash_(hasher) {  // NOLINT
+        size_t groups = 1;
+        if (expected_size != kUndefinedSize) {
+            auto per_segment = size_t(expected_size) / kSegments + 1;
+            while (groups * kGroupSize * kMaxLoadNumerator < per_segment * kMaxLoadDenominator) {
+                groups *= 2;
+            }
+        }
+        for (auto& segment : segments_) {
+            segment.tables.push_back(std::make_unique<Table>(groups));
+            Publish(segment);
+        }
+    }
+
+    SwissHashMap(const SwissHashMap&) = delete;
+    SwissHashMap& operator=(const SwissHashMap&) = delete;
+
+    bool Insert(const K& key, const V& value) {
+        auto h = HashOf(key);
+        auto& segment = SegmentOf(h);
+        std::scoped_lock lock(segment.mutex);
+
+        auto table = segment.tables.back().get();
+        auto tag = TagOf(h);
+        Group* target = nullptr;
+        int target_slot = 0;
+        bool target_empty = false;
+        for (auto probe = Probe(h, table->mask);; probe.Next()) {
+            auto& group = table->groups[probe.group];
+            auto control = group.Control();
+            for (auto match = Match(control, tag); match; match &= match - 1) {
+                if (group.slots[std::countr_zero(match)].first == key) {
+                    return false;
+                }
+            }
+            auto empty = MatchEmpty(control);
+            if (!target) {
+                if (auto free = empty | MatchDeleted(control)) {
+                    target = &group;
+                    target_slot = std::countr_zero(free);
+                    target_empty = (empty >> target_slot) & 1;
+                }
+            }
+            if (empty) {
+                break;
+            }
+        }
+
+        if (target_empty) {
+            if ((segment.used + 1) * kMaxLoadDenominator >
+                table->Capacity() * kMaxLoadNumerator) {
+                table = Rehash(segment);
+                target = FindFree(*table, h, target_slot);
+            }
+            ++segment.used;
+        }
+        {
+            WriteGuard guard(*target);
+            std::atomic_ref<K>(target->slots[target_slot].first)
+                .store(key, std::memory_order_relaxed);
+            std::atomic_ref<V>(target->slots[target_slot].second)
+                .store(value, std::memory_order_relaxed);
+            target->SetControl(target_slot, tag);
+        }
+        segment.size.store(segment.size.load(std::memory_order_relaxed) + 1,
+                           std::memory_order_relaxed);
+        return true;
+    }
+
+    bool Erase(const K& key) {
+        auto h = HashOf(key);
+        auto& segment = SegmentOf(h);
+        std::scoped_lock lock(segment.mutex);
+
+        auto table = segment.tables.back().get();
+        auto tag = TagOf(h);
+        for (auto probe = Probe(h, table->mask);; probe.Next()) {
+            auto& group = table->groups[probe.group];
+            auto control = group.Control();
+            for (auto match = Match(control, tag); match; match &= match - 1) {
+                auto slot = std::countr_zero(match);
+                if (group.slots[slot].first != key) {
+                    continue;
+                }
+                // A group with an empty slot has never been full, so no probe went past it
+                // and the slot can be empty again
+                auto empty = MatchEmpty(control) != 0;
+                {
+                    WriteGuard guard(group);
+                    group.SetControl(slot, empty ? kEmpty : kDeleted);
+                }
+                segment.used -= empty;
+                segment.size.store(segment.size.load(std::memory_order_relaxed) - 1,
+                                   std::memory_order_relaxed);
+                return true;
+            }
+            if (MatchEmpty(control)) {
+                return false;
+            }
+        }
+    }
+
+    // Keeps the capacity, like std::unordered_map::clear
+    void Clear() {
+        for (auto& segment : segments_) {
+            segment.mutex.lock();
+        }
+        for (auto& segment : segments_) {
+            auto table = segment.tables.back().get();
+            for (size_t i = 0; i <= table->mask; ++i) {
+                auto& group = table->groups[i];
+                WriteGuard guard(group);
+                group.control[0].store(kEmptyWord, std::memory_order_relaxed);
+                group.control[1].store(kEmptyWord, std::memory_order_relaxed);
+            }
+            segment.used = 0;
+            segment.size.store(0, std::memory_order_relaxed);
+        }
+        for (auto& segment : segments_) {
+            segment.mutex.unlock();
+        }
+    }
+
+    std::pair<bool, V> Find(const K& key) const {
+        auto h = HashOf(key);
+        auto [groups, mask] = Unpack(SegmentOf(h).current.load(std::memory_order_acquire));
+        auto tag = TagOf(h);
+        for (auto probe = Probe(h, mask);; probe.Next()) {
+            auto& group = groups[probe.group];
+            for (int spins = 0;; ++spins) {
+                auto version = group.version.load(std::memory_order_acquire);
+                if (version & 1) {
+                    // The writer may have been preempted
+                    if (spins >= kSpinsBeforeYield) {
+                        std::this_thread::yield();
+                    }
+                    continue;
+                }
+                auto control = group.Control();
+                bool found = false;
+                V value{};
+                for (auto match = Match(control, tag); match; match &= match - 1) {
+                    auto& slot = group.slots[std::countr_zero(match)];
+                    if (std::atomic_ref<K>(slot.first).load(std::memory_order_relaxed) == key) {
+                        found = true;
+                        value = std::atomic_ref<V>(slot.second).load(std::memory_order_relaxed);
+                        break;
+                    }
+                }
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (group.version.load(std::memory_order_relaxed) != version) {
+                    continue;
+                }
+                if (found) {
+                    return {true, value};
+                }
+                if (MatchEmpty(control)) {
+                    return {false, V()};
+                }
+                break;
+            }
+        }
+    }
+
+    const V At(const K& key) const {
+        auto [found, value] = Find(key);
+        if (!found) {
+            throw std::out_of_range("");
+        }
+        return value;
+    }
+
+    size_t Size() const {
+        size_t size = 0;
+        for (const auto& segment : segments_) {
+            size += segment.size.load(std::memory_order_relaxed);
+        }
+        return size;
+    }
+
+    // Slots of all segments
+    size_t BucketCount() const {
+        size_t count = 0;
+        for (const auto& segment : segments_) {
+            count += (Unpack(segment.current.load()).second + 1) * kGroupSize;
+        }
+        return count;
+    }
+
+    static const int kDefaultConcurrencyLevel;
+    static const int kUndefinedSize;
+
+private:
+    // A power of two, the segment is taken from the low bits of the hash
+    static constexpr size_t kSegments = 64;
+    static constexpr int kSegmentBits = 6;
+    static_assert(kSegments == size_t(1) << kSegmentBits);
+    static constexpr size_t kGroupSize = 16;
+    // Full and deleted slots of a segment take at most 7/8 of it
+    static constexpr size_t kMaxLoadNumerator = 7;
+    static constexpr size_t kMaxLoadDenominator = 8;
+    static constexpr int kSpinsBeforeYield = 64;
+    // User space addresses fit below it
+    static constexpr int kCountShift = 56;
+
+    // Control bytes: a full slot holds 7 bits of the hash, the high bit marks the others
+    static constexpr uint8_t kEmpty = 0x80;
+    static constexpr uint8_t kDeleted = 0xfe;
+    static constexpr uint64_t kEmptyWord = 0x8080808080808080ULL;
+    static constexpr uint64_t kLowBits = 0x0101010101010101ULL;
+
+    using Entry = std::pair<K, V>;
+
+    struct Group {
+        Group() {
+            control[0].store(kEmptyWord, std::memory_order_relaxed);
+            control[1].store(kEmptyWord, std::memory_order_relaxed);
+        }
+
+        // Written as whole words, so that readers can load them while they change
+        std::atomic<uint64_t> control[2];
+        std::atomic<uint32_t> version{0};
+        Entry slots[kGroupSize];
+
+        std::pair<uint64_t, uint64_t> Control() const {
+            return {control[0].load(std::memory_order_relaxed),
+                    control[1].load(std::memory_order_relaxed)};
+        }
+
+        // The writer has to hold the segment lock and a WriteGuard of the group
+        void SetControl(int slot, uint8_t value) {
+            auto& word = control[slot / 8];
+            auto shift = (slot % 8) * 8;
+            auto bits = word.load(std::memory_order_relaxed);
+            bits = (bits & ~(uint64_t(0xff) << shift)) | (uint64_t(value) << shift);
+            word.store(bits, std::memory_order_relaxed);
+        }
+    };
+
+    struct Table {
+        explicit Table(size_t groups_count)
+            : groups(new Group[groups_count]), mask(groups_count - 1) {
+        }
+
+        size_t Capacity() const {
+            return (mask + 1) * kGroupSize;
+        }
+
+        std::unique_ptr<Group[]> groups;
+        size_t mask;
+    };
+
+    struct alignas(64) Segment {
+        std::mutex mutex;
+        // Written under the lock, read by Size without it
+        std::atomic<size_t> size{0};
+        // Full and deleted slots of the current table
+        size_t used = 0;
+        // Groups of the current table with the log of their count in the top byte, so that a
+        // reader gets both with one load
+        std::atomic<uint64_t> current{0};
+        // The current table is the last one, the rest are kept for readers
+        std::vector<std::unique_ptr<Table>> tables;
+    };
+
+    // Makes the version of the group odd for its lifetime
+    class WriteGuard {
+    public:
+        explicit WriteGuard(Group& group) : version_(group.version) {
+            version_.store(version_.load(std::memory_order_relaxed) + 1,
+                           std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+        }
+
+        ~WriteGuard() {
+            version_.store(version_.load(std::memory_order_relaxed) + 1,
+                           std::memory_order_release);
+        }
+
+    private:
+        std::atomic<uint32_t>& version_;
+    };
+
+    // Triangular numbers of groups, visits every group of a power of two table
+    struct Probe {
+        Probe(size_t h, size_t mask) : group((h >> kSegmentBits) & mask), mask(mask) {
+        }
+
+        void Next() {
+            ++step;
+            group = (group + step) & mask;
+        }
+
+        size_t group;
+        size_t mask;
+        size_t step = 0;
+    };
+
+#ifdef SWISS_HASH_MAP_SSE2
+    static __m128i Load(std::pair<uint64_t, uint64_t> control) {
+        return _mm_set_epi64x(control.second, control.first);
+    }
+
+    // Bit i is set if slot i holds the byte
+    static uint32_t Match(std::pair<uint64_t, uint64_t> control, uint8_t byte) {
+        return _mm_movemask_epi8(_mm_cmpeq_epi8(Load(control), _mm_set1_epi8(byte)));
+    }
+#else
+    // Sets the high bit of the bytes that are zero, and may set it for a byte above a zero one
+    static uint64_t ZeroBytes(uint64_t word) {
+        return (word - kLowBits) & ~word & (kLowBits << 7);
+    }
+
+    // The high bits of the bytes, one per bit
+    static uint32_t Pack(uint64_t high_bits) {
+        return ((high_bits >> 7) * 0x0102040810204080ULL) >> 56;
+    }
+
+    // Bit i is set if slot i holds the byte. A false positive is a byte one bit off the match
+    // above a true one: a tag that fails on the key, never a full slot for kEmpty or kDeleted.
+    static uint32_t Match(std::pair<uint64_t, uint64_t> control, uint8_t byte) {
+        auto pattern = kLowBits * byte;
+        return Pack(ZeroBytes(control.first ^ pattern)) |
+               Pack(ZeroBytes(control.second ^ pattern)) << 8;
+    }
+#endif
+
+    static uint32_t MatchEmpty(std::pair<uint64_t, uint64_t> control) {
+        return Match(control, kEmpty);
+    }
+
+    static uint32_t MatchDeleted(std::pair<uint64_t, uint64_t> control) {
+        return Match(control, kDeleted);
+    }
+
+    size_t HashOf(const K& key) const {
+        return MixHash(hash_(key));
+    }
+
+    Segment& SegmentOf(size_t h) const {
+        return segments_[h & (kSegments - 1)];
+    }
+
+    static uint8_t TagOf(size_t h) {
+        return h >> 57;
+    }
+
+    static void Publish(Segment& segment) {
+        auto& table = *segment.tables.back();
+        auto bits = reinterpret_cast<uint64_t>(table.groups.get());
+        segment.current.store(bits | uint64_t(std::countr_zero(table.mask + 1)) << kCountShift,
+                              std::memory_order_release);
+    }
+
+    static std::pair<Group*, size_t> Unpack(uint64_t current) {
+        return {reinterpret_cast<Group*>(current & ((uint64_t(1) << kCountShift) - 1)),
+                (size_t(1) << (current >> kCountShift)) - 1};
+    }
+
+    // First empty or deleted slot on the probe of the hash
+    static Group* FindFree(Table& table, size_t h, int& slot) {
+        for (auto probe = Probe(h, table.mask);; probe.Next()) {
+            auto& group = table.groups[probe.group];
+            auto control = group.Control();
+            if (auto free = MatchEmpty(control) | MatchDeleted(control)) {
+                slot = std::countr_zero(free);
+                return &group;
+            }
+        }
+    }
+
+    // Copies the entries into a new table, twice larger unless deleted slots were most of the
+    // load. Nothing writes to the old table any more, readers in it see it as it was.
+    Table* Rehash(Segment& segment) {
+        auto old = segment.tables.back().get();
+        auto groups = old->mask + 1;
+        auto size = segment.size.load(std::memory_order_relaxed);
+        if ((size + 1) * 2 * kMaxLoadDenominator > old->Capacity() * kMaxLoadNumerator) {
+            groups *= 2;
+        }
+        auto table = std::make_unique<Table>(groups);
+        for (size_t i = 0; i <= old->mask; ++i) {
+            auto& group = old->groups[i];
+            auto control = group.Control();
+            for (int slot = 0; slot < int(kGroupSize); ++slot) {
+                auto word = slot < 8 ? control.first : control.second;
+                auto byte = uint8_t(word >> (slot % 8 * 8));
+                if (byte & kEmpty) {
+                    continue;
+                }
+                auto& entry = group.slots[slot];
+                int target_slot;
+                auto target = FindFree(*table, HashOf(entry.first), target_slot);
+                target->slots[target_slot] = entry;
+                target->SetControl(target_slot, byte);
+            }
+        }
+        segment.used = size;
+        segment.tables.push_back(std::move(table));
+        Publish(segment);
+        return segment.tables.back().get();
+    }
+
+    mutable std::vector<Segment> segments_;
+    Hash hash_;
+};
+
+template <class K, class V, class Hash>
+const int SwissHashMap<K, V, Hash>::kDefaultConcurrencyLevel = 8;
+
+template <class K, class V, class Hash>
+const int SwissHashMap<K, V, Hash>::kUndefinedSize = -1;
@@ -1,12 +1,16 @@
 #include <concurrent_hash_map.h>
+#include <flat_hash_map.h>
+#include <swiss_hash_map.h>
 #include "commons.h"
 
+#include <memory>
 #include <string>
 #include <random>
 #include <unordered_set>
 #include <utility>
 #include <vector>
 #include <functional>
+#include <optional>
 #include <stdexcept>
 #include <queue>
 #include <algorithm>
@@ -82,6 +86,185 @@ TEST(Correctness, Clear) {
     ASSERT_TRUE(table.Insert(1, 1));
 }
 
+TEST(Correctness, Growth) {
+    const int count = 100000;
+    ConcurrentHashMap<int, int> table;
+    auto initial_buckets = table.BucketCount();
+    for (int i = 0; i < count; ++i) {
+        ASSERT_TRUE(table.Insert(i, i));
+        ASSERT_LE(table.Size(), 2 * table.BucketCount());
+    }
+    ASSERT_GT(table.BucketCount(), initial_buckets);
+    for (int i = 0; i < count; ++i) {
+        ASSERT_EQ(i, table.At(i));
+    }
+    ASSERT_FALSE(table.Find(count).first);
+
+    // Sized up front, the table does not grow
+    ConcurrentHashMap<int, int> sized(count);
+    auto buckets = sized.BucketCount();
+    for (int i = 0; i < count; ++i) {
+        sized.Insert(i, i);
+    }
+    ASSERT_EQ(buckets, sized.BucketCount());
+}
+
+TEST(Correctness, Size) {
+    const int count = 100000;
+    ConcurrentHashMap<int, int> table;
+    auto check = [&table](size_t size) {
+        ASSERT_EQ(size, table.Size());
+        auto slack = table.BucketCount() / 8;
+        ASSERT_LE(table.ApproximateSize(), size + slack);
+        ASSERT_GE(table.ApproximateSize() + slack, size);
+    };
+    for (int i = 0; i < count; ++i) {
+        table.Insert(i, i);
+    }
+    check(count);
+    for (int i = 0; i < count; i += 2) {
+        ASSERT_TRUE(table.Erase(i));
+    }
+    check(count / 2);
+    table.EraseIf(1, [](int) { return false; });
+    table.Compute(1, [](const int*) { return std::optional<int>(); });
+    table.Compute(0, [](const int*) { return std::optional<int>(0); });
+    table.InsertOrAssign(3, 0);
+    check(count / 2);
+    table.Clear();
+    check(0);
+    ASSERT_EQ(0u, table.ApproximateSize());
+}
+
+TEST(Correctness, Stripes) {
+    auto undefined_size = ConcurrentHashMap<int, int>::kUndefinedSize;
+    ASSERT_EQ(64u, (ConcurrentHashMap<int, int>().StripeCount()));
+    ASSERT_EQ(8u, (ConcurrentHashMap<int, int>(undefined_size, 1).StripeCount()));
+    ASSERT_EQ(128u, (ConcurrentHashMap<int, int>(undefined_size, 12).StripeCount()));
+    ASSERT_EQ(1024u, (ConcurrentHashMap<int, int>(undefined_size, 1000).StripeCount()));
+    // No more stripes than expected entries
+    ASSERT_EQ(8u, (ConcurrentHashMap<int, int>(5, 16).StripeCount()));
+
+    ConcurrentHashMap<int, int> single(1, 1);
+    ASSERT_EQ(1u, single.StripeCount());
+    for (int i = 0; i < 10000; ++i) {
+        ASSERT_TRUE(single.Insert(i, i));
+    }
+    for (int i = 0; i < 10000; ++i) {
+        ASSERT_EQ(i, single.At(i));
+    }
+}
+
+TEST(Correctness, Updates) {
+    ConcurrentHashMap<int, int> table;
+    ASSERT_TRUE(table.InsertOrAssign(1, 10));
+    ASSERT_FALSE(table.InsertOrAssign(1, 20));
+    ASSERT_EQ(20, table.At(1));
+
+    auto increment = [](int& value) { ++value; };
+    ASSERT_TRUE(table.Upsert(2, 1, increment));
+    ASSERT_FALSE(table.Upsert(2, 1, increment));
+    ASSERT_FALSE(table.Upsert(2, 1, increment));
+    ASSERT_EQ(3, table.At(2));
+
+    auto twice = [](const int* value) -> std::optional<int> {
+        if (!value) {
+            return 1;
+        }
+        if (*value > 100) {
+            return std::nullopt;
+        }
+        return *value * 2;
+    };
+    ASSERT_EQ(std::optional<int>(1), table.Compute(3, twice));
+    ASSERT_EQ(std::optional<int>(2), table.Compute(3, twice));
+    ASSERT_EQ(std::optional<int>(40), table.Compute(1, twice));
+    table.InsertOrAssign(1, 101);
+    ASSERT_EQ(std::nullopt, table.Compute(1, twice));
+    ASSERT_FALSE(table.Find(1).first);
+    ASSERT_EQ(std::nullopt, table.Compute(4, [](const int*) { return std::optional<int>(); }));
+    ASSERT_FALSE(table.Find(4).first);
+
+    auto even = [](int value) { return value % 2 == 0; };
+    ASSERT_FALSE(table.EraseIf(2, even));
+    ASSERT_EQ(3, table.At(2));
+    ASSERT_TRUE(table.EraseIf(3, even));
+    ASSERT_FALSE(table.Find(3).first);
+    ASSERT_FALSE(table.EraseIf(5, even));
+
+    // Values read under the lock
+    ConcurrentHashMap<string, string> strings;
+    ASSERT_TRUE(strings.Upsert("a", "x", [](string& value) { value += "y"; }));
+    ASSERT_FALSE(strings.Upsert("a", "x", [](string& value) { value += "y"; }));
+    ASSERT_TRUE(strings.InsertOrAssign("b", "z"));
+    ASSERT_FALSE(strings.InsertOrAssign("b", "w"));
+    ASSERT_EQ("xy", strings.At("a"));
+    ASSERT_EQ("w", strings.At("b"));
+    ASSERT_TRUE(strings.EraseIf("a", [](const string& value) { return value == "xy"; }));
+    ASSERT_FALSE(strings.Find("a").first);
+}
+
+TEST(Correctness, Emplace) {
+    ConcurrentHashMap<int, std::unique_ptr<int>> table;
+    ASSERT_TRUE(table.TryEmplace(1, std::make_unique<int>(10)));
+    auto other = std::make_unique<int>(20);
+    ASSERT_FALSE(table.TryEmplace(1, std::move(other)));
+    ASSERT_TRUE(other);
+
+    int made = 0;
+    auto make = [&made] {
+        ++made;
+        return std::make_unique<int>(5);
+    };
+    auto increment = [](std::unique_ptr<int>& value) { ++*value; };
+    ASSERT_TRUE(table.Upsert(2, std::in_place, make, increment));
+    ASSERT_FALSE(table.Upsert(2, std::in_place, make, increment));
+    ASSERT_FALSE(table.Upsert(1, std::in_place, make, increment));
+    ASSERT_EQ(1, made);
+
+    auto equals = [](int expected) {
+        return [expected](const std::unique_ptr<int>& value) { return *value == expected; };
+    };
+    ASSERT_TRUE(table.EraseIf(2, equals(6)));
+    ASSERT_TRUE(table.EraseIf(1, equals(11)));
+    ASSERT_EQ(0u, table.Size());
+
+    // Word-sized values go through the free list of erased nodes
+    ConcurrentHashMap<int, int> words;
+    ASSERT_TRUE(words.TryEmplace(1, 7));
+    ASSERT_TRUE(words.Erase(1));
+    ASSERT_TRUE(words.TryEmplace(2, 8));
+    ASSERT_EQ(8, words.At(2));
+}
+
+TEST(Correctness, FindMany) {
+    ConcurrentHashMap<int, int> table;
+    ConcurrentHashMap<string, string> strings;
+    for (int i = 0; i < 1000; i += 2) {
+        table.Insert(i, -i);
+        strings.Insert(std::to_string(i), std::to_string(-i));
+    }
+
+    // More keys than a chunk, with misses and repeats
+    std::vector<int> keys;
+    std::vector<string> string_keys;
+    for (int i = 0; i < 300; ++i) {
+        keys.push_back((i * 37) % 1001);
+        string_keys.push_back(std::to_string(keys.back()));
+    }
+    std::vector<std::pair<bool, int>> out(keys.size());
+    std::vector<std::pair<bool, string>> string_out(keys.size());
+    table.FindMany(keys, out);
+    strings.FindMany(string_keys, string_out);
+    for (size_t i = 0; i < keys.size(); ++i) {
+        ASSERT_EQ(table.Find(keys[i]), out[i]);
+        ASSERT_EQ(strings.Find(string_keys[i]), string_out[i]);
+    }
+
+    table.FindMany({}, {});
+    ASSERT_THROW(table.FindMany(keys, std::span(out).first(10)), std::invalid_argument);
+}
+
 void CheckOutput(const ConcurrentHashMap<int, int>& table, std::vector<std::vector<int>> queries) {
     struct Item {
         int value;
@@ -135,6 +318,420 @@ TEST(Concurrency, Insertions) {
 
     CheckOutput(table, MoveToVectors(std::move(queries)));
 }
+
+TEST(Concurrency, ReadersDuringGrowth) {
+    const int old_keys = 1000;
+    const int writers_count = 4;
+    const int inserts_per_writer = 50000;
+    ConcurrentHashMap<int, int> table;
+    for (int i = 1; i <= old_keys; ++i) {
+        table.Insert(-i, i);
+    }
+
+    std::atomic<bool> done{false};
+    std::atomic<int> misses{0};
+    std::vector<std::thread> threads;
+    for (int r = 0; r < 2; ++r) {
+        threads.emplace_back([&] {
+            while (!done.load()) {
+                for (int i = 1; i <= old_keys; ++i) {
+                    if (table.Find(-i) != std::make_pair(true, i)) {
+                        ++misses;
+                    }
+                }
+            }
+        });
+    }
+    std::vector<std::thread> writers;
+    for (int w = 0; w < writers_count; ++w) {
+        writers.emplace_back([&table, w] {
+            for (int i = 0; i < inserts_per_writer; ++i) {
+                table.Insert(w * inserts_per_writer + i, 1);
+            }
+        });
+    }
+    for (auto& writer : writers) {
+        writer.join();
+    }
+    done = true;
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    ASSERT_EQ(0, misses.load());
+    ASSERT_EQ(size_t(old_keys + writers_count * inserts_per_writer), table.Size());
+    for (int i = 0; i < writers_count * inserts_per_writer; ++i) {
+        ASSERT_TRUE(table.Find(i).first);
+    }
+}
+TEST(Concurrency, OptimisticReads) {
+    static_assert(ConcurrentHashMap<int, int64_t>::kOptimisticReads);
+    static_assert(!ConcurrentHashMap<string, int>::kOptimisticReads);
+
+    const int stable_keys = 1000;
+    const int churned_keys = 64;
+    ConcurrentHashMap<int, int64_t> table;
+    for (int i = 0; i < stable_keys; ++i) {
+        table.Insert(i, 3 * i);
+    }
+
+    // Churned keys come and go with the same value, so a reader sees them either whole or not at
+    // all, while stable keys are always there
+    std::atomic<bool> done{false};
+    std::atomic<int> errors{0};
+    std::vector<std::thread> readers;
+    for (int r = 0; r < 3; ++r) {
+        readers.emplace_back([&, r] {
+            Random random(kSeed + r, 0, stable_keys + churned_keys - 1);
+            while (!done.load()) {
+                auto key = random();
+                auto found = table.Find(key);
+                if (key < stable_keys) {
+                    errors += found != std::make_pair(true, int64_t(3) * key);
+                } else {
+                    errors += found.first && found.second != int64_t(3) * key;
+                }
+            }
+        });
+    }
+    std::thread writer([&] {
+        for (int round = 0; round < 2000; ++round) {
+            for (int i = stable_keys; i < stable_keys + churned_keys; ++i) {
+                table.Insert(i, 3 * i);
+            }
+            for (int i = stable_keys; i < stable_keys + churned_keys; ++i) {
+                table.Erase(i);
+            }
+        }
+        // Grows the table under the readers as well
+        for (int i = 0; i < 20000; ++i) {
+            table.Insert(-1 - i, -3 * (1 + i));
+        }
+        done = true;
+    });
+    writer.join();
+    for (auto& reader : readers) {
+        reader.join();
+    }
+    ASSERT_EQ(0, errors.load());
+    for (int i = 0; i < stable_keys; ++i) {
+        ASSERT_EQ(3 * i, table.At(i));
+    }
+}
+
+TEST(Concurrency, FindManyDuringGrowth) {
+    const int old_keys = 1000;
+    ConcurrentHashMap<int, int> table;
+    std::vector<int> keys;
+    for (int i = 1; i <= old_keys; ++i) {
+        table.Insert(-i, i);
+        keys.push_back(-i);
+    }
+
+    std::atomic<bool> done{false};
+    std::atomic<int> misses{0};
+    std::thread reader([&] {
+        std::vector<std::pair<bool, int>> out(keys.size());
+        while (!done.load()) {
+            table.FindMany(keys, out);
+            for (int i = 0; i < old_keys; ++i) {
+                misses += out[i] != std::make_pair(true, i + 1);
+            }
+        }
+    });
+    for (int i = 0; i < 100000; ++i) {
+        table.Insert(i, i);
+    }
+    done = true;
+    reader.join();
+    ASSERT_EQ(0, misses.load());
+}
+
+TEST(Concurrency, Counters) {
+    const int threads_count = 4;
+    const int keys = 100;
+    const int rounds = 5000;
+    ConcurrentHashMap<int, int> table;
+    std::atomic<bool> done{false};
+    std::atomic<int> bad_reads{0};
+    // Counters only grow, a reader must never see one going back
+    std::thread reader([&] {
+        std::vector<int> last(keys, 0);
+        while (!done.load()) {
+            for (int key = 0; key < keys; ++key) {
+                auto [found, value] = table.Find(key);
+                if (found) {
+                    bad_reads += value < last[key];
+                    last[key] = value;
+                }
+            }
+        }
+    });
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < threads_count; ++i) {
+        threads.emplace_back([&table, i] {
+            for (int round = 0; round < rounds; ++round) {
+                auto key = (round + i) % keys;
+                if (round % 2) {
+                    table.Upsert(key, 1, [](int& value) { ++value; });
+                } else {
+                    table.Compute(key, [](const int* value) {
+                        return std::optional<int>(value ? *value + 1 : 1);
+                    });
+                }
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    done = true;
+    reader.join();
+
+    ASSERT_EQ(0, bad_reads.load());
+    int64_t total = 0;
+    for (int key = 0; key < keys; ++key) {
+        total += table.At(key);
+    }
+    ASSERT_EQ(threads_count * rounds, total);
+}
+
+TEST(Flat, Operations) {
+    FlatHashMap<int, int> table;
+    ASSERT_TRUE(table.Insert(3, 1));
+    ASSERT_TRUE(table.Insert(2, 2));
+    ASSERT_FALSE(table.Insert(2, 1));
+    ASSERT_EQ(std::make_pair(true, 2), table.Find(2));
+    ASSERT_FALSE(table.Find(5).first);
+    ASSERT_EQ(2u, table.Size());
+    ASSERT_TRUE(table.Erase(2));
+    ASSERT_FALSE(table.Erase(2));
+    ASSERT_EQ(1u, table.Size());
+    ASSERT_THROW(table.At(2), std::out_of_range);  // NOLINT
+    ASSERT_EQ(1, table.At(3));
+    table.Clear();
+    ASSERT_EQ(0u, table.Size());
+    ASSERT_TRUE(table.Insert(3, 3));
+
+    FlatHashMap<std::pair<int, int>, string, size_t (*)(const std::pair<int, int>&)> pair_table(
+        100, 4, PairHash);
+    ASSERT_TRUE(pair_table.Insert({1, 2}, "string"));
+    ASSERT_EQ("string", pair_table.At({1, 2}));
+}
+
+TEST(Flat, Growth) {
+    const int count = 100000;
+    FlatHashMap<string, int> table;
+    auto initial_slots = table.BucketCount();
+    for (int i = 0; i < count; ++i) {
+        ASSERT_TRUE(table.Insert(std::to_string(i), i));
+    }
+    ASSERT_EQ(size_t(count), table.Size());
+    ASSERT_GT(table.BucketCount(), initial_slots);
+    for (int i = 0; i < count; i += 2) {
+        ASSERT_TRUE(table.Erase(std::to_string(i)));
+    }
+    for (int i = 0; i < count; ++i) {
+        ASSERT_EQ(i % 2 == 1, table.Find(std::to_string(i)).first);
+    }
+    ASSERT_EQ(size_t(count / 2), table.Size());
+
+    FlatHashMap<int, int> sized(count);
+    auto slots = sized.BucketCount();
+    for (int i = 0; i < count; ++i) {
+        sized.Insert(i, i);
+    }
+    ASSERT_EQ(slots, sized.BucketCount());
+}
+
+TEST(Flat, ChurnDoesNotGrow) {
+    FlatHashMap<int, int> table;
+    for (int i = 0; i < 1000; ++i) {
+        table.Insert(i, i);
+    }
+    auto slots = table.BucketCount();
+    // Deleted slots are reused or dropped by rehashing in place, a stripe grows only when
+    // its live entries do
+    for (int i = 1000; i < 200000; ++i) {
+        ASSERT_TRUE(table.Insert(i, i));
+        ASSERT_TRUE(table.Erase(i - 1000));
+    }
+    ASSERT_EQ(1000u, table.Size());
+    ASSERT_LE(table.BucketCount(), 4 * slots);
+    for (int i = 199000; i < 200000; ++i) {
+        ASSERT_EQ(i, table.At(i));
+    }
+}
+
+TEST(Flat, LargeEntries) {
+    struct Big {
+        int value;
+        char payload[120];
+    };
+    static_assert(FlatHashMap<int, int>::kInlineEntries);
+    static_assert(!FlatHashMap<int, Big>::kInlineEntries);
+
+    FlatHashMap<int, Big> table;
+    for (int i = 0; i < 10000; ++i) {
+        ASSERT_TRUE(table.Insert(i, Big{i, {}}));
+    }
+    for (int i = 0; i < 10000; i += 3) {
+        ASSERT_TRUE(table.Erase(i));
+    }
+    for (int i = 0; i < 10000; ++i) {
+        auto found = table.Find(i);
+        ASSERT_EQ(i % 3 != 0, found.first);
+        if (found.first) {
+            ASSERT_EQ(i, found.second.value);
+        }
+    }
+    table.Clear();
+    ASSERT_FALSE(table.Find(1).first);
+}
+
+TEST(Flat, Concurrency) {
+    const int threads_count = 4;
+    const int per_thread = 50000;
+    FlatHashMap<int, int> table;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < threads_count; ++t) {
+        threads.emplace_back([&table, t] {
+            for (int i = t * per_thread; i < (t + 1) * per_thread; ++i) {
+                table.Insert(i, i);
+                if (i % 2) {
+                    table.Erase(i - 1);
+                }
+                table.Find(i / 2);
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    ASSERT_EQ(size_t(threads_count * per_thread / 2), table.Size());
+    for (int i = 0; i < threads_count * per_thread; ++i) {
+        ASSERT_EQ(i % 2 == 1, table.Find(i).first);
+    }
+}
+
+TEST(Swiss, Operations) {
+    SwissHashMap<int, int> table;
+    ASSERT_TRUE(table.Insert(3, 1));
+    ASSERT_TRUE(table.Insert(2, 2));
+    ASSERT_FALSE(table.Insert(2, 1));
+    ASSERT_EQ(std::make_pair(true, 2), table.Find(2));
+    ASSERT_FALSE(table.Find(5).first);
+    ASSERT_EQ(2u, table.Size());
+    ASSERT_TRUE(table.Erase(2));
+    ASSERT_FALSE(table.Erase(2));
+    ASSERT_EQ(1u, table.Size());
+    ASSERT_THROW(table.At(2), std::out_of_range);  // NOLINT
+    ASSERT_EQ(1, table.At(3));
+    table.Clear();
+    ASSERT_EQ(0u, table.Size());
+    ASSERT_FALSE(table.Find(3).first);
+    ASSERT_TRUE(table.Insert(3, 3));
+}
+
+TEST(Swiss, GrowthAndTombstones) {
+    const int count = 100000;
+    SwissHashMap<int64_t, int> table;
+    auto initial_slots = table.BucketCount();
+    for (int i = 0; i < count; ++i) {
+        ASSERT_TRUE(table.Insert(i, i));
+    }
+    ASSERT_GT(table.BucketCount(), initial_slots);
+    for (int i = 0; i < count; i += 2) {
+        ASSERT_TRUE(table.Erase(i));
+    }
+    for (int i = 0; i < count; ++i) {
+        ASSERT_EQ(i % 2 == 1, table.Find(i).first);
+    }
+    ASSERT_EQ(size_t(count / 2), table.Size());
+
+    // Churn reuses deleted slots instead of growing
+    auto slots = table.BucketCount();
+    for (int i = count; i < 4 * count; ++i) {
+        ASSERT_TRUE(table.Insert(i, i));
+        ASSERT_TRUE(table.Erase(i));
+    }
+    ASSERT_EQ(slots, table.BucketCount());
+    ASSERT_EQ(size_t(count / 2), table.Size());
+}
+
+TEST(Swiss, CollidingHashes) {
+    // Every key lands in the same segment and group with the same control byte, so the probe
+    // runs through many groups and every match is checked against the key
+    auto constant = [](int) { return size_t(42); };
+    SwissHashMap<int, int, decltype(constant)> table(constant);
+    for (int i = 0; i < 2000; ++i) {
+        ASSERT_TRUE(table.Insert(i, -i));
+    }
+    for (int i = 0; i < 2000; i += 3) {
+        ASSERT_TRUE(table.Erase(i));
+    }
+    for (int i = 0; i < 2000; ++i) {
+        ASSERT_EQ(i % 3 != 0, table.Find(i).first);
+        ASSERT_FALSE(table.Insert(i, 0) && i % 3 != 0);
+    }
+    ASSERT_EQ(2000u, table.Size());
+}
+
+TEST(Swiss, ReadersDuringWrites) {
+    const int stable_keys = 1000;
+    const int churned_keys = 64;
+    SwissHashMap<int, int64_t> table;
+    for (int i = 0; i < stable_keys; ++i) {
+        table.Insert(i, 3 * i);
+    }
+
+    std::atomic<bool> done{false};
+    std::atomic<int> errors{0};
+    std::vector<std::thread> readers;
+    for (int r = 0; r < 3; ++r) {
+        readers.emplace_back([&, r] {
+            Random random(kSeed + r, 0, stable_keys + churned_keys - 1);
+            while (!done.load()) {
+                auto key = random();
+                auto found = table.Find(key);
+                if (key < stable_keys) {
+                    errors += found != std::make_pair(true, int64_t(3) * key);
+                } else {
+                    errors += found.first && found.second != int64_t(3) * key;
+                }
+            }
+        });
+    }
+    std::vector<std::thread> writers;
+    for (int w = 0; w < 2; ++w) {
+        writers.emplace_back([&, w] {
+            for (int round = 0; round < 1000; ++round) {
+                for (int i = stable_keys + w; i < stable_keys + churned_keys; i += 2) {
+                    table.Insert(i, 3 * i);
+                }
+                for (int i = stable_keys + w; i < stable_keys + churned_keys; i += 2) {
+                    table.Erase(i);
+                }
+            }
+            // Grows the table under the readers as well
+            for (int i = 0; i < 20000; ++i) {
+                table.Insert(-1 - 2 * i - w, 0);
+            }
+        });
+    }
+    for (auto& writer : writers) {
+        writer.join();
+    }
+    done = true;
+    for (auto& reader : readers) {
+        reader.join();
+    }
+    ASSERT_EQ(0, errors.load());
+    ASSERT_EQ(size_t(stable_keys + 40000), table.Size());
+}
+
 ////
 //TEST(Concurrency, Searching) {
 //    const int threads_count = 4;
@@ -0,0 +1,392 @@
+#pragma once
+
+#include <algorithm>
+#include <deque>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <optional>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+#include "executors.h"
+
+enum class StreamPull { kItem, kEmpty, kEnd };
+
+// Buffer of one stream stage together with the task that fills it.
+// The source is pulled only from the pump task, which is suspended (not blocked) when the
+// buffer is full or the upstream stage is empty, and is resubmitted when that changes.
+// Stages hand items over in chunks, so locks are taken once per chunk, not per item.
+template <class T>
+class StreamState : public std::enable_shared_from_this<StreamState<T>> {
+public:
+    // Appends up to max items to out. kItem means more may follow right away, kEmpty means
+    // the source has to wait and will call resume once more input is available.
+    using Source = std::function<StreamPull(std::vector<T>& out, size_t max,
+                                            const std::function<void()>& resume)>;
+
+    static constexpr size_t kChunkSize = 256;
+
+    StreamState(Executor* executor, size_t capacity, Source source)
+        : executor_(executor), capacity_(capacity > 0 ? capacity : 1), source_(std::move(source)) {
+    }
+
+    void Start() {
+        {
+            auto guard = std::lock_guard(lock_);
+            pumping_ = true;
+        }
+        SubmitPump();
+    }
+
+    std::optional<T> Next() {
+        auto guard = std::unique_lock(lock_);
+        while (buffer_.empty() && !done_) {
+            ++consumers_waiting_;
+            if (Scheduler::CanPark()) {
+                // A consumer on a fiber parks on a task the producer finishes
+                auto ready = std::make_shared<ReadyTask>();
+                consumer_ready_ = ready;
+                guard.unlock();
+                ready->Wait();
+                guard.lock();
+            } else {
+                not_empty_.wait(guard, [this] { return !buffer_.empty() || done_; });
+            }
+            --consumers_waiting_;
+        }
+        if (buffer_.empty()) {
+            if (error_) {
+                std::rethrow_exception(error_);
+            }
+            return std::nullopt;
+        }
+        T item = std::move(buffer_.front());
+        buffer_.pop_front();
+        ResumeIfDrained(guard);
+        return item;
+    }
+
+    // Non-blocking pull used by downstream stages, on_ready is called once when
+    // items or the end of the stream arrive
+    StreamPull TryNext(std::vector<T>& out, size_t max, const std::function<void()>& on_ready) {
+        auto guard = std::unique_lock(lock_);
+        if (!buffer_.empty()) {
+            auto end = buffer_.begin() + std::min(max, buffer_.size());
+            std::move(buffer_.begin(), end, std::back_inserter(out));
+            buffer_.erase(buffer_.begin(), end);
+            ResumeIfDrained(guard);
+            return StreamPull::kItem;
+        }
+        if (done_) {
+            if (error_) {
+                std::rethrow_exception(error_);
+            }
+            return StreamPull::kEnd;
+        }
+        on_data_ = on_ready;
+        return StreamPull::kEmpty;
+    }
+
+    size_t Capacity() const {
+        return capacity_;
+    }
+
+    Executor* GetExecutor() const {
+        return executor_;
+    }
+
+private:
+    class ReadyTask : public Task {
+    public:
+        void Run() override {
+        }
+    };
+
+    class PumpTask : public Task {
+    public:
+        explicit PumpTask(std::shared_ptr<StreamState> state) : state_(std::move(state)) {
+        }
+
+        void Run() override {
+            state_->Pump();
+        }
+
+        // The executor shut down before the pump ran, nothing is going to fill the buffer
+        void Cancel() override {
+            Task::Cancel();
+            state_->Finish(std::make_exception_ptr(std::runtime_error("Executor is shut down")));
+        }
+
+    private:
+        std::shared_ptr<StreamState> state_;
+    };
+
+    void SubmitPump() {
+        executor_->Submit(std::make_shared<PumpTask>(this->shared_from_this()));
+    }
+
+    // Called with lock_ held, unlocks it.
+    // The producer is resumed only at the low watermark, so it refills half a buffer per task.
+    void ResumeIfDrained(std::unique_lock<std::mutex>& guard) {
+        bool resume = !done_ && !pumping_ && buffer_.size() <= capacity_ / 2;
+        if (resume) {
+            pumping_ = true;
+        }
+        guard.unlock();
+        if (resume) {
+            SubmitPump();
+        }
+    }
+
+    void Resume() {
+        {
+            auto guard = std::lock_guard(lock_);
+            wakeup_ = true;
+            if (pumping_ || done_) {
+                return;
+            }
+            pumping_ = true;
+        }
+        SubmitPump();
+    }
+
+    void Pump() {
+        std::weak_ptr<StreamState> weak = this->shared_from_this();
+        std::function<void()> resume = [weak] {
+            if (auto state = weak.lock()) {
+                state->Resume();
+            }
+        };
+        std::vector<T> chunk;
+        while (true) {
+            size_t space;
+            {
+                auto guard = std::unique_lock(lock_);
+                wakeup_ = false;
+                if (buffer_.size() >= capacity_) {
+                    pumping_ = false;
+                    NotifyDownstream(guard);
+                    return;
+                }
+                space = capacity_ - buffer_.size();
+            }
+
+            chunk.clear();
+            StreamPull pulled;
+            try {
+                pulled = source_(chunk, std::min(space, kChunkSize), resume);
+            } catch (...) {
+                // Items the source produced before throwing are still delivered
+                {
+                    auto guard = std::lock_guard(lock_);
+                    std::move(chunk.begin(), chunk.end(), std::back_inserter(buffer_));
+                }
+                Finish(std::current_exception());
+                return;
+            }
+
+            bool notify;
+            std::shared_ptr<Task> ready;
+            {
+                auto guard = std::unique_lock(lock_);
+                std::move(chunk.begin(), chunk.end(), std::back_inserter(buffer_));
+                notify = consumers_waiting_ > 0 && !chunk.empty();
+                if (notify) {
+                    ready = std::move(consumer_ready_);
+                }
+                if (pulled == StreamPull::kEmpty) {
+                    // The upstream may have resumed us while we were pulling
+                    if (!wakeup_) {
+                        pumping_ = false;
+                        NotifyDownstream(guard);
+                        guard.unlock();
+                        NotifyConsumers(notify, std::move(ready));
+                        return;
+                    }
+                } else if (buffer_.size() >= (capacity_ + 1) / 2) {
+                    // Downstream stages are resumed once per half buffer instead of once per item
+                    NotifyDownstream(guard);
+                }
+            }
+            NotifyConsumers(notify, std::move(ready));
+            if (pulled == StreamPull::kEnd) {
+                Finish(nullptr);
+                return;
+            }
+        }
+    }
+
+    // Called with lock_ held, releases it while the callback runs
+    void NotifyDownstream(std::unique_lock<std::mutex>& guard) {
+        if (!on_data_ || buffer_.empty()) {
+            return;
+        }
+        auto on_data = std::move(on_data_);
+        on_data_ = nullptr;
+        guard.unlock();
+        on_data();
+        guard.lock();
+    }
+
+    void NotifyConsumers(bool notify, std::shared_ptr<Task> ready) {
+        if (notify) {
+            not_empty_.notify_one();
+        }
+        if (ready) {
+            ready->Invoke();
+        }
+    }
+
+    void Finish(std::exception_ptr error) {
+        std::function<void()> on_data;
+        std::shared_ptr<Task> ready;
+        {
+            auto guard = std::lock_guard(lock_);
+            done_ = true;
+            pumping_ = false;
+            error_ = error;
+            on_data.swap(on_data_);
+            ready.swap(consumer_ready_);
+        }
+        not_empty_.notify_all();
+        if (ready) {
+            ready->Invoke();
+        }
+        if (on_data) {
+            on_data();
+        }
+    }
+
+    Executor* executor_;
+    size_t capacity_;
+    Source source_;
+
+    std::mutex lock_;
+    std::condition_variable not_empty_;
+    std::deque<T> buffer_;
+    std::function<void()> on_data_;
+    // Finished to resume a consumer parked on a fiber
+    std::shared_ptr<Task> consumer_ready_;
+    std::exception_ptr error_;
+    int consumers_waiting_{0};
+    bool done_{false};
+    bool pumping_{false};
+    bool wakeup_{false};
+};
+
+// Multi-value Future: items are produced on an Executor into a bounded buffer and pulled
+// by the consumer with Next(). Each Map/Filter/Batch stage has its own bounded buffer,
+// so peak memory depends on the capacities, not on the length of the stream.
+// A stream has a single consumer: either Next() or one operator applied to it.
+// The Executor must outlive the stream.
+template <class T>
+class AsyncStream {
+public:
+    explicit AsyncStream(std::shared_ptr<StreamState<T>> state) : state_(std::move(state)) {
+    }
+
+    // Blocks until the next item, returns nullopt at the end of the stream.
+    // Rethrows the exception thrown by the producer or by an operator.
+    std::optional<T> Next() {
+        return state_->Next();
+    }
+
+    template <class F>
+    AsyncStream<std::invoke_result_t<F&, T>> Map(F fn) {
+        using U = std::invoke_result_t<F&, T>;
+        return MakeStage<U>(state_->Capacity(),
+                            [upstream = state_, fn, in = std::vector<T>()](
+                                std::vector<U>& out, size_t max,
+                                const std::function<void()>& resume) mutable {
+                                auto pulled = upstream->TryNext(in, max, resume);
+                                for (auto& item : in) {
+                                    out.push_back(fn(std::move(item)));
+                                }
+                                in.clear();
+                                return pulled;
+                            });
+    }
+
+    template <class F>
+    AsyncStream<T> Filter(F pred) {
+        return MakeStage<T>(state_->Capacity(),
+                            [upstream = state_, pred, in = std::vector<T>()](
+                                std::vector<T>& out, size_t max,
+                                const std::function<void()>& resume) mutable {
+                                while (true) {
+                                    auto pulled = upstream->TryNext(in, max, resume);
+                                    for (auto& item : in) {
+                                        if (pred(item)) {
+                                            out.push_back(std::move(item));
+                                        }
+                                    }
+                                    in.clear();
+                                    if (pulled != StreamPull::kItem || !out.empty()) {
+                                        return pulled;
+                                    }
+                                }
+                            });
+    }
+
+    // Groups items into vectors of the given size, the last one may be shorter.
+    // Throws std::invalid_argument for size 0.
+    AsyncStream<std::vector<T>> Batch(size_t size) {
+        if (size == 0) {
+            throw std::invalid_argument("Batch size must be positive");
+        }
+        auto capacity = std::max<size_t>(1, state_->Capacity() / size);
+        return MakeStage<std::vector<T>>(
+            capacity, [upstream = state_, size, pending = std::vector<T>()](
+                          std::vector<std::vector<T>>& out, size_t max,
+                          const std::function<void()>& resume) mutable {
+                while (out.size() < max) {
+                    auto pulled = upstream->TryNext(pending, size - pending.size(), resume);
+                    if (pending.size() == size || (pulled == StreamPull::kEnd && !pending.empty())) {
+                        out.push_back(std::move(pending));
+                        pending.clear();
+                    }
+                    if (pulled != StreamPull::kItem) {
+                        return pulled;
+                    }
+                }
+                return StreamPull::kItem;
+            });
+    }
+
+private:
+    template <class U>
+    AsyncStream<U> MakeStage(size_t capacity, typename StreamState<U>::Source source) {
+        auto state =
+            std::make_shared<StreamState<U>>(state_->GetExecutor(), capacity, std::move(source));
+        state->Start();
+        return AsyncStream<U>(std::move(state));
+    }
+
+    std::shared_ptr<StreamState<T>> state_;
+};
+
+// Runs producer on the executor until it returns nullopt, keeping at most capacity
+// items buffered ahead of the consumer
+template <class T>
+AsyncStream<T> MakeAsyncStream(std::shared_ptr<Executor> executor,
+                               std::function<std::optional<T>()> producer, size_t capacity) {
+    auto state = std::make_shared<StreamState<T>>(
+        executor.get(), capacity,
+        [producer = std::move(producer)](std::vector<T>& out, size_t max,
+                                         const std::function<void()>&) {
+            for (size_t i = 0; i < max; ++i) {
+                auto item = producer();
+                if (!item) {
+                    return StreamPull::kEnd;
+                }
+                out.push_back(std::move(*item));
+            }
+            return StreamPull::kItem;
+        });
+    state->Start();
+    return AsyncStream<T>(std::move(state));
+}
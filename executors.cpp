@@ -1,87 +1,866 @@
 #include "executors.h"
 
-void Task::Invoke() {
-    for (const auto& dep : dependences_) {
-        if (!dep->IsFinished()) {
-            return;
-        }
+namespace {
+
+struct Worker {
+    Scheduler* scheduler;
+    std::shared_ptr<Task> lifo_slot;
+    int lifo_streak{0};
+    int fusion_depth{0};
+    int blocking_depth{0};
+    // Fiber the worker has switched into
+    Task* fiber{nullptr};
+    Scheduler::WorkerSlot slot;
+    uint16_t runs{0};
+
+    void Publish(const Task* task) {
+        slot.running.store(reinterpret_cast<uint64_t>(task) |
+                               (uint64_t{++runs} << Scheduler::WorkerSlot::kRunShift),
+                           std::memory_order_relaxed);
     }
+};
 
-    if (!triggers_.empty()) {
-        bool any_triggered{false};
-        for (const auto& trig : triggers_) {
-            if (trig->IsFinished()) {
-                any_triggered = true;
-                break;
-            }
-        }
-        if (!any_triggered) {
-            return;
-        }
+thread_local Worker* current_worker = nullptr;
+
+// A fiber may park on one worker and resume on another, so code that can run on a fiber
+// must not let the compiler cache the thread-local address across the switch
+[[gnu::noinline]] Worker* CurrentWorker() {
+    return current_worker;
+}
+
+std::atomic<TaskObserver*> task_observer{nullptr};
+
+const std::vector<std::shared_ptr<Task>> kNoDependencies;
+
+}  // namespace
+
+struct Task::Extras {
+    std::vector<std::shared_ptr<Task>> dependencies;
+    std::vector<std::shared_ptr<Task>> triggers;
+    TimePoint deadline{};
+    std::atomic<size_t> deps_left{0};
+    // Set by Submit for tasks that become ready later, keeps the queue reachable for them
+    std::shared_ptr<Scheduler> scheduler;
+    std::exception_ptr error;
+    std::string label;
+};
+
+struct Task::Waiter {
+    std::shared_ptr<Task> task;
+    bool is_dependency;
+    Waiter* next;
+};
+
+Task::Waiter* const Task::kWaitersClosed = reinterpret_cast<Task::Waiter*>(uintptr_t{1});
+
+TaskObserver* SetTaskObserver(TaskObserver* observer) {
+    return task_observer.exchange(observer);
+}
+
+Task::Task() = default;
+
+Task::~Task() {
+    auto waiter = waiters_.load();
+    while (waiter && waiter != kWaitersClosed) {
+        delete std::exchange(waiter, waiter->next);
     }
+}
 
-    if (std::chrono::system_clock::now() < ded_) {
-        return;
+Task::Extras& Task::GetExtras() {
+    if (!extras_) {
+        extras_ = std::make_unique<Extras>();
     }
+    return *extras_;
+}
 
-    auto guard = std::lock_guard(doing_work_);
-    if (is_canceled_.load()) {
+void Task::Invoke() {
+    if (state_.fetch_or(kStarted) & (kStarted | kFinished | kCanceled)) {
         return;
     }
+    // Reported before Finish, so whoever waits for the task also waits for the observer
+    auto observer = task_observer.load(std::memory_order_acquire);
+    if (observer) {
+        observer->OnStart(*this);
+    }
+    bool failed = false;
     try {
         Run();
     } catch (...) {
-        is_failed_.store(true);
-        is_finished_.store(true);
-        exc_ptr_ = std::current_exception();
-        task_done_.notify_all();
-        return;
+        GetExtras().error = std::current_exception();
+        failed = true;
+    }
+    if (observer) {
+        observer->OnFinish(*this);
     }
-    is_completed_ = true;
-    is_finished_.store(true);
-    task_done_.notify_all();
+    Finish(failed, false, true);
 }
 
 void Task::AddDependency(std::shared_ptr <Task> dep) {
-    dependences_.push_back(dep);
+    GetExtras().dependencies.push_back(dep);
 }
 
 void Task::AddTrigger(std::shared_ptr <Task> dep) {
-    triggers_.push_back(dep);
+    GetExtras().triggers.push_back(dep);
 }
 
 void Task::SetTimeTrigger(std::chrono::system_clock::time_point at) {
-    ded_ = at;
+    GetExtras().deadline = at;
 }
 
 bool Task::IsCompleted() {
-    return is_completed_;
+    return state_.load() & kCompleted;
 }
 
 bool Task::IsFailed() {
-    return is_failed_.load();
+    return state_.load() & kFailed;
 }
 
 bool Task::IsCanceled() {
-    return is_canceled_.load();
+    return state_.load() & kCanceled;
 }
 
 bool Task::IsFinished() {
-    return is_finished_.load();
+    return state_.load() & kFinished;
 }
 
 std::exception_ptr Task::GetError() {
-    return exc_ptr_;
+    return IsFailed() ? extras_->error : nullptr;
 }
 
 void Task::Cancel() {
-    is_canceled_.store(true);
-    is_finished_.store(true);
+    // A running task is finished by its runner once Run returns, so Wait never returns
+    // while Run is still going
+    if (state_.fetch_or(kCanceled) & kStarted) {
+        return;
+    }
+    Finish(false, true, false);
+}
+
+void Task::SetLabel(std::string label) {
+    GetExtras().label = std::move(label);
+}
+
+const std::string& Task::Label() const {
+    static const std::string kNoLabel;
+    return extras_ ? extras_->label : kNoLabel;
 }
 
 void Task::Wait() {
-    auto guard = std::unique_lock(doing_work_);
-    while (!is_finished_.load()) {
-        task_done_.wait(guard);
+    if (!IsFinished() && Scheduler::ParkUntilFinished(this)) {
+        return;
+    }
+    auto state = state_.load();
+    while (!(state & kFinished)) {
+        if (!(state & kWaited) && !state_.compare_exchange_weak(state, state | kWaited)) {
+            continue;
+        }
+        FutexWait(&state_, state | kWaited);
+        state = state_.load();
+    }
+}
+
+void PeriodicTask::Invoke() {
+    if (state_.fetch_or(kStarted) & (kFinished | kCanceled)) {
+        return;
+    }
+    try {
+        Run();
+    } catch (...) {
+        GetExtras().error = std::current_exception();
+        Finish(true, false, true);
+        return;
+    }
+    ++run_count_;
+    // Canceled during the run: Cancel left finishing it to us
+    if (state_.fetch_and(~kStarted) & kCanceled) {
+        Finish(false, true, true);
+        return;
+    }
+
+    auto now = std::chrono::system_clock::now();
+    if (policy_ == PeriodicPolicy::kFixedRate) {
+        next_run_ += period_;
+        if (next_run_ <= now) {
+            next_run_ += (now - next_run_) / period_ * period_ + period_;
+        }
+    } else {
+        next_run_ = now + period_;
+    }
+    state_.fetch_and(~kReady);
+    extras_->scheduler->AddTimer(shared_from_this(), next_run_);
+}
+
+bool Task::Subscribe(std::shared_ptr<Task> waiter, bool is_dependency) {
+    auto node = new Waiter{std::move(waiter), is_dependency, waiters_.load()};
+    while (node->next != kWaitersClosed) {
+        if (waiters_.compare_exchange_weak(node->next, node)) {
+            return true;
+        }
+    }
+    delete node;
+    return false;
+}
+
+void Task::OnPredecessorFinished(bool is_dependency, bool local, bool fuse) {
+    if (is_dependency && --extras_->deps_left != 0) {
+        return;
+    }
+    if (TryMarkReady()) {
+        extras_->scheduler->Schedule(shared_from_this(), local, fuse);
+    }
+}
+
+bool Task::TryMarkReady() {
+    return !(state_.fetch_or(kReady) & kReady);
+}
+
+void Task::Finish(bool failed, bool canceled, bool local) {
+    auto outcome = canceled ? kCanceled : (failed ? kFailed : kCompleted);
+    auto state = state_.load();
+    do {
+        if (state & kFinished) {
+            return;
+        }
+        // A run that was canceled while going on ends as canceled
+        if (state & kCanceled) {
+            outcome = kCanceled;
+        }
+    } while (!state_.compare_exchange_weak(state, state | kFinished | outcome));
+    if (state & kWaited) {
+        FutexWake(&state_, INT32_MAX);
+    }
+
+    // The stack holds waiters newest first, notify them in subscription order
+    Waiter* waiters = nullptr;
+    size_t count = 0;
+    for (auto node = waiters_.exchange(kWaitersClosed); node; ++count) {
+        auto next = node->next;
+        node->next = waiters;
+        waiters = node;
+        node = next;
+    }
+    bool fuse = local && count == 1;
+    while (waiters) {
+        std::unique_ptr<Waiter> node(std::exchange(waiters, waiters->next));
+        node->task->OnPredecessorFinished(node->is_dependency, local, fuse);
+    }
+}
+
+Scheduler::Scheduler(int num_workers, std::optional<FiberOptions> fibers)
+    : num_workers_(num_workers), running_(num_workers) {
+    if (fibers) {
+        stacks_ = std::make_unique<StackPool>(*fibers);
+    }
+}
+
+// Out of line: Fiber is incomplete in the header
+Scheduler::~Scheduler() = default;
+
+struct Scheduler::Fiber : public Task {
+    Fiber(StackPool& pool, StackPool::Stack stack)
+        : context(pool, stack, &Scheduler::FiberMain, this) {
+    }
+
+    // Never called, workers switch into the fiber instead
+    void Run() override {
+    }
+
+    FiberContext context;
+    // Task to run when switched in while idle
+    std::shared_ptr<Task> task;
+    // Set by a parking fiber right before it switches out
+    Task* park_on{nullptr};
+};
+
+std::shared_ptr<Scheduler::Fiber> Scheduler::MakeFiber() {
+    auto stack = stacks_->Allocate();
+    if (!stack.base) {
+        return nullptr;
+    }
+    auto fiber = std::make_shared<Fiber>(*stacks_, stack);
+    fiber->state_.fetch_or(Task::kFiber);
+    // Keeps the stack pool alive while the fiber is parked on some task
+    fiber->GetExtras().scheduler = shared_from_this();
+    return fiber;
+}
+
+void Scheduler::FiberMain(void* arg) {
+    auto fiber = static_cast<Fiber*>(arg);
+    while (true) {
+        fiber->task->Invoke();
+        // Released on the fiber: the worker hands it the next task right after the switch.
+        // The slot of the worker lets go of the task first.
+        if (auto worker = CurrentWorker()) {
+            worker->slot.running.store(0, std::memory_order_relaxed);
+        }
+        fiber->task = nullptr;
+        fiber->context.SwitchOut();
+    }
+}
+
+void Scheduler::RunOnFiber(std::shared_ptr<Task> task, std::vector<std::shared_ptr<Fiber>>& idle) {
+    std::shared_ptr<Fiber> fiber;
+    if (task->state_.load(std::memory_order_relaxed) & Task::kFiber) {
+        fiber = std::static_pointer_cast<Fiber>(std::move(task));
+    } else if (!idle.empty()) {
+        fiber = std::move(idle.back());
+        idle.pop_back();
+        fiber->task = std::move(task);
+    } else if ((fiber = MakeFiber())) {
+        fiber->task = std::move(task);
+    } else {
+        // Out of stacks, the task blocks the worker if it waits
+        auto worker = CurrentWorker();
+        if (worker) {
+            worker->Publish(task.get());
+        }
+        task->Invoke();
+        if (worker) {
+            worker->slot.running.store(0, std::memory_order_relaxed);
+        }
+        return;
+    }
+
+    // Not a worker when resumed after shutdown, a fiber itself when resumed by one
+    auto worker = CurrentWorker();
+    auto outer = worker ? worker->fiber : nullptr;
+    ucontext_t here;
+    while (true) {
+        if (worker) {
+            worker->fiber = fiber.get();
+            worker->Publish(fiber->task.get());
+        }
+        fiber->context.SwitchIn(&here);
+        if (worker) {
+            worker->fiber = outer;
+            // A parked task may be resumed and released by another worker
+            worker->slot.running.store(0, std::memory_order_relaxed);
+        }
+        auto target = std::exchange(fiber->park_on, nullptr);
+        if (!target) {
+            break;
+        }
+        // The fiber is off its stack now, so the one finishing target may resume it
+        fiber->state_.fetch_and(~Task::kReady);
+        if (target->Subscribe(fiber, false)) {
+            return;
+        }
+        // target finished while the fiber was switching out
+    }
+    if (idle.size() < kMaxIdleFibers) {
+        idle.push_back(std::move(fiber));
+    }
+}
+
+bool Scheduler::ParkUntilFinished(Task* target) {
+    auto worker = CurrentWorker();
+    if (!worker || !worker->fiber || worker->blocking_depth > 0) {
+        return false;
+    }
+    auto fiber = static_cast<Fiber*>(worker->fiber);
+    fiber->park_on = target;
+    fiber->context.SwitchOut();
+    return true;
+}
+
+bool Scheduler::CanPark() {
+    auto worker = CurrentWorker();
+    return worker && worker->fiber && worker->blocking_depth == 0;
+}
+
+size_t Scheduler::FiberStacks() {
+    return stacks_ ? stacks_->Mapped() : 0;
+}
+
+void Scheduler::Submit(std::shared_ptr<Task> task) {
+    if (is_closed_.load()) {
+        task->Cancel();
+        return;
+    }
+    if (auto observer = task_observer.load(std::memory_order_acquire)) {
+        observer->OnSubmit(*task, task->extras_ ? task->extras_->dependencies : kNoDependencies);
+    }
+    if (!task->extras_) {
+        if (task->TryMarkReady()) {
+            Schedule(std::move(task), false);
+        }
+        return;
+    }
+
+    auto& extras = *task->extras_;
+    extras.scheduler = shared_from_this();
+    bool has_deps = !extras.dependencies.empty();
+    bool has_time = extras.deadline != TimePoint{};
+    if (!has_deps && extras.triggers.empty() && !has_time) {
+        if (task->TryMarkReady()) {
+            Schedule(std::move(task), false);
+        }
+        return;
+    }
+
+    // One extra count keeps the task from firing while dependencies are still being registered
+    extras.deps_left.store(extras.dependencies.size() + 1);
+    for (const auto& dep : extras.dependencies) {
+        if (!dep->Subscribe(task, true)) {
+            --extras.deps_left;
+        }
+    }
+    for (const auto& trig : extras.triggers) {
+        if (!trig->Subscribe(task, false)) {
+            task->OnPredecessorFinished(false, false, false);
+            break;
+        }
+    }
+    if (has_time) {
+        if (std::chrono::system_clock::now() >= extras.deadline) {
+            task->OnPredecessorFinished(false, false, false);
+        } else if (!(task->state_.load() & Task::kReady)) {
+            AddTimer(task, extras.deadline);
+        }
+    }
+    if (has_deps) {
+        task->OnPredecessorFinished(true, false, false);
+    }
+}
+
+void Scheduler::Schedule(std::shared_ptr<Task> task, bool from_predecessor, bool fuse) {
+    auto worker = CurrentWorker();
+    if (from_predecessor && worker && worker->scheduler == this) {
+        // A fused task that parks would resume with the frame of another worker
+        if (fuse && !stacks_ && worker->fusion_depth < kMaxFusionDepth && !is_closed_.load()) {
+            ++worker->fusion_depth;
+            task->Invoke();
+            --worker->fusion_depth;
+            return;
+        }
+        if (worker->lifo_streak < kMaxLifoStreak && !is_closed_.load()) {
+            std::swap(worker->lifo_slot, task);
+            if (!task) {
+                return;
+            }
+        }
+    }
+    if (!queue_.Put(task)) {
+        if (task->state_.load(std::memory_order_relaxed) & Task::kFiber) {
+            // A parked task is running already, like a blocked thread it goes on after
+            // shutdown, here on the thread that finished what it waited for
+            std::vector<std::shared_ptr<Fiber>> idle;
+            RunOnFiber(std::move(task), idle);
+        } else {
+            task->Cancel();
+        }
+    }
+}
+
+void Scheduler::SchedulePeriodic(std::shared_ptr<PeriodicTask> task) {
+    if (is_closed_.load()) {
+        task->Cancel();
+        return;
+    }
+    task->GetExtras().scheduler = shared_from_this();
+    task->next_run_ = std::chrono::system_clock::now() + task->period_;
+    AddTimer(task, task->next_run_);
+}
+
+void Scheduler::AddTimer(std::shared_ptr<Task> task, TimePoint at) {
+    {
+        auto guard = std::lock_guard(timers_lock_);
+        if (!timers_stopped_) {
+            if (!timer_thread_.joinable()) {
+                timer_thread_ = std::thread([this] { TimerLoop(); });
+            }
+            timers_.push({at, std::move(task)});
+            if (timers_.top().at == at) {
+                timers_changed_.notify_one();
+            }
+            return;
+        }
+    }
+    CancelTimer(task);
+}
+
+void Scheduler::TimerLoop() {
+    std::vector<std::shared_ptr<Task>> due;
+    auto guard = std::unique_lock(timers_lock_);
+    while (!timers_stopped_) {
+        if (timers_.empty()) {
+            timers_changed_.wait(guard);
+            continue;
+        }
+        auto now = std::chrono::system_clock::now();
+        // Copied: StopTimers may free the heap while we wait
+        auto next = timers_.top().at;
+        if (now < next) {
+            timers_changed_.wait_until(guard, next);
+            continue;
+        }
+        while (!timers_.empty() && timers_.top().at <= now) {
+            due.push_back(std::move(const_cast<Timer&>(timers_.top()).task));
+            timers_.pop();
+        }
+        guard.unlock();
+        for (auto& task : due) {
+            if (!task->IsFinished() && task->TryMarkReady()) {
+                Schedule(std::move(task), false);
+            }
+        }
+        due.clear();
+        guard.lock();
+    }
+}
+
+void Scheduler::StopTimers() {
+    decltype(timers_) timers;
+    {
+        auto guard = std::lock_guard(timers_lock_);
+        timers_stopped_ = true;
+        timers.swap(timers_);
+        timers_changed_.notify_one();
+    }
+    // Outside the lock: waiters of a canceled task may add timers
+    while (!timers.empty()) {
+        CancelTimer(const_cast<Timer&>(timers.top()).task);
+        timers.pop();
+    }
+}
+
+void Scheduler::CancelTimer(const std::shared_ptr<Task>& task) {
+    // A task made ready by something else meanwhile is queued, shutdown cancels it there
+    if (task->TryMarkReady()) {
+        task->Cancel();
+    }
+}
+
+void Scheduler::JoinTimers() {
+    std::thread timer_thread;
+    {
+        auto guard = std::lock_guard(timers_lock_);
+        timer_thread.swap(timer_thread_);
+    }
+    if (timer_thread.joinable()) {
+        timer_thread.join();
+    }
+}
+
+void Scheduler::WorkerLoop(bool compensating) {
+    Worker worker;
+    worker.scheduler = this;
+    worker.slot.thread = pthread_self();
+    current_worker = &worker;
+    {
+        auto guard = std::lock_guard(slots_lock_);
+        slots_.push_back(&worker.slot);
+    }
+
+    std::vector<std::shared_ptr<Fiber>> idle_fibers;
+    // The last task is released once the slot no longer points at it: when the next task
+    // is published or right before the worker goes to sleep. A fused continuation runs
+    // under the slot of the task it was fused into.
+    std::shared_ptr<Task> finished;
+    auto release = [&worker, &finished] {
+        worker.slot.running.store(0, std::memory_order_relaxed);
+        finished = nullptr;
+    };
+    // An idle compensating worker retires as well if the worker it replaced is back
+    auto on_sleep = [this, &release, compensating] {
+        release();
+        return !(compensating && TryRetire());
+    };
+    while (true) {
+        std::shared_ptr<Task> task;
+        if (worker.lifo_slot && !is_closed_.load()) {
+            task = std::move(worker.lifo_slot);
+            ++worker.lifo_streak;
+        } else if (auto next = queue_.Take(on_sleep)) {
+            task = std::move(*next);
+            worker.lifo_streak = 0;
+        } else {
+            break;
+        }
+        if (stacks_) {
+            RunOnFiber(std::move(task), idle_fibers);
+        } else {
+            worker.Publish(task.get());
+            finished = nullptr;
+            task->Invoke();
+            finished = std::move(task);
+        }
+        if (compensating && TryRetire()) {
+            FlushLifoSlot(worker.lifo_slot);
+            break;
+        }
+    }
+    // Canceled if the queue is closed
+    FlushLifoSlot(worker.lifo_slot);
+    release();
+
+    {
+        auto guard = std::lock_guard(slots_lock_);
+        std::erase(slots_, &worker.slot);
+    }
+    while (worker.slot.pins.load() > 0) {
+        std::this_thread::sleep_for(std::chrono::microseconds(50));
+    }
+    current_worker = nullptr;
+}
+
+void Scheduler::ForEachWorker(const std::function<void(WorkerSlot&)>& fn) {
+    auto guard = std::lock_guard(slots_lock_);
+    for (auto slot : slots_) {
+        fn(*slot);
+    }
+}
+
+void Scheduler::FlushLifoSlot(std::shared_ptr<Task>& slot) {
+    if (auto task = std::move(slot)) {
+        if (!queue_.Put(task)) {
+            task->Cancel();
+        }
+    }
+}
+
+bool Scheduler::TryRetire() {
+    auto running = running_.load();
+    while (running > num_workers_) {
+        if (running_.compare_exchange_weak(running, running - 1)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void Scheduler::EnterBlocking() {
+    auto worker = CurrentWorker();
+    if (worker->blocking_depth++ > 0) {
+        return;
+    }
+    // Its continuation would wait for the whole blocking call
+    FlushLifoSlot(worker->lifo_slot);
+
+    if (--running_ >= num_workers_) {
+        // A compensating worker of an earlier blocked one is still around
+        return;
+    }
+    {
+        auto guard = std::lock_guard(compensators_lock_);
+        if (compensators_stopped_ || compensators_ >= kMaxCompensatingWorkers) {
+            return;
+        }
+        ++compensators_;
+    }
+    ++running_;
+    std::thread([self = shared_from_this()] {
+        self->WorkerLoop(true);
+        auto guard = std::lock_guard(self->compensators_lock_);
+        if (--self->compensators_ == 0) {
+            self->compensators_done_.notify_all();
+        }
+    }).detach();
+}
+
+void Scheduler::ExitBlocking() {
+    if (--CurrentWorker()->blocking_depth == 0 && ++running_ > num_workers_) {
+        // A compensating worker that went idle meanwhile retires on its next on_sleep
+        queue_.Notify();
+    }
+}
+
+void Scheduler::WaitCompensators() {
+    auto guard = std::unique_lock(compensators_lock_);
+    compensators_stopped_ = true;
+    compensators_done_.wait(guard, [this] { return compensators_ == 0; });
+}
+
+BlockingScope::BlockingScope()
+    : scheduler_(CurrentWorker() ? CurrentWorker()->scheduler : nullptr) {
+    if (scheduler_) {
+        scheduler_->EnterBlocking();
+    }
+}
+
+BlockingScope::~BlockingScope() {
+    if (scheduler_) {
+        scheduler_->ExitBlocking();
+    }
+}
+
+void Scheduler::StartShutdown() {
+    is_closed_ = true;
+    std::vector<std::shared_ptr<Fiber>> idle;
+    queue_.Cancel([this, &idle](std::shared_ptr<Task>& task) {
+        if (task->state_.load(std::memory_order_relaxed) & Task::kFiber) {
+            // A parked task queued for resumption is running already, it goes on here
+            // like one resumed after shutdown by Schedule
+            RunOnFiber(std::move(task), idle);
+        } else {
+            task->Cancel();
+        }
+    });
+    StopTimers();
+}
+
+void Scheduler::Close() {
+    queue_.Close();
+    StopTimers();
+}
+
+TaskGraph::NodeId TaskGraph::AddNode(std::function<void()> fn) {
+    if (frozen_) {
+        throw std::logic_error("TaskGraph is frozen");
+    }
+    fns_.push_back(std::move(fn));
+    return fns_.size() - 1;
+}
+
+void TaskGraph::AddEdge(NodeId from, NodeId to) {
+    if (frozen_) {
+        throw std::logic_error("TaskGraph is frozen");
+    }
+    if (from >= fns_.size() || to >= fns_.size()) {
+        throw std::out_of_range("TaskGraph node does not exist");
+    }
+    edges_.emplace_back(from, to);
+}
+
+size_t TaskGraph::Size() const {
+    return fns_.size();
+}
+
+void TaskGraph::Freeze() {
+    if (frozen_) {
+        return;
+    }
+    auto size = fns_.size();
+    first_successor_.assign(size + 1, 0);
+    in_degree_.assign(size, 0);
+    for (auto [from, to] : edges_) {
+        ++first_successor_[from + 1];
+        ++in_degree_[to];
+    }
+    for (size_t i = 0; i < size; ++i) {
+        first_successor_[i + 1] += first_successor_[i];
+    }
+    successors_.resize(edges_.size());
+    std::vector<uint32_t> next_slot(first_successor_.begin(), first_successor_.end() - 1);
+    for (auto [from, to] : edges_) {
+        successors_[next_slot[from]++] = to;
+    }
+
+    // Kahn's algorithm, only to reject cycles
+    auto left = in_degree_;
+    std::vector<NodeId> order;
+    order.reserve(size);
+    for (NodeId i = 0; i < size; ++i) {
+        if (left[i] == 0) {
+            roots_.push_back(i);
+            order.push_back(i);
+        }
+    }
+    for (size_t i = 0; i < order.size(); ++i) {
+        for (auto j = first_successor_[order[i]]; j < first_successor_[order[i] + 1]; ++j) {
+            if (--left[successors_[j]] == 0) {
+                order.push_back(successors_[j]);
+            }
+        }
     }
-}
\ No newline at end of file
+    if (order.size() != size) {
+        roots_.clear();
+        throw std::logic_error("TaskGraph has a cycle");
+    }
+
+    pending_ = std::make_unique<std::atomic<uint32_t>[]>(size);
+    nodes_.reserve(size);
+    for (NodeId i = 0; i < size; ++i) {
+        nodes_.push_back(std::make_shared<Node>(this, i));
+    }
+    edges_.clear();
+    edges_.shrink_to_fit();
+    frozen_ = true;
+}
+
+void TaskGraph::Run(Scheduler* scheduler) {
+    Freeze();
+    if (fns_.empty()) {
+        return;
+    }
+    scheduler_ = scheduler;
+    for (size_t i = 0; i < fns_.size(); ++i) {
+        pending_[i].store(in_degree_[i], std::memory_order_relaxed);
+    }
+    failed_.store(false);
+    error_ = nullptr;
+    done_ = false;
+    nodes_left_.store(fns_.size());
+
+    for (auto root : roots_) {
+        scheduler->Schedule(nodes_[root], false);
+    }
+    auto guard = std::unique_lock(done_lock_);
+    done_cv_.wait(guard, [this] { return done_; });
+    if (error_) {
+        std::rethrow_exception(error_);
+    }
+}
+
+void TaskGraph::RunNode(NodeId id) {
+    if (!failed_.load()) {
+        try {
+            fns_[id]();
+        } catch (...) {
+            if (!failed_.exchange(true)) {
+                error_ = std::current_exception();
+            }
+        }
+    }
+
+    // Successors go through the scheduler like continuations of a Task: all but the last
+    // ready one are queued, the last one is fused if it is the only one
+    bool several_ready = false;
+    std::optional<NodeId> ready;
+    for (auto i = first_successor_[id]; i < first_successor_[id + 1]; ++i) {
+        auto next = successors_[i];
+        if (pending_[next].fetch_sub(1) == 1) {
+            if (ready) {
+                scheduler_->Schedule(nodes_[*ready], true);
+                several_ready = true;
+            }
+            ready = next;
+        }
+    }
+    if (ready) {
+        scheduler_->Schedule(nodes_[*ready], true, !several_ready);
+    }
+
+    FinishNode();
+}
+
+void TaskGraph::CancelNode(NodeId id) {
+    if (!failed_.exchange(true)) {
+        error_ = std::make_exception_ptr(std::runtime_error("Executor is shut down"));
+    }
+    SkipNode(id);
+}
+
+void TaskGraph::SkipNode(NodeId id) {
+    // Not through the scheduler: it is closed, and a long chain would recurse in Cancel
+    std::vector<NodeId> skipped{id};
+    while (!skipped.empty()) {
+        auto node = skipped.back();
+        skipped.pop_back();
+        for (auto i = first_successor_[node]; i < first_successor_[node + 1]; ++i) {
+            if (pending_[successors_[i]].fetch_sub(1) == 1) {
+                skipped.push_back(successors_[i]);
+            }
+        }
+        FinishNode();
+    }
+}
+
+void TaskGraph::FinishNode() {
+    // Counted last: once the run is over the graph may be reused or destroyed
+    if (nodes_left_.fetch_sub(1) == 1) {
+        auto guard = std::lock_guard(done_lock_);
+        done_ = true;
+        done_cv_.notify_all();
+    }
+}
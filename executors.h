@@ -1,76 +1,46 @@
+#pragma once
+
 #include <memory>
 #include <chrono>
 #include <vector>
 #include <functional>
 #include <mutex>
 #include <condition_variable>
-#include <deque>
 #include <thread>
 #include <optional>
 #include <atomic>
+#include <cstdint>
+#include <queue>
+#include <stdexcept>
+#include <string>
 
-//////////////////////////////////////////////////////
+#include <pthread.h>
 
-using TimePoint = std::chrono::system_clock::time_point;
+#include "fiber.h"
+#include "injection_queue.h"
+#include "reactor.h"
 
-// Template UnboundedBlockingQueue
-template <typename T>
-class UnboundedBlockingQueue {
-public:
-    bool Put(T value) {
-        auto guard = std::lock_guard{mutex_};
-        if (stopped_) {
-            return false;
-        }
-        buffer_.push_back(std::move(value));
-        not_empty_.notify_one();
-        return true;
-    }
-
-    std::optional<T> Take() {
-        auto guard = std::unique_lock{mutex_};
-        not_empty_.wait(guard, [this] { return stopped_ || !buffer_.empty(); });
-        if (stopped_ && buffer_.empty()) {
-            return std::nullopt;
-        }
-        T result = std::move(buffer_.front());
-        buffer_.pop_front();
-        return result;
-    }
+//////////////////////////////////////////////////////
 
-    void Close() {
-        CloseImpl(false);
-    }
+using TimePoint = std::chrono::system_clock::time_point;
 
-    void Cancel() {
-        CloseImpl(true);
-    }
+class Scheduler;
 
-private:
-    void CloseImpl(bool clear) {
-        auto guard = std::lock_guard{mutex_};
-        stopped_ = true;
-        if (clear) {
-            buffer_.clear();
-        }
-        not_empty_.notify_all();
-    }
+class Task : public std::enable_shared_from_this<Task> {
+    friend Scheduler;
+    friend class PeriodicTask;
 
-private:
-    std::mutex mutex_;
-    std::condition_variable not_empty_;
+public:
+    Task();
 
-    bool stopped_{false};
-    std::deque<T> buffer_;
-};
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
 
-class Task : public std::enable_shared_from_this<Task> {
-public:
-    virtual ~Task(){};
+    virtual ~Task();
 
     virtual void Run() = 0;
 
-    void Invoke();
+    virtual void Invoke();
 
     void AddDependency(std::shared_ptr<Task> dep);
 
@@ -92,21 +62,367 @@ public:
 
     std::exception_ptr GetError();
 
-    void Cancel();
+    // A task that has not started yet is finished right away. A running one is not
+    // interrupted: it finishes as canceled once Run returns, so Wait also waits for Run.
+    // The executor also cancels a task it drops at shutdown, before the task has started.
+    // An override has to finish the task or account for it in its own way.
+    virtual void Cancel();
 
     void Wait();
 
+    // Name shown in Watchdog reports, set it before Submit
+    void SetLabel(std::string label);
+
+    // Empty if not set
+    const std::string& Label() const;
+
 private:
-    std::atomic<bool> is_canceled_{false};
-    std::atomic<bool> is_failed_{false};
-    std::atomic<bool> is_finished_{false};
-    bool is_completed_{false};
-    std::exception_ptr exc_ptr_;
-    std::condition_variable task_done_;
-    std::mutex doing_work_;
-    std::vector<std::shared_ptr<Task>> dependences_;
-    std::vector<std::shared_ptr<Task>> triggers_;
-    TimePoint ded_{};
+    // Bits of state_
+    static constexpr uint32_t kReady = 1;
+    static constexpr uint32_t kStarted = 2;
+    static constexpr uint32_t kFinished = 4;
+    static constexpr uint32_t kCompleted = 8;
+    static constexpr uint32_t kFailed = 16;
+    static constexpr uint32_t kCanceled = 32;
+    // Some thread sleeps in Wait on the state_ futex
+    static constexpr uint32_t kWaited = 64;
+    // The task is a fiber of a fiber Executor, workers switch into it instead of running it
+    static constexpr uint32_t kFiber = 128;
+
+    // Dependencies, triggers, deadline and error. Most tasks have none of them,
+    // so they live out of line and are allocated on first use.
+    struct Extras;
+
+    // Node of the intrusive list of tasks waiting for this one
+    struct Waiter;
+
+    // waiters_ value of a finished task
+    static Waiter* const kWaitersClosed;
+
+    Extras& GetExtras();
+
+    // Registers waiter to be notified when this task finishes.
+    // Returns false if the task is already finished.
+    bool Subscribe(std::shared_ptr<Task> waiter, bool is_dependency);
+
+    // local: predecessor finished on the worker that ran it,
+    // fuse: this task is the only continuation of that predecessor
+    void OnPredecessorFinished(bool is_dependency, bool local, bool fuse);
+
+    // Marks the task ready; only the first caller gets true
+    bool TryMarkReady();
+
+    void Finish(bool failed, bool canceled, bool local);
+
+    std::atomic<uint32_t> state_{0};
+    // Lock-free stack of waiters, closed once the task finishes
+    std::atomic<Waiter*> waiters_{nullptr};
+    std::unique_ptr<Extras> extras_;
+};
+
+// Together with the 16-byte control block of make_shared a plain task fits one cache line
+static_assert(sizeof(Task) <= 48, "Task header is over its size budget");
+
+// Receives events of tasks of every Executor while installed by SetTaskObserver, a hook
+// for tracing tools. Calls come concurrently from submitting threads and from workers.
+// Periodic tasks and TaskGraph nodes are not reported.
+class TaskObserver {
+public:
+    virtual ~TaskObserver() = default;
+
+    // The task passed to Submit, with the dependencies added by AddDependency
+    virtual void OnSubmit(const Task& task,
+                          const std::vector<std::shared_ptr<Task>>& dependencies) = 0;
+
+    // Run is about to start and has just returned or thrown
+    virtual void OnStart(const Task& task) = 0;
+    virtual void OnFinish(const Task& task) = 0;
+};
+
+// Installs observer, nullptr removes it. Returns the one installed before.
+// The observer must outlive every task that started while it was installed.
+TaskObserver* SetTaskObserver(TaskObserver* observer);
+
+enum class PeriodicPolicy {
+    // Runs are aligned to first_run + k * period, ticks missed by an overrun are skipped
+    kFixedRate,
+    // Next run starts one period after the previous one finished
+    kFixedDelay,
+};
+
+// Recurring job created by Executor::SchedulePeriodic, the only way to make one: the
+// scheduler it re-arms itself on is set there.
+// The same object is re-armed after every run, so runs never overlap.
+// Cancel() stops it, a throwing job stops as failed.
+class PeriodicTask : public Task {
+    friend Scheduler;
+    friend class Executor;
+
+public:
+    void Run() override {
+        fn_();
+    }
+
+    void Invoke() override;
+
+    // Number of finished runs
+    size_t RunCount() {
+        return run_count_.load();
+    }
+
+private:
+    PeriodicTask(std::function<void()> fn, std::chrono::system_clock::duration period,
+                 PeriodicPolicy policy)
+        : fn_(std::move(fn)), period_(period), policy_(policy) {
+    }
+
+    std::function<void()> fn_;
+    std::chrono::system_clock::duration period_;
+    PeriodicPolicy policy_;
+    TimePoint next_run_{};
+    std::atomic<size_t> run_count_{0};
+};
+
+// Scheduling state shared by Executor, its workers and parked tasks.
+// A task that becomes ready after its Executor is gone finds the scheduler closed.
+class Scheduler : public std::enable_shared_from_this<Scheduler> {
+public:
+    // Upper bound on compensating workers alive at the same time
+    static constexpr int kMaxCompensatingWorkers = 256;
+
+    // With fibers every task runs on a pooled stack of its own and parks it in a blocking
+    // Wait, the worker meanwhile runs other tasks
+    explicit Scheduler(int num_workers, std::optional<FiberOptions> fibers = std::nullopt);
+
+    ~Scheduler();
+
+    // A worker runs at most kMaxLifoStreak continuations in a row from its LIFO slot
+    // before it goes back to the global queue, so the queue is never starved.
+    static constexpr int kMaxLifoStreak = 16;
+    // Depth budget for continuations fused into the frame of the task they waited for
+    static constexpr int kMaxFusionDepth = 32;
+
+    void Submit(std::shared_ptr<Task> task);
+
+    // Puts a ready task for execution. from_predecessor means the task became ready
+    // because a task run by the current worker finished, so it is kept on that worker.
+    // fuse additionally allows running it right away on the current stack: a task that
+    // is the only continuation of its predecessor has nothing to wait for or compete with.
+    void Schedule(std::shared_ptr<Task> task, bool from_predecessor, bool fuse = false);
+
+    void SchedulePeriodic(std::shared_ptr<PeriodicTask> task);
+
+    // Makes the task ready at the given time unless something else does it first.
+    // The first timer starts the timer thread, after shutdown the task is canceled instead.
+    void AddTimer(std::shared_ptr<Task> task, TimePoint at);
+
+    // compensating: the worker was spawned for a blocked one and retires once
+    // the blocked worker is back, after its current task or when it runs out of tasks
+    void WorkerLoop(bool compensating = false);
+
+    // Called by BlockingScope on a worker of this scheduler
+    void EnterBlocking();
+    void ExitBlocking();
+
+    // Waits until every compensating worker has exited, the queue has to be closed
+    void WaitCompensators();
+
+    void StartShutdown();
+
+    void Close();
+
+    // Waits for the timer thread if it was started, has to be called after Close
+    void JoinTimers();
+
+    bool IsClosed() const {
+        return is_closed_.load();
+    }
+
+    // Switches the calling fiber out until target finishes. Returns false if the caller is
+    // not on a fiber or is inside a BlockingScope, then it has to block the thread instead.
+    static bool ParkUntilFinished(Task* target);
+
+    // The caller is a task on a fiber that can park
+    static bool CanPark();
+
+    // Stacks mapped by the fiber pool, 0 without fibers
+    size_t FiberStacks();
+
+    // Workers sleeping for lack of tasks
+    int IdleWorkers() const {
+        return queue_.Sleepers();
+    }
+
+    // What a worker is running, published for Watchdog with one relaxed store per task
+    struct WorkerSlot {
+        static constexpr int kRunShift = 48;
+        static constexpr uint64_t kTaskMask = (uint64_t{1} << kRunShift) - 1;
+
+        // Task being run with the worker's run count in the top bits, so a task allocated
+        // at the address of the previous one still changes the word. 0 while the worker
+        // sleeps. A task stays alive as long as the slot points at it.
+        std::atomic<uint64_t> running{0};
+        pthread_t thread;
+        // A pinned slot and its thread outlive ForEachWorker: an exiting worker waits
+        // until the count drops to 0
+        std::atomic<int> pins{0};
+    };
+
+    // Calls fn for the slot of every live worker, compensating ones included. The slots
+    // and their threads stay alive until fn returns, or until unpinned if fn pins them.
+    void ForEachWorker(const std::function<void(WorkerSlot&)>& fn);
+
+private:
+    // Idle fibers a worker keeps for the next tasks, the rest give their stack to the pool
+    static constexpr size_t kMaxIdleFibers = 16;
+
+    struct Fiber;
+
+    // Returns nullptr if the pool is out of stacks
+    std::shared_ptr<Fiber> MakeFiber();
+
+    // Runs task on a fiber, or resumes it if it is a parked fiber
+    void RunOnFiber(std::shared_ptr<Task> task, std::vector<std::shared_ptr<Fiber>>& idle);
+
+    static void FiberMain(void* arg);
+
+    struct Timer {
+        TimePoint at;
+        std::shared_ptr<Task> task;
+
+        bool operator>(const Timer& other) const {
+            return at > other.at;
+        }
+    };
+
+    // Sleeps until the earliest timer is due, run by timer_thread_
+    void TimerLoop();
+
+    // Cancels the tasks still waiting for their time
+    void StopTimers();
+
+    // Cancels a task whose timer is dropped
+    static void CancelTimer(const std::shared_ptr<Task>& task);
+
+    bool TryRetire();
+
+    // Moves a worker's LIFO slot task to the shared queue
+    void FlushLifoSlot(std::shared_ptr<Task>& slot);
+
+    InjectionQueue<std::shared_ptr<Task>> queue_;
+    std::atomic<bool> is_closed_{false};
+
+    std::mutex timers_lock_;
+    std::condition_variable timers_changed_;
+    std::priority_queue<Timer, std::vector<Timer>, std::greater<>> timers_;
+    bool timers_stopped_{false};
+    std::thread timer_thread_;
+
+    // Workers that are not inside a BlockingScope, compensating ones included
+    const int num_workers_;
+    std::atomic<int> running_;
+    std::mutex compensators_lock_;
+    std::condition_variable compensators_done_;
+    int compensators_{0};
+    bool compensators_stopped_{false};
+
+    std::unique_ptr<StackPool> stacks_;
+
+    std::mutex slots_lock_;
+    std::vector<WorkerSlot*> slots_;
+};
+
+// Marks the current worker as blocked (in a syscall, on a contended lock) for the scope's
+// lifetime. The executor starts a compensating worker, so the number of workers running
+// tasks stays at num_threads. Does nothing outside of executor workers.
+class BlockingScope {
+public:
+    BlockingScope();
+    ~BlockingScope();
+
+    BlockingScope(const BlockingScope&) = delete;
+    BlockingScope& operator=(const BlockingScope&) = delete;
+
+private:
+    Scheduler* scheduler_;
+};
+
+// DAG of functions that is built once and then run by Executor::Run any number of times.
+// The first run freezes the topology into flat arrays: successor indices of all nodes in one
+// vector and a per-node pending counter, so a run only resets counters and allocates nothing.
+// A graph runs on one Executor at a time.
+class TaskGraph {
+public:
+    using NodeId = uint32_t;
+
+    NodeId AddNode(std::function<void()> fn);
+
+    // to starts after from has finished
+    void AddEdge(NodeId from, NodeId to);
+
+    // Throws std::logic_error if the graph has a cycle. Nodes and edges can't be added after.
+    void Freeze();
+
+    size_t Size() const;
+
+    // Blocks until every node has run. Rethrows the first exception thrown by a node,
+    // nodes that had not started by then are skipped. If the executor shuts down meanwhile,
+    // the nodes it drops and the ones after them are skipped and Run throws
+    // std::runtime_error.
+    void Run(Scheduler* scheduler);
+
+private:
+    class Node : public Task {
+    public:
+        Node(TaskGraph* graph, NodeId id) : graph_(graph), id_(id) {
+        }
+
+        void Run() override {
+        }
+
+        void Invoke() override {
+            graph_->RunNode(id_);
+        }
+
+        // Nodes are reused by the next runs, so the task itself is never finished
+        void Cancel() override {
+            graph_->CancelNode(id_);
+        }
+
+    private:
+        TaskGraph* graph_;
+        NodeId id_;
+    };
+
+    void RunNode(NodeId id);
+
+    void CancelNode(NodeId id);
+
+    // Successors of the node that become ready, and the node itself, are counted done
+    void SkipNode(NodeId id);
+
+    void FinishNode();
+
+    std::vector<std::function<void()>> fns_;
+    std::vector<std::pair<NodeId, NodeId>> edges_;
+    bool frozen_{false};
+
+    // Frozen topology: successors of node i are successors_[first_successor_[i]..[i + 1])
+    std::vector<uint32_t> first_successor_;
+    std::vector<NodeId> successors_;
+    std::vector<uint32_t> in_degree_;
+    std::vector<NodeId> roots_;
+    std::vector<std::shared_ptr<Node>> nodes_;
+    std::unique_ptr<std::atomic<uint32_t>[]> pending_;
+
+    // State of the current run
+    Scheduler* scheduler_{nullptr};
+    std::atomic<size_t> nodes_left_{0};
+    std::atomic<bool> failed_{false};
+    std::exception_ptr error_;
+    std::mutex done_lock_;
+    std::condition_variable done_cv_;
+    bool done_{false};
 };
 
 class Executor;
@@ -116,27 +432,51 @@ class Future : public Task {
     friend Executor;
 
 public:
+    Future() {
+    }
+
+    ~Future() override {
+        if (has_value_) {
+            value_.~T();
+        }
+    }
+
     void Run() override {
-        auto guard = std::lock_guard(wait_for_value_);
         try {
-            value_ = func_();
+            new (&value_) T(func_());
+            has_value_ = true;
         } catch (...) {
             exc_ptr_ = std::current_exception();
         }
-        got_value_.store(true);
-        wait_for_value_cv_.notify_one();
     }
 
-    T Get() {
-        auto guard = std::unique_lock(wait_for_value_);
-        while (!got_value_.load()) {
-            wait_for_value_cv_.wait(guard);
+    // Waits for the task itself rather than for a separate value handshake,
+    // so the future is finished whenever Get returns
+    const T& GetRef() {
+        Wait();
+        // Canceled even if the run got to the end, a canceled future has no result
+        if (IsCanceled()) {
+            throw std::runtime_error("Future is canceled");
         }
         if (exc_ptr_) {
             rethrow_exception(exc_ptr_);
         }
         return value_;
-    };
+    }
+
+    T Get() & {
+        return GetRef();
+    }
+
+    T Get() && {
+        return Take();
+    }
+
+    // Moves the result out, the future keeps a moved-from value
+    T Take() {
+        GetRef();
+        return std::move(value_);
+    }
 
 private:
     void SetFunction(std::function<T()> f) {
@@ -144,10 +484,11 @@ private:
     }
 
     std::function<T()> func_;
-    T value_;
-    std::mutex wait_for_value_;
-    std::condition_variable wait_for_value_cv_;
-    std::atomic<bool> got_value_{false};
+    // Constructed by Run, so T needs neither a default constructor nor copy assignment
+    union {
+        T value_;
+    };
+    bool has_value_{false};
     std::exception_ptr exc_ptr_;
 };
 
@@ -159,26 +500,27 @@ struct Unit {};
 
 // Template Task sheduler
 class Executor {
+    friend class Watchdog;
+
 public:
-    Executor(int num_threads) {
+    Executor(int num_threads, std::optional<FiberOptions> fibers = std::nullopt)
+        : scheduler_(std::make_shared<Scheduler>(num_threads, fibers)) {
         working_threads_ = num_threads;
         workers_.reserve(num_threads);
         for (int i = 0; i < num_threads; ++i) {
-            workers_.emplace_back([this] { Run(); });
+            workers_.emplace_back([this] { RunWorker(); });
         }
     }
 
     void Submit(std::shared_ptr<Task> task) {
-        if (is_closed_.load()) {
-            task->Cancel();
-            return;
-        }
-        queue_.Put(std::move(task));
+        scheduler_->Submit(std::move(task));
     }
 
     void StartShutdown() {
-        is_closed_ = true;
-        queue_.Cancel();
+        scheduler_->StartShutdown();
+        if (auto reactor = GetReactor(false)) {
+            reactor->Stop();
+        }
     };
 
     void WaitShutdown() {
@@ -188,29 +530,98 @@ public:
         }
     };
 
+    // Submits task once fd is readable, see Reactor. The first registration starts
+    // the reactor thread.
+    void OnReadable(int fd, std::shared_ptr<Task> task) {
+        if (auto reactor = GetReactor(true)) {
+            reactor->OnReadable(fd, std::move(task));
+        } else {
+            task->Cancel();
+        }
+    }
+
+    void OnWritable(int fd, std::shared_ptr<Task> task) {
+        if (auto reactor = GetReactor(true)) {
+            reactor->OnWritable(fd, std::move(task));
+        } else {
+            task->Cancel();
+        }
+    }
+
+    // Cancels tasks waiting for fd, call it before closing fd
+    void Forget(int fd) {
+        // Nothing was registered before the reactor started
+        if (reactor_started_.load()) {
+            reactor_->Forget(fd);
+        }
+    }
+
+    // Stacks mapped for fibers right now, 0 for an Executor without fibers
+    size_t FiberStacks() {
+        return scheduler_->FiberStacks();
+    }
+
+    // Workers sleeping for lack of tasks right now, a hint for splitting work
+    int IdleWorkers() {
+        return scheduler_->IdleWorkers();
+    }
+
+    // Runs every node of the graph and waits for them, see TaskGraph::Run.
+    // Must not be called from a task of this executor.
+    void Run(TaskGraph& graph) {
+        if (scheduler_->IsClosed()) {
+            throw std::runtime_error("Executor is shut down");
+        }
+        graph.Run(scheduler_.get());
+    }
+
+    // Runs fn every period until the returned task is canceled.
+    // Throws std::invalid_argument unless period is positive.
+    std::shared_ptr<PeriodicTask> SchedulePeriodic(
+        std::function<void()> fn, std::chrono::system_clock::duration period,
+        PeriodicPolicy policy = PeriodicPolicy::kFixedRate) {
+        if (period <= std::chrono::system_clock::duration::zero()) {
+            throw std::invalid_argument("SchedulePeriodic needs a positive period");
+        }
+        // Not make_shared: the constructor is private
+        auto task = std::shared_ptr<PeriodicTask>(new PeriodicTask(std::move(fn), period, policy));
+        scheduler_->SchedulePeriodic(task);
+        return task;
+    }
+
     template <class T>
     FuturePtr<T> Invoke(std::function<T()> fn) {
         auto future_ptr = std::make_shared<Future<T>>();
         (*future_ptr).SetFunction(fn);
-        queue_.Put(future_ptr);
+        Submit(future_ptr);
         return future_ptr;
     }
 
+    // Invoke for blocking work, fn runs inside a BlockingScope
+    template <class T>
+    FuturePtr<T> SpawnBlocking(std::function<T()> fn) {
+        return Invoke<T>([fn = std::move(fn)] {
+            BlockingScope scope;
+            return fn();
+        });
+    }
+
     template <class Y, class T>
     FuturePtr<Y> Then(FuturePtr<T> input, std::function<Y()> fn) {
         auto future_ptr = std::make_shared<Future<Y>>();
         future_ptr->AddDependency(input);
         future_ptr->SetFunction(fn);
-        queue_.Put(future_ptr);
+        Submit(future_ptr);
         return future_ptr;
     }
 
     template <class T>
     FuturePtr<std::vector<T>> WhenAll(std::vector<FuturePtr<T>> all) {
         std::function<std::vector<T>()> f = [all]() {
-            std::vector<T> results(all.size());
-            for (size_t i = 0; i < all.size(); ++i) {
-                results[i] = all[i]->Get();
+            std::vector<T> results;
+            results.reserve(all.size());
+            for (const auto& fut_ptr : all) {
+                results.push_back(fut_ptr->GetRef());
             }
             return results;
         };
@@ -221,7 +632,7 @@ public:
         }
 
         future_ptr->SetFunction(f);
-        queue_.Put(future_ptr);
+        Submit(future_ptr);
         return future_ptr;
     }
 
@@ -240,32 +651,51 @@ public:
             std::vector<T> results;
             for (auto fut_ptr : all) {
                 if (fut_ptr->IsFinished()) {
-                    results.push_back(fut_ptr->Get());
+                    results.push_back(fut_ptr->GetRef());
                 }
             }
             return results;
         };
 
         future_ptr->SetFunction(f);
-        queue_.Put(future_ptr);
+        Submit(future_ptr);
         return future_ptr;
     }
 
     ~Executor() {
-        queue_.Close();
+        scheduler_->Close();
+        if (auto reactor = GetReactor(false)) {
+            reactor->Stop();
+        }
         for (auto& t : workers_) {
             t.join();
         }
+        scheduler_->JoinTimers();
+        if (reactor_thread_.joinable()) {
+            reactor_thread_.join();
+        }
+        scheduler_->WaitCompensators();
     }
 
 private:
-    void Run() {
-        while (auto task = queue_.Take()) {
-            task->get()->Invoke();
-            if (!task->get()->IsFinished()) {
-                queue_.Put(task.value());
+    // Starts the reactor and its thread on the first call with start set. A call without
+    // start before that makes every later call return nullptr, shutdown uses it so that
+    // registrations after it cancel their tasks.
+    Reactor* GetReactor(bool start) {
+        std::call_once(reactor_once_, [this, start] {
+            if (!start) {
+                return;
             }
-        }
+            auto reactor = std::make_unique<Reactor>(scheduler_.get());
+            reactor_thread_ = std::thread([reactor = reactor.get()] { reactor->Loop(); });
+            reactor_ = std::move(reactor);
+            reactor_started_.store(true);
+        });
+        return reactor_.get();
+    }
+
+    void RunWorker() {
+        scheduler_->WorkerLoop();
 
         auto guard = std::lock_guard(mutex_);
         if (--working_threads_ == 0) {
@@ -273,14 +703,26 @@ private:
         };
     }
 
-    UnboundedBlockingQueue<std::shared_ptr<Task>> queue_;
+    std::shared_ptr<Scheduler> scheduler_;
     std::vector<std::thread> workers_;
+    std::once_flag reactor_once_;
+    std::atomic<bool> reactor_started_{false};
+    std::unique_ptr<Reactor> reactor_;
+    std::thread reactor_thread_;
     int working_threads_;
     std::condition_variable work_done_;
     std::mutex mutex_;
-    std::atomic<bool> is_closed_{false};
 };
 
 inline std::shared_ptr<Executor> MakeThreadPoolExecutor(int num_threads) {
     return std::make_shared<Executor>(num_threads);
+}
+
+// Tasks run on fibers: Wait, Future::Get and AsyncStream::Next inside a task park the fiber
+// and free the worker for other tasks. A parked task may resume on another worker.
+// Continuations are not fused into the frame of their predecessor in this mode.
+// A task parked at shutdown goes on once what it waits for finishes, on the thread that
+// finished it. One already queued for resumption goes on in StartShutdown.
+inline std::shared_ptr<Executor> MakeFiberExecutor(int num_threads, FiberOptions options = {}) {
+    return std::make_shared<Executor>(num_threads, options);
 }
\ No newline at end of file
@@ -0,0 +1,196 @@
+#include "fair_executor.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <utility>
+
+struct FairExecutor::State {
+    State(Executor* executor, int runners) : executor(executor), runners(runners) {
+    }
+
+    static bool Eligible(const Group& group) {
+        return !group.queue.empty() && (!group.max_running || group.running < group.max_running);
+    }
+
+    // Deficit round robin, called with lock held. Returns nullptr if no group has a task
+    // it may start right now.
+    Group* Pick() {
+        while (true) {
+            bool any = false;
+            for (size_t i = 0; i < groups.size(); ++i) {
+                auto& group = *groups[current];
+                if (Eligible(group)) {
+                    if (group.deficit.count() > 0) {
+                        return &group;
+                    }
+                    any = true;
+                    group.deficit += kQuantum * group.weight;
+                }
+                current = (current + 1) % groups.size();
+            }
+            if (!any) {
+                return nullptr;
+            }
+            // A long task can put its group many rounds behind, skip the rounds in which
+            // nobody would be served
+            int64_t rounds = -1;
+            for (auto& group : groups) {
+                if (Eligible(*group) && group->deficit.count() <= 0) {
+                    auto quantum = (kQuantum * group->weight).count();
+                    int64_t needed = (quantum - group->deficit.count()) / quantum;
+                    rounds = rounds < 0 ? needed : std::min(rounds, needed);
+                }
+            }
+            if (rounds > 1) {
+                for (auto& group : groups) {
+                    if (Eligible(*group)) {
+                        group->deficit += kQuantum * group->weight * (rounds - 1);
+                    }
+                }
+            }
+        }
+    }
+
+    // Moves every queued task out, they are canceled by the caller outside of lock
+    std::vector<std::shared_ptr<Task>> Close() {
+        std::vector<std::shared_ptr<Task>> dropped;
+        closed = true;
+        for (auto& group : groups) {
+            for (auto& [task, queued_at] : group->queue) {
+                dropped.push_back(std::move(task));
+            }
+            group->queue.clear();
+        }
+        return dropped;
+    }
+
+    Executor* executor;
+    const int runners;
+
+    std::mutex lock;
+    std::vector<std::unique_ptr<Group>> groups;
+    // Next group to visit in the round
+    size_t current = 0;
+    // Runners submitted to the Executor and not finished yet
+    int in_flight = 0;
+    bool closed = false;
+};
+
+class FairExecutor::Runner : public Task {
+public:
+    explicit Runner(std::shared_ptr<State> state) : state_(std::move(state)) {
+    }
+
+    // The Executor dropped the runner without running it, so it is shutting down
+    ~Runner() override {
+        if (ran_) {
+            return;
+        }
+        std::vector<std::shared_ptr<Task>> dropped;
+        {
+            auto guard = std::lock_guard(state_->lock);
+            --state_->in_flight;
+            dropped = state_->Close();
+        }
+        for (auto& task : dropped) {
+            task->Cancel();
+        }
+    }
+
+    void Run() override {
+        ran_ = true;
+        auto slice_end = Clock::now() + kRunnerSlice;
+        auto guard = std::unique_lock(state_->lock);
+        while (true) {
+            auto group = state_->Pick();
+            if (!group) {
+                --state_->in_flight;
+                return;
+            }
+            auto [task, queued_at] = std::move(group->queue.front());
+            group->queue.pop_front();
+            if (group->queue.empty() && group->deficit.count() > 0) {
+                // An idle group does not bank unused run time
+                group->deficit = group->deficit.zero();
+            }
+            ++group->running;
+            guard.unlock();
+
+            auto start = Clock::now();
+            task->Invoke();
+            auto end = Clock::now();
+            task = nullptr;
+
+            guard.lock();
+            --group->running;
+            ++group->completed;
+            group->deficit -= end - start;
+            group->run_time += end - start;
+            group->queue_time += start - queued_at;
+            if (end >= slice_end) {
+                break;
+            }
+        }
+        guard.unlock();
+        state_->executor->Submit(std::make_shared<Runner>(state_));
+    }
+
+private:
+    std::shared_ptr<State> state_;
+    bool ran_ = false;
+};
+
+FairExecutor::FairExecutor(std::shared_ptr<Executor> executor, int runners)
+    : state_(std::make_shared<State>(executor.get(), runners)) {
+}
+
+FairExecutor::~FairExecutor() {
+    std::vector<std::shared_ptr<Task>> dropped;
+    {
+        auto guard = std::lock_guard(state_->lock);
+        dropped = state_->Close();
+    }
+    for (auto& task : dropped) {
+        task->Cancel();
+    }
+}
+
+FairExecutor::GroupId FairExecutor::AddGroup(std::string name, uint32_t weight,
+                                             size_t max_running) {
+    if (!weight) {
+        throw std::invalid_argument("group weight has to be positive");
+    }
+    auto group = std::make_unique<Group>();
+    group->name = std::move(name);
+    group->weight = weight;
+    group->max_running = max_running;
+    auto guard = std::lock_guard(state_->lock);
+    state_->groups.push_back(std::move(group));
+    return state_->groups.size() - 1;
+}
+
+void FairExecutor::Submit(GroupId group, std::shared_ptr<Task> task) {
+    {
+        auto guard = std::lock_guard(state_->lock);
+        auto& target = *state_->groups.at(group);
+        if (!state_->closed) {
+            target.queue.emplace_back(std::move(task), Clock::now());
+            if (state_->in_flight == state_->runners) {
+                return;
+            }
+            ++state_->in_flight;
+        }
+    }
+    if (task) {
+        task->Cancel();
+        return;
+    }
+    state_->executor->Submit(std::make_shared<Runner>(state_));
+}
+
+FairExecutor::GroupStats FairExecutor::Stats(GroupId group) {
+    auto guard = std::lock_guard(state_->lock);
+    auto& source = *state_->groups.at(group);
+    return {source.name,    source.weight,    source.max_running, source.queue.size(),
+            source.running, source.completed, source.run_time,    source.queue_time};
+}
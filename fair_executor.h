@@ -0,0 +1,76 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "executors.h"
+
+// Shares one Executor between several tenants.
+// Every tenant submits into its own named group. At most `runners` tasks of all groups
+// are on the Executor at once, and a free runner picks the next group by deficit round
+// robin: a group earns weight * kQuantum of run time per round and is charged the measured
+// run time of each of its tasks, so a group that floods Submit only grows its own queue.
+// A group may also be capped to max_running tasks at once.
+// Dependencies and triggers of submitted tasks are ignored. The Executor must outlive the
+// FairExecutor, tasks still queued when either of them shuts down are canceled.
+class FairExecutor {
+public:
+    static constexpr std::chrono::nanoseconds kQuantum = std::chrono::microseconds(100);
+    // A runner hands the worker back to the Executor after this much work
+    static constexpr std::chrono::nanoseconds kRunnerSlice = std::chrono::milliseconds(1);
+
+    using GroupId = size_t;
+
+    struct GroupStats {
+        std::string name;
+        uint32_t weight;
+        // 0 for no cap
+        size_t max_running;
+        size_t queued;
+        size_t running;
+        uint64_t completed;
+        // Total time tasks of the group spent running and waiting in its queue
+        std::chrono::nanoseconds run_time;
+        std::chrono::nanoseconds queue_time;
+    };
+
+    FairExecutor(std::shared_ptr<Executor> executor, int runners);
+    ~FairExecutor();
+
+    FairExecutor(const FairExecutor&) = delete;
+    FairExecutor& operator=(const FairExecutor&) = delete;
+
+    // Throws std::invalid_argument for a zero weight
+    GroupId AddGroup(std::string name, uint32_t weight, size_t max_running = 0);
+
+    void Submit(GroupId group, std::shared_ptr<Task> task);
+
+    GroupStats Stats(GroupId group);
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Group {
+        std::string name;
+        uint32_t weight;
+        size_t max_running;
+        std::deque<std::pair<std::shared_ptr<Task>, Clock::time_point>> queue;
+        size_t running = 0;
+        // Run time the group may still use in the current round, goes negative after a
+        // task overruns it
+        std::chrono::nanoseconds deficit{0};
+        uint64_t completed = 0;
+        std::chrono::nanoseconds run_time{0};
+        std::chrono::nanoseconds queue_time{0};
+    };
+
+    struct State;
+    class Runner;
+
+    std::shared_ptr<State> state_;
+};
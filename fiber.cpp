@@ -0,0 +1,168 @@
+#include "fiber.h"
+
+#include <cstdint>
+#include <exception>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#if defined(__SANITIZE_ADDRESS__)
+#define FIBER_ASAN 1
+#endif
+#if defined(__SANITIZE_THREAD__)
+#define FIBER_TSAN 1
+#endif
+#if defined(__has_feature)
+#if __has_feature(address_sanitizer)
+#define FIBER_ASAN 1
+#endif
+#if __has_feature(thread_sanitizer)
+#define FIBER_TSAN 1
+#endif
+#endif
+
+#ifdef FIBER_ASAN
+#include <sanitizer/common_interface_defs.h>
+#endif
+#ifdef FIBER_TSAN
+#include <sanitizer/tsan_interface.h>
+#endif
+
+namespace {
+
+size_t RoundToPages(size_t size) {
+    size_t page = sysconf(_SC_PAGESIZE);
+    return (size + page - 1) / page * page;
+}
+
+}  // namespace
+
+StackPool::StackPool(const FiberOptions& options)
+    : stack_size_(RoundToPages(options.stack_size)),
+      guard_size_(options.guard_page ? RoundToPages(1) : 0),
+      max_stacks_(options.max_stacks),
+      max_cached_(options.max_cached_stacks) {
+}
+
+StackPool::~StackPool() {
+    for (auto stack : free_) {
+        Unmap(stack);
+    }
+}
+
+StackPool::Stack StackPool::Allocate() {
+    {
+        auto guard = std::lock_guard(lock_);
+        if (!free_.empty()) {
+            auto stack = free_.back();
+            free_.pop_back();
+            return stack;
+        }
+        if (mapped_ == max_stacks_) {
+            return {};
+        }
+        ++mapped_;
+    }
+
+    auto total = guard_size_ + stack_size_;
+    void* region = mmap(nullptr, total, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+    if (region != MAP_FAILED && guard_size_ && mprotect(region, guard_size_, PROT_NONE) != 0) {
+        munmap(region, total);
+        region = MAP_FAILED;
+    }
+    if (region == MAP_FAILED) {
+        auto guard = std::lock_guard(lock_);
+        --mapped_;
+        return {};
+    }
+    return {static_cast<char*>(region) + guard_size_, stack_size_};
+}
+
+void StackPool::Release(Stack stack) {
+    {
+        auto guard = std::lock_guard(lock_);
+        if (free_.size() < max_cached_) {
+            free_.push_back(stack);
+            return;
+        }
+        --mapped_;
+    }
+    Unmap(stack);
+}
+
+size_t StackPool::Mapped() {
+    auto guard = std::lock_guard(lock_);
+    return mapped_;
+}
+
+void StackPool::Unmap(Stack stack) {
+    munmap(stack.base - guard_size_, guard_size_ + stack.size);
+}
+
+FiberContext::FiberContext(StackPool& pool, StackPool::Stack stack, Entry entry, void* arg)
+    : pool_(pool), stack_(stack), entry_(entry), arg_(arg) {
+    getcontext(&context_);
+    context_.uc_stack.ss_sp = stack_.base;
+    context_.uc_stack.ss_size = stack_.size;
+    context_.uc_link = nullptr;
+    // makecontext passes int arguments only
+    auto self = reinterpret_cast<uintptr_t>(this);
+    makecontext(&context_, reinterpret_cast<void (*)()>(&Trampoline), 2,
+                static_cast<unsigned>(self >> 32), static_cast<unsigned>(self));
+#ifdef FIBER_TSAN
+    tsan_fiber_ = __tsan_create_fiber(0);
+#endif
+}
+
+FiberContext::~FiberContext() {
+#ifdef FIBER_TSAN
+    __tsan_destroy_fiber(tsan_fiber_);
+#endif
+    pool_.Release(stack_);
+}
+
+void FiberContext::SwitchIn(ucontext_t* from) {
+    caller_ = from;
+    void* fake_stack = nullptr;
+#ifdef FIBER_ASAN
+    __sanitizer_start_switch_fiber(&fake_stack, stack_.base, stack_.size);
+#endif
+#ifdef FIBER_TSAN
+    tsan_caller_ = __tsan_get_current_fiber();
+    __tsan_switch_to_fiber(tsan_fiber_, 0);
+#endif
+    swapcontext(from, &context_);
+#ifdef FIBER_ASAN
+    __sanitizer_finish_switch_fiber(fake_stack, nullptr, nullptr);
+#endif
+    (void)fake_stack;
+}
+
+void FiberContext::SwitchOut() {
+    void* fake_stack = nullptr;
+#ifdef FIBER_ASAN
+    __sanitizer_start_switch_fiber(&fake_stack, caller_stack_, caller_stack_size_);
+#endif
+#ifdef FIBER_TSAN
+    __tsan_switch_to_fiber(tsan_caller_, 0);
+#endif
+    swapcontext(&context_, caller_);
+    OnSwitchedIn(fake_stack);
+}
+
+void FiberContext::OnSwitchedIn(void* fake_stack) {
+#ifdef FIBER_ASAN
+    // The caller may be another thread than last time
+    __sanitizer_finish_switch_fiber(fake_stack, &caller_stack_, &caller_stack_size_);
+#endif
+    (void)fake_stack;
+}
+
+void FiberContext::Trampoline(unsigned high, unsigned low) {
+    auto self = reinterpret_cast<FiberContext*>((uintptr_t{high} << 32) | low);
+    self->OnSwitchedIn(nullptr);
+    self->entry_(self->arg_);
+    // uc_link is null, returning would end the worker thread
+    std::terminate();
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <cstddef>
+#include <mutex>
+#include <vector>
+
+#include <ucontext.h>
+
+struct FiberOptions {
+    // Usable stack of every fiber, rounded up to whole pages
+    size_t stack_size = 64 * 1024;
+    // A PROT_NONE page below every stack turns an overflow into a segfault instead of
+    // silently corrupting the neighbour. Costs a second mapping per stack, and the kernel
+    // limits a process to vm.max_map_count mappings.
+    bool guard_page = true;
+    // Upper bound on stacks mapped at once. Without a free stack a task runs on the
+    // worker's own stack and blocks it when it waits.
+    size_t max_stacks = 1 << 20;
+    // Freed stacks kept mapped for reuse, the rest are unmapped
+    size_t max_cached_stacks = 1024;
+};
+
+// mmap-ed fiber stacks. Pages are committed on first touch, so a stack costs only what
+// its fiber actually used.
+class StackPool {
+public:
+    struct Stack {
+        // Usable region [base, base + size), the guard page is right below base
+        char* base = nullptr;
+        size_t size = 0;
+    };
+
+    explicit StackPool(const FiberOptions& options);
+    ~StackPool();
+
+    StackPool(const StackPool&) = delete;
+    StackPool& operator=(const StackPool&) = delete;
+
+    // Returns an empty Stack if max_stacks are in use or the kernel refused the mapping
+    Stack Allocate();
+
+    void Release(Stack stack);
+
+    // Stacks mapped right now, in use and cached
+    size_t Mapped();
+
+private:
+    void Unmap(Stack stack);
+
+    size_t stack_size_;
+    size_t guard_size_;
+    size_t max_stacks_;
+    size_t max_cached_;
+
+    std::mutex lock_;
+    std::vector<Stack> free_;
+    size_t mapped_{0};
+};
+
+// User-space execution context on a stack of a StackPool, switched with swapcontext.
+// The fiber runs entry(arg) when first switched in, entry must never return.
+// A suspended fiber may be switched in again by another thread.
+class FiberContext {
+public:
+    using Entry = void (*)(void*);
+
+    // Takes ownership of stack, it goes back to pool on destruction
+    FiberContext(StackPool& pool, StackPool::Stack stack, Entry entry, void* arg);
+    ~FiberContext();
+
+    FiberContext(const FiberContext&) = delete;
+    FiberContext& operator=(const FiberContext&) = delete;
+
+    // Saves the current context into from and runs the fiber until it calls SwitchOut
+    void SwitchIn(ucontext_t* from);
+
+    // Called on the fiber, returns to the last SwitchIn caller.
+    // Returns when the fiber is switched in again.
+    void SwitchOut();
+
+private:
+    static void Trampoline(unsigned high, unsigned low);
+
+    // Completes a switch into the fiber for the sanitizers
+    void OnSwitchedIn(void* fake_stack);
+
+    StackPool& pool_;
+    StackPool::Stack stack_;
+    Entry entry_;
+    void* arg_;
+    ucontext_t context_;
+    ucontext_t* caller_{nullptr};
+
+    // Sanitizer bookkeeping, unused in regular builds
+    void* tsan_fiber_{nullptr};
+    void* tsan_caller_{nullptr};
+    const void* caller_stack_{nullptr};
+    size_t caller_stack_size_{0};
+};
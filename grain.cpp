@@ -0,0 +1,249 @@
+#include "grain.h"
+
+#include <algorithm>
+
+#if defined(__x86_64__)
+#include <x86intrin.h>
+#endif
+
+GrainTuner::GrainTuner(GrainPolicy policy) : policy_(std::move(policy)) {
+}
+
+uint64_t GrainTuner::Now() {
+#if defined(__x86_64__)
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+#endif
+}
+
+double GrainTuner::TicksPerNanosecond() {
+#if defined(__x86_64__)
+    // Measured once against steady_clock, an invariant TSC ticks at a constant rate
+    static const double ticks_per_ns = [] {
+        auto clock_start = std::chrono::steady_clock::now();
+        auto ticks_start = __rdtsc();
+        auto until = clock_start + std::chrono::milliseconds(2);
+        auto clock_end = clock_start;
+        while ((clock_end = std::chrono::steady_clock::now()) < until) {
+        }
+        auto ticks = __rdtsc() - ticks_start;
+        return 1.0 * ticks / (clock_end - clock_start).count();
+    }();
+    return ticks_per_ns;
+#else
+    return 1.0;
+#endif
+}
+
+void GrainTuner::Record(uint64_t cycles, size_t items) {
+    if (!items) {
+        return;
+    }
+    uint64_t sample = cycles * 16 / items;
+    // Lost updates between racing workers only drop a sample
+    auto current = item_ticks_x16_.load(std::memory_order_relaxed);
+    if (current == 0) {
+        current = std::max<uint64_t>(sample, 1);
+    } else {
+        // A batch preempted for a whole time slice would look like slow items, so a single
+        // sample may at most quadruple the estimate
+        sample = std::min(sample, current * 4);
+        int64_t delta = static_cast<int64_t>(sample) - static_cast<int64_t>(current);
+        current = std::max<int64_t>(current + delta / (int64_t{1} << policy_.smoothing_shift), 1);
+    }
+    item_ticks_x16_.store(current, std::memory_order_relaxed);
+}
+
+std::chrono::nanoseconds GrainTuner::ItemTime() const {
+    auto ticks_x16 = item_ticks_x16_.load(std::memory_order_relaxed);
+    return std::chrono::nanoseconds(
+        static_cast<int64_t>(ticks_x16 / 16.0 / TicksPerNanosecond()));
+}
+
+size_t GrainTuner::Grain() const {
+    auto ticks_x16 = item_ticks_x16_.load(std::memory_order_relaxed);
+    if (!ticks_x16) {
+        return std::clamp<size_t>(policy_.initial_grain, 1, policy_.max_grain);
+    }
+    size_t grain;
+    if (policy_.grain) {
+        grain = policy_.grain(ItemTime());
+    } else {
+        auto target_ticks_x16 = policy_.target_time.count() * TicksPerNanosecond() * 16;
+        grain = static_cast<size_t>(target_ticks_x16 / ticks_x16);
+    }
+    return std::clamp<size_t>(grain, 1, policy_.max_grain);
+}
+
+class AdaptiveSubmitter::Batch : public Task {
+public:
+    Batch(std::shared_ptr<State> state, std::vector<std::function<void()>> fns)
+        : state_(std::move(state)), fns_(std::move(fns)) {
+    }
+
+    void Run() override {
+        auto start = GrainTuner::Now();
+        for (auto& fn : fns_) {
+            try {
+                fn();
+            } catch (...) {
+                auto guard = std::lock_guard(state_->error_lock);
+                if (!state_->error) {
+                    state_->error = std::current_exception();
+                }
+            }
+        }
+        state_->tuner.Record(GrainTuner::Now() - start, fns_.size());
+        fns_.clear();
+    }
+
+private:
+    std::shared_ptr<State> state_;
+    std::vector<std::function<void()>> fns_;
+};
+
+AdaptiveSubmitter::AdaptiveSubmitter(std::shared_ptr<Executor> executor, GrainPolicy policy)
+    : executor_(executor.get()), state_(std::make_shared<State>(std::move(policy))) {
+}
+
+AdaptiveSubmitter::~AdaptiveSubmitter() {
+    Flush();
+}
+
+void AdaptiveSubmitter::Submit(std::function<void()> fn) {
+    batch_.push_back(std::move(fn));
+    if (batch_.size() >= state_->tuner.Grain()) {
+        Flush();
+    }
+}
+
+void AdaptiveSubmitter::Flush() {
+    if (batch_.empty()) {
+        return;
+    }
+    auto batch = std::make_shared<Batch>(state_, std::move(batch_));
+    batch_.clear();
+    batch_.reserve(state_->tuner.Grain());
+    // Finished batches are dropped whenever the list doubles, so it stays proportional
+    // to the batches actually in flight
+    if (in_flight_.size() == in_flight_.capacity()) {
+        std::erase_if(in_flight_, [](const auto& task) { return task->IsFinished(); });
+    }
+    in_flight_.push_back(batch);
+    executor_->Submit(std::move(batch));
+}
+
+void AdaptiveSubmitter::Wait() {
+    Flush();
+    for (auto& batch : in_flight_) {
+        batch->Wait();
+    }
+    in_flight_.clear();
+    std::exception_ptr error;
+    {
+        auto guard = std::lock_guard(state_->error_lock);
+        std::swap(error, state_->error);
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+namespace {
+
+struct ForState {
+    ForState(Executor& executor, const std::function<void(size_t)>& fn, GrainPolicy policy,
+             size_t items)
+        : executor(executor), fn(fn), tuner(std::move(policy)), left(items) {
+    }
+
+    Executor& executor;
+    const std::function<void(size_t)>& fn;
+    GrainTuner tuner;
+    // Iterations neither run nor skipped yet
+    std::atomic<size_t> left;
+    std::atomic<bool> failed{false};
+    std::exception_ptr error;
+
+    class Done : public Task {
+    public:
+        void Run() override {
+        }
+    };
+
+    std::shared_ptr<Task> done = std::make_shared<Done>();
+};
+
+void RunRange(const std::shared_ptr<ForState>& state, size_t begin, size_t end);
+
+class RangeTask : public Task {
+public:
+    RangeTask(std::shared_ptr<ForState> state, size_t begin, size_t end)
+        : state_(std::move(state)), begin_(begin), end_(end) {
+    }
+
+    void Run() override {
+        RunRange(state_, begin_, end_);
+    }
+
+    // Dropped by a closed executor, at Submit or later in its queue: the range is run by
+    // the canceling thread, so ParallelFor still gets every iteration
+    void Cancel() override {
+        Task::Cancel();
+        RunRange(state_, begin_, end_);
+    }
+
+private:
+    std::shared_ptr<ForState> state_;
+    size_t begin_;
+    size_t end_;
+};
+
+void RunRange(const std::shared_ptr<ForState>& state, size_t begin, size_t end) {
+    while (begin < end) {
+        auto grain = state->tuner.Grain();
+        if (end - begin > 2 * grain && state->executor.IdleWorkers() > 0) {
+            auto middle = begin + (end - begin) / 2;
+            state->executor.Submit(std::make_shared<RangeTask>(state, middle, end));
+            end = middle;
+            continue;
+        }
+
+        auto stop = std::min(end, begin + grain);
+        if (!state->failed.load(std::memory_order_relaxed)) {
+            auto start = GrainTuner::Now();
+            try {
+                for (auto i = begin; i < stop; ++i) {
+                    state->fn(i);
+                }
+            } catch (...) {
+                if (!state->failed.exchange(true)) {
+                    state->error = std::current_exception();
+                }
+            }
+            state->tuner.Record(GrainTuner::Now() - start, stop - begin);
+        }
+        if (state->left.fetch_sub(stop - begin) == stop - begin) {
+            state->done->Invoke();
+        }
+        begin = stop;
+    }
+}
+
+}  // namespace
+
+void ParallelFor(Executor& executor, size_t begin, size_t end,
+                 const std::function<void(size_t)>& fn, GrainPolicy policy) {
+    if (begin >= end) {
+        return;
+    }
+    auto state = std::make_shared<ForState>(executor, fn, std::move(policy), end - begin);
+    RunRange(state, begin, end);
+    state->done->Wait();
+    if (state->error) {
+        std::rethrow_exception(state->error);
+    }
+}
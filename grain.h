@@ -0,0 +1,101 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "executors.h"
+
+// Heuristics of AdaptiveSubmitter and ParallelFor
+struct GrainPolicy {
+    // A batch or grain aims at this much run time: long enough to amortize one submission,
+    // short enough to keep the workers balanced
+    std::chrono::nanoseconds target_time = std::chrono::microseconds(20);
+    // Items per batch until the first measurement
+    size_t initial_grain = 8;
+    size_t max_grain = 4096;
+    // A new measurement moves the estimate by 1 / 2^smoothing_shift of the difference
+    int smoothing_shift = 3;
+    // Replaces the target_time / item_time rule when set
+    std::function<size_t(std::chrono::nanoseconds item_time)> grain;
+};
+
+// Estimates the run time of one item from TSC readings taken around whole batches,
+// so measuring costs two rdtsc per batch rather than a clock read per item
+class GrainTuner {
+public:
+    explicit GrainTuner(GrainPolicy policy = {});
+
+    // Items per batch for the current estimate
+    size_t Grain() const;
+
+    // items took cycles ticks of Now()
+    void Record(uint64_t cycles, size_t items);
+
+    std::chrono::nanoseconds ItemTime() const;
+
+    // Raw TSC on x86-64, nanoseconds of steady_clock elsewhere
+    static uint64_t Now();
+
+    static double TicksPerNanosecond();
+
+private:
+    GrainPolicy policy_;
+    // Moving average of ticks per item in 1/16 units, 0 until the first Record
+    std::atomic<uint64_t> item_ticks_x16_{0};
+};
+
+// Coalesces small functions into batches, each batch runs as one task on one worker.
+// The batch size follows the measured run time of the functions, so 200 ns functions go
+// in batches of ~100 and 1 ms ones go one per task. Submit and Wait are called from one
+// producer thread; a partial batch is submitted by Flush, Wait or the destructor.
+class AdaptiveSubmitter {
+public:
+    explicit AdaptiveSubmitter(std::shared_ptr<Executor> executor, GrainPolicy policy = {});
+    ~AdaptiveSubmitter();
+
+    AdaptiveSubmitter(const AdaptiveSubmitter&) = delete;
+    AdaptiveSubmitter& operator=(const AdaptiveSubmitter&) = delete;
+
+    void Submit(std::function<void()> fn);
+
+    void Flush();
+
+    // Flushes and waits for every submitted function. Rethrows the first exception thrown
+    // by one of them, functions of the same batch after it still run.
+    void Wait();
+
+    const GrainTuner& Tuner() const {
+        return state_->tuner;
+    }
+
+private:
+    struct State {
+        explicit State(GrainPolicy policy) : tuner(std::move(policy)) {
+        }
+
+        GrainTuner tuner;
+        std::atomic<size_t> pending{0};
+        std::mutex error_lock;
+        std::exception_ptr error;
+    };
+
+    class Batch;
+
+    Executor* executor_;
+    std::shared_ptr<State> state_;
+    std::vector<std::function<void()>> batch_;
+    std::vector<std::shared_ptr<Task>> in_flight_;
+};
+
+// Runs fn(i) for every i in [begin, end) and returns once all of them have run.
+// The calling thread works through the range one grain at a time and splits off the upper
+// half of what is left only while the executor has idle workers, so a busy executor pays
+// nothing for parallelism it could not use. Rethrows the first exception of fn, grains
+// not started by then are skipped. On a fiber executor the wait parks the calling task.
+// Parts dropped by an executor shutting down are run by the thread that drops them.
+void ParallelFor(Executor& executor, size_t begin, size_t end,
+                 const std::function<void(size_t)>& fn, GrainPolicy policy = {});
@@ -0,0 +1,268 @@
+#pragma once
+
+#include <atomic>
+#include <climits>
+#include <cstdint>
+#include <optional>
+#include <thread>
+#include <utility>
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+inline void FutexWait(std::atomic<uint32_t>* word, uint32_t expected) {
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAIT_PRIVATE, expected, nullptr,
+            nullptr, 0);
+}
+
+inline void FutexWake(std::atomic<uint32_t>* word, int count) {
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAKE_PRIVATE, count, nullptr,
+            nullptr, 0);
+}
+
+// Unbounded lock-free MPMC queue made of linked segments.
+// Segment is a single-pass version of MPMCBoundedQueue ring: producers claim cells with
+// fetch_add, consumers take them in order, a full segment links the next one.
+// head_ and tail_ pack the segment pointer with the number of threads currently using it
+// through this link (split reference count), so segments are freed once both links moved on.
+template <class T>
+class SegmentedQueue {
+    static constexpr size_t kSegmentSize = 1024;
+    static constexpr int kPointerBits = 48;
+    static constexpr uint64_t kOneRef = uint64_t{1} << kPointerBits;
+    static constexpr uint64_t kPointerMask = kOneRef - 1;
+    // Every segment is referenced by head_ and by tail_ before being freed
+    static constexpr int64_t kLinkRef = int64_t{1} << 32;
+
+    static_assert(sizeof(void*) == 8);
+
+    struct Cell {
+        std::atomic<bool> ready{false};
+        T value;
+    };
+
+    struct Segment {
+        std::atomic<size_t> end{0};
+        std::atomic<size_t> begin{0};
+        std::atomic<Segment*> next{nullptr};
+        std::atomic<int64_t> refs{2 * kLinkRef};
+        Cell cells[kSegmentSize];
+    };
+
+public:
+    SegmentedQueue() {
+        auto segment = reinterpret_cast<uint64_t>(new Segment);
+        head_.store(segment);
+        tail_.store(segment);
+    }
+
+    SegmentedQueue(const SegmentedQueue&) = delete;
+    SegmentedQueue& operator=(const SegmentedQueue&) = delete;
+
+    void Enqueue(T value) {
+        while (true) {
+            auto segment = Acquire(tail_);
+            auto pos = segment->end.fetch_add(1);
+            if (pos < kSegmentSize) {
+                segment->cells[pos].value = std::move(value);
+                segment->cells[pos].ready.store(true);
+                Release(tail_, segment);
+                return;
+            }
+            auto next = segment->next.load();
+            if (!next) {
+                auto fresh = new Segment;
+                if (segment->next.compare_exchange_strong(next, fresh)) {
+                    next = fresh;
+                } else {
+                    delete fresh;
+                }
+            }
+            Swing(tail_, segment, next);
+            Release(tail_, segment);
+        }
+    }
+
+    // Returns false if the queue is empty or the head cell is claimed but not yet written
+    bool Dequeue(T& data) {
+        while (true) {
+            auto segment = Acquire(head_);
+            auto pos = segment->begin.load();
+            while (pos < kSegmentSize) {
+                if (!segment->cells[pos].ready.load()) {
+                    Release(head_, segment);
+                    return false;
+                }
+                if (segment->begin.compare_exchange_weak(pos, pos + 1)) {
+                    data = std::move(segment->cells[pos].value);
+                    Release(head_, segment);
+                    return true;
+                }
+            }
+            auto next = segment->next.load();
+            if (next) {
+                Swing(head_, segment, next);
+            }
+            Release(head_, segment);
+            if (!next) {
+                return false;
+            }
+        }
+    }
+
+    ~SegmentedQueue() {
+        auto segment = reinterpret_cast<Segment*>(head_.load() & kPointerMask);
+        while (segment) {
+            delete std::exchange(segment, segment->next.load());
+        }
+    }
+
+private:
+    static Segment* Acquire(std::atomic<uint64_t>& link) {
+        return reinterpret_cast<Segment*>(link.fetch_add(kOneRef) & kPointerMask);
+    }
+
+    static void Release(std::atomic<uint64_t>& link, Segment* segment) {
+        auto current = link.load();
+        while ((current & kPointerMask) == reinterpret_cast<uint64_t>(segment)) {
+            if (link.compare_exchange_weak(current, current - kOneRef)) {
+                return;
+            }
+        }
+        // The link has moved on and handed its count over to the segment
+        Unref(segment, -1);
+    }
+
+    static void Swing(std::atomic<uint64_t>& link, Segment* from, Segment* to) {
+        auto current = link.load();
+        while ((current & kPointerMask) == reinterpret_cast<uint64_t>(from)) {
+            if (link.compare_exchange_weak(current, reinterpret_cast<uint64_t>(to))) {
+                Unref(from, static_cast<int64_t>(current >> kPointerBits) - kLinkRef);
+                return;
+            }
+        }
+    }
+
+    static void Unref(Segment* segment, int64_t delta) {
+        if (segment->refs.fetch_add(delta) + delta == 0) {
+            delete segment;
+        }
+    }
+
+    std::atomic<uint64_t> head_;
+    std::atomic<uint64_t> tail_;
+};
+
+// Task injection queue of Executor: lock-free on both ends, idle consumers park on a futex.
+// Close and Cancel wait for the Puts in progress, so a value is either rejected by Put or
+// reaches consumers or on_drop.
+template <class T>
+class InjectionQueue {
+public:
+    bool Put(T value) {
+        // Counted before the check: Stop reads the count after setting stopped_
+        producers_.fetch_add(1);
+        if (stopped_.load()) {
+            producers_.fetch_sub(1);
+            return false;
+        }
+        queue_.Enqueue(std::move(value));
+        if (sleepers_.load() > 0) {
+            epoch_.fetch_add(1);
+            FutexWake(&epoch_, 1);
+        }
+        producers_.fetch_sub(1);
+        return true;
+    }
+
+    // on_sleep is called every time the consumer is about to park, if it returns false
+    // Take returns nullopt instead
+    template <class OnSleep = bool (*)()>
+    std::optional<T> Take(OnSleep on_sleep = [] { return true; }) {
+        T result;
+        while (true) {
+            if (canceled_.load()) {
+                return std::nullopt;
+            }
+            if (queue_.Dequeue(result)) {
+                return result;
+            }
+            if (closed_.load()) {
+                return std::nullopt;
+            }
+            // Loaded before on_sleep, so a Notify after its checks is not missed
+            auto epoch = epoch_.load();
+            if (!on_sleep()) {
+                return std::nullopt;
+            }
+            sleepers_.fetch_add(1);
+            // Put publishes the value before reading sleepers_, so either we see the value
+            // here or the producer sees us and bumps epoch_
+            if (queue_.Dequeue(result)) {
+                sleepers_.fetch_sub(1);
+                return result;
+            }
+            if (!closed_.load()) {
+                FutexWait(&epoch_, epoch);
+            }
+            sleepers_.fetch_sub(1);
+        }
+    }
+
+    // Consumers parked in Take right now
+    uint32_t Sleepers() const {
+        return sleepers_.load(std::memory_order_relaxed);
+    }
+
+    // Makes every parked consumer, and every one about to park, call on_sleep again
+    void Notify() {
+        epoch_.fetch_add(1);
+        if (sleepers_.load() > 0) {
+            FutexWake(&epoch_, INT32_MAX);
+        }
+    }
+
+    // Consumers take what is left, then get nullopt
+    void Close() {
+        Stop();
+        WakeAll();
+    }
+
+    // Consumers get nullopt right away, values left in the queue are passed to on_drop
+    template <class OnDrop = void (*)(T&)>
+    void Cancel(OnDrop on_drop = [](T&) {}) {
+        canceled_.store(true);
+        Stop();
+        T dropped;
+        while (queue_.Dequeue(dropped)) {
+            on_drop(dropped);
+        }
+        WakeAll();
+    }
+
+private:
+    // Once it returns every Put has either failed or enqueued its value
+    void Stop() {
+        stopped_.store(true);
+        while (producers_.load() > 0) {
+            std::this_thread::yield();
+        }
+        closed_.store(true);
+    }
+
+    void WakeAll() {
+        epoch_.fetch_add(1);
+        FutexWake(&epoch_, INT32_MAX);
+    }
+
+    SegmentedQueue<T> queue_;
+    // Put fails from now on
+    std::atomic<bool> stopped_{false};
+    // No value is being put any more, so an empty queue stays empty
+    std::atomic<bool> closed_{false};
+    std::atomic<bool> canceled_{false};
+    std::atomic<uint32_t> producers_{0};
+    std::atomic<uint32_t> epoch_{0};
+    std::atomic<uint32_t> sleepers_{0};
+};
@@ -0,0 +1,154 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "executors.h"
+
+// Runs tasks submitted under the same key one after another, in submission order, while
+// tasks of different keys run in parallel on the workers of an Executor.
+// Keys are hashed onto a fixed power-of-two set of mailboxes, so any number of keys costs
+// nothing while idle. A busy mailbox is drained by one task at a time, which runs at most
+// kMaxBatch tasks and then yields the worker to other mailboxes.
+// Dependencies and triggers of submitted tasks are ignored, they run in mailbox order.
+// The Executor must outlive the KeyedExecutor.
+template <class Key, class Hash = std::hash<Key>>
+class KeyedExecutor {
+public:
+    static constexpr size_t kMaxBatch = 64;
+
+    explicit KeyedExecutor(std::shared_ptr<Executor> executor, size_t mailboxes = 4096)
+        : state_(std::make_shared<State>(executor.get(), RoundUp(mailboxes))) {
+    }
+
+    void Submit(const Key& key, std::shared_ptr<Task> task) {
+        state_->Push(MailboxOf(key), std::move(task));
+    }
+
+    size_t MailboxOf(const Key& key) const {
+        // Fibonacci hashing: std::hash of integers is the identity, so take the high bits
+        uint64_t hash = Hash{}(key) * 0x9E3779B97F4A7C15ull;
+        return state_->bits == 0 ? 0 : hash >> (64 - state_->bits);
+    }
+
+    size_t MailboxCount() const {
+        return state_->mailboxes.size();
+    }
+
+private:
+    // Vyukov's intrusive MPSC queue: producers swap the head, the single drainer follows
+    // next pointers from the tail. The tail node is always a consumed placeholder.
+    struct Node {
+        std::shared_ptr<Task> task;
+        std::atomic<Node*> next{nullptr};
+    };
+
+    struct alignas(64) Mailbox {
+        Mailbox() : head(new Node), tail(head.load()) {
+        }
+
+        ~Mailbox() {
+            while (tail) {
+                if (tail->task) {
+                    tail->task->Cancel();
+                }
+                delete std::exchange(tail, tail->next.load());
+            }
+        }
+
+        void Push(std::shared_ptr<Task> task) {
+            auto node = new Node{std::move(task)};
+            head.exchange(node)->next.store(node);
+        }
+
+        // Returns nullptr if the queue is empty or the next push has not linked its node yet
+        std::shared_ptr<Task> Pop() {
+            auto next = tail->next.load();
+            if (!next) {
+                return nullptr;
+            }
+            delete std::exchange(tail, next);
+            return std::move(next->task);
+        }
+
+        std::atomic<Node*> head;
+        Node* tail;
+        std::atomic<bool> scheduled{false};
+    };
+
+    struct State;
+
+    class DrainTask : public Task {
+    public:
+        DrainTask(std::shared_ptr<State> state, size_t index)
+            : state_(std::move(state)), index_(index) {
+        }
+
+        void Run() override {
+            state_->Drain(index_);
+        }
+
+    private:
+        std::shared_ptr<State> state_;
+        size_t index_;
+    };
+
+    struct State : public std::enable_shared_from_this<State> {
+        State(Executor* executor, size_t count)
+            : executor(executor), mailboxes(count), bits(Log2(count)) {
+        }
+
+        void Push(size_t index, std::shared_ptr<Task> task) {
+            auto& mailbox = mailboxes[index];
+            mailbox.Push(std::move(task));
+            if (!mailbox.scheduled.exchange(true)) {
+                executor->Submit(std::make_shared<DrainTask>(this->shared_from_this(), index));
+            }
+        }
+
+        void Drain(size_t index) {
+            auto& mailbox = mailboxes[index];
+            for (size_t i = 0; i < kMaxBatch; ++i) {
+                auto task = mailbox.Pop();
+                if (!task) {
+                    // Once the flag is down another drainer may own tail, only compare pointers
+                    auto last = mailbox.tail;
+                    mailbox.scheduled.store(false);
+                    // A producer may have pushed after the last Pop and seen the flag still set
+                    if (mailbox.head.load() == last || mailbox.scheduled.exchange(true)) {
+                        return;
+                    }
+                    break;
+                }
+                task->Invoke();
+            }
+            executor->Submit(std::make_shared<DrainTask>(this->shared_from_this(), index));
+        }
+
+        Executor* executor;
+        std::vector<Mailbox> mailboxes;
+        int bits;
+    };
+
+    static size_t RoundUp(size_t count) {
+        size_t result = 1;
+        while (result < count) {
+            result *= 2;
+        }
+        return result;
+    }
+
+    static int Log2(size_t count) {
+        int result = 0;
+        while ((size_t{1} << result) < count) {
+            ++result;
+        }
+        return result;
+    }
+
+    std::shared_ptr<State> state_;
+};
@@ -0,0 +1,219 @@
+#include "reactor.h"
+
+#include <cerrno>
+#include <cstdint>
+#include <stdexcept>
+#include <system_error>
+#include <vector>
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "executors.h"
+
+namespace {
+
+[[noreturn]] void ThrowErrno(const char* what) {
+    throw std::system_error(errno, std::generic_category(), what);
+}
+
+}  // namespace
+
+Reactor::Reactor(Scheduler* scheduler) : scheduler_(scheduler) {
+    epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd_ < 0) {
+        ThrowErrno("epoll_create1");
+    }
+    wakeup_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wakeup_fd_ < 0) {
+        close(epoll_fd_);
+        ThrowErrno("eventfd");
+    }
+    epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.fd = wakeup_fd_;
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, wakeup_fd_, &event) < 0) {
+        close(wakeup_fd_);
+        close(epoll_fd_);
+        ThrowErrno("epoll_ctl");
+    }
+}
+
+Reactor::~Reactor() {
+    close(wakeup_fd_);
+    close(epoll_fd_);
+}
+
+void Reactor::OnReadable(int fd, std::shared_ptr<Task> task) {
+    Register(fd, std::move(task), false);
+}
+
+void Reactor::OnWritable(int fd, std::shared_ptr<Task> task) {
+    Register(fd, std::move(task), true);
+}
+
+void Reactor::Register(int fd, std::shared_ptr<Task> task, bool write) {
+    {
+        auto guard = std::lock_guard(lock_);
+        if (!stopped_) {
+            auto [it, added] = watches_.try_emplace(fd);
+            auto& slot = write ? it->second.on_write : it->second.on_read;
+            if (slot) {
+                throw std::logic_error("fd already has a waiting task");
+            }
+            slot = std::move(task);
+            try {
+                Arm(fd, it->second, added);
+            } catch (...) {
+                slot = nullptr;
+                if (!it->second.on_read && !it->second.on_write) {
+                    watches_.erase(it);
+                }
+                throw;
+            }
+            return;
+        }
+        if (error_) {
+            std::rethrow_exception(error_);
+        }
+    }
+    task->Cancel();
+}
+
+void Reactor::Arm(int fd, const Watch& watch, bool added) {
+    epoll_event event{};
+    event.events = EPOLLET | EPOLLONESHOT;
+    if (watch.on_read) {
+        event.events |= EPOLLIN | EPOLLRDHUP;
+    }
+    if (watch.on_write) {
+        event.events |= EPOLLOUT;
+    }
+    event.data.fd = fd;
+    // The fd may have been closed and reopened since it was last armed,
+    // epoll forgets closed fds on its own
+    if (epoll_ctl(epoll_fd_, added ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, fd, &event) == 0) {
+        return;
+    }
+    if (errno == (added ? EEXIST : ENOENT) &&
+        epoll_ctl(epoll_fd_, added ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, fd, &event) == 0) {
+        return;
+    }
+    ThrowErrno("epoll_ctl");
+}
+
+void Reactor::Forget(int fd) {
+    Watch watch;
+    {
+        auto guard = std::lock_guard(lock_);
+        auto it = watches_.find(fd);
+        if (it == watches_.end()) {
+            return;
+        }
+        watch = std::move(it->second);
+        watches_.erase(it);
+        epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);
+    }
+    if (watch.on_read) {
+        watch.on_read->Cancel();
+    }
+    if (watch.on_write) {
+        watch.on_write->Cancel();
+    }
+}
+
+void Reactor::Loop() {
+    try {
+        Poll();
+    } catch (...) {
+        Stop(std::current_exception());
+    }
+}
+
+void Reactor::Poll() {
+    epoll_event events[kMaxEvents];
+    std::vector<std::shared_ptr<Task>> ready;
+    std::vector<std::shared_ptr<Task>> dropped;
+    ready.reserve(2 * kMaxEvents);
+    while (true) {
+        int count = epoll_wait(epoll_fd_, events, kMaxEvents, -1);
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            ThrowErrno("epoll_wait");
+        }
+        {
+            auto guard = std::lock_guard(lock_);
+            if (stopped_) {
+                return;
+            }
+            for (int i = 0; i < count; ++i) {
+                auto fd = events[i].data.fd;
+                auto it = watches_.find(fd);
+                if (fd == wakeup_fd_ || it == watches_.end()) {
+                    continue;
+                }
+                auto& watch = it->second;
+                auto happened = events[i].events;
+                bool failed = happened & (EPOLLERR | EPOLLHUP);
+                if (watch.on_read && (failed || (happened & (EPOLLIN | EPOLLRDHUP)))) {
+                    ready.push_back(std::move(watch.on_read));
+                }
+                if (watch.on_write && (failed || (happened & EPOLLOUT))) {
+                    ready.push_back(std::move(watch.on_write));
+                }
+                // One-shot disarmed the fd, the other direction may still be waited for
+                if (watch.on_read || watch.on_write) {
+                    try {
+                        Arm(fd, watch, false);
+                    } catch (const std::system_error&) {
+                        // The fd was closed without Forget
+                        for (auto task : {&watch.on_read, &watch.on_write}) {
+                            if (*task) {
+                                dropped.push_back(std::move(*task));
+                            }
+                        }
+                        watches_.erase(it);
+                    }
+                }
+            }
+        }
+        for (auto& task : ready) {
+            scheduler_->Submit(std::move(task));
+        }
+        ready.clear();
+        for (auto& task : dropped) {
+            task->Cancel();
+        }
+        dropped.clear();
+    }
+}
+
+void Reactor::Stop() {
+    Stop(nullptr);
+}
+
+void Reactor::Stop(std::exception_ptr error) {
+    std::unordered_map<int, Watch> watches;
+    {
+        auto guard = std::lock_guard(lock_);
+        if (stopped_) {
+            return;
+        }
+        stopped_ = true;
+        error_ = std::move(error);
+        watches.swap(watches_);
+    }
+    uint64_t one = 1;
+    [[maybe_unused]] auto written = write(wakeup_fd_, &one, sizeof(one));
+    for (auto& [fd, watch] : watches) {
+        if (watch.on_read) {
+            watch.on_read->Cancel();
+        }
+        if (watch.on_write) {
+            watch.on_write->Cancel();
+        }
+    }
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+class Task;
+class Scheduler;
+
+// Edge-triggered epoll loop that submits tasks when file descriptors become ready.
+// Every registration is one-shot: the task is submitted once, then the fd has to be
+// registered again. One epoll_wait hands over up to kMaxEvents ready fds at once.
+class Reactor {
+public:
+    static constexpr int kMaxEvents = 256;
+
+    explicit Reactor(Scheduler* scheduler);
+    ~Reactor();
+
+    Reactor(const Reactor&) = delete;
+    Reactor& operator=(const Reactor&) = delete;
+
+    // Submit task once fd is readable (or hung up, or failed).
+    // Throws std::logic_error if fd already has a task waiting for the same event,
+    // and the error that ended Loop if it failed.
+    void OnReadable(int fd, std::shared_ptr<Task> task);
+
+    void OnWritable(int fd, std::shared_ptr<Task> task);
+
+    // Cancels tasks still waiting for fd, has to be called before fd is closed
+    void Forget(int fd);
+
+    // Waits for events until Stop, run by a dedicated Executor thread.
+    // Never throws: an error stops the reactor like Stop and is kept for Register.
+    void Loop();
+
+    // Wakes Loop up and cancels every waiting task, nothing can be registered after
+    void Stop();
+
+private:
+    struct Watch {
+        std::shared_ptr<Task> on_read;
+        std::shared_ptr<Task> on_write;
+    };
+
+    void Register(int fd, std::shared_ptr<Task> task, bool write);
+
+    void Poll();
+
+    // Stops the reactor, error is kept unless it is null
+    void Stop(std::exception_ptr error);
+
+    // Called with lock_ held
+    void Arm(int fd, const Watch& watch, bool added);
+
+    Scheduler* scheduler_;
+    int epoll_fd_;
+    int wakeup_fd_;
+
+    std::mutex lock_;
+    std::unordered_map<int, Watch> watches_;
+    bool stopped_{false};
+    std::exception_ptr error_;
+};
@@ -1,6 +1,23 @@
 #include <benchmark/benchmark.h>
 
 #include <executors.h>
+#include <async_stream.h>
+#include <keyed_executor.h>
+#include <fair_executor.h>
+#include <grain.h>
+#include <simulator.h>
+#include <watchdog.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <future>
+#include <random>
+
+#include <fcntl.h>
+#include <malloc.h>
+#include <sys/socket.h>
+#include <unistd.h>
 
 class EmptyTask : public Task {
 public:
@@ -8,6 +25,41 @@ public:
     }
 };
 
+// Heap bytes held per task while range(0) tasks are alive: plain tasks when range(1) == 0,
+// tasks with one dependency each when range(1) == 1, Then-chained futures when range(1) == 2
+static void BenchmarkMemoryPerTask(benchmark::State& state) {
+    auto executor = MakeThreadPoolExecutor(1);
+    const int count = state.range(0);
+    double bytes = 0;
+    for (auto _ : state) {
+        std::vector<std::shared_ptr<Task>> tasks;
+        tasks.reserve(count);
+        auto root = executor->Invoke<int>([] { return 0; });
+        root->Wait();
+        auto tasks_start = mallinfo2().uordblks;
+        for (int i = 0; i < count; ++i) {
+            if (state.range(1) == 0) {
+                tasks.push_back(std::make_shared<EmptyTask>());
+            } else if (state.range(1) == 1) {
+                auto task = std::make_shared<EmptyTask>();
+                task->AddDependency(root);
+                tasks.push_back(std::move(task));
+            } else {
+                tasks.push_back(executor->Then<int>(root, [] { return 1; }));
+            }
+        }
+        bytes = static_cast<double>(mallinfo2().uordblks - tasks_start) / count;
+    }
+    state.counters["bytes_per_task"] = bytes;
+}
+
+BENCHMARK(BenchmarkMemoryPerTask)
+    ->Args({100000, 0})
+    ->Args({100000, 1})
+    ->Args({100000, 2})
+    ->Iterations(3)
+    ->Unit(benchmark::kMillisecond);
+
 static void BenchmarkSimpleSubmit(benchmark::State& state) {
     auto executor = MakeThreadPoolExecutor(state.range(0));
     for (auto _ : state) {
@@ -51,6 +103,67 @@ BENCHMARK(BenchmarkFanoutFanin)
     ->Args({10, 10})
     ->Args({10, 100});
 
+using Buffer = std::shared_ptr<std::vector<uint32_t>>;
+
+// Every stage of the chain rewrites the same 1 MB buffer produced by the previous one
+static void BenchmarkThenChainLocality(benchmark::State& state) {
+    auto executor = MakeThreadPoolExecutor(state.range(0));
+    const size_t buffer_size = (1 << 20) / sizeof(uint32_t);
+    for (auto _ : state) {
+        auto future = executor->Invoke<Buffer>(
+            [&] { return std::make_shared<std::vector<uint32_t>>(buffer_size, 1); });
+        for (int i = 0; i < state.range(1); ++i) {
+            future = executor->Then<Buffer>(future, [future] {
+                auto buffer = future->Get();
+                for (auto& x : *buffer) {
+                    x = x * 3 + 1;
+                }
+                return buffer;
+            });
+        }
+        benchmark::DoNotOptimize(future->Get()->front());
+    }
+    state.SetBytesProcessed(state.iterations() * state.range(1) * (1 << 20));
+}
+
+BENCHMARK(BenchmarkThenChainLocality)
+    ->Args({1, 16})
+    ->Args({2, 16})
+    ->Args({4, 16})
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+// Stages pass a 1MB vector by value: range(1) == 0 copies it out with Get(),
+// range(1) == 1 moves it out with Take()
+static void BenchmarkLargeResultChain(benchmark::State& state) {
+    auto executor = MakeThreadPoolExecutor(state.range(0));
+    const size_t size = (1 << 20) / sizeof(uint32_t);
+    const bool take = state.range(1);
+    for (auto _ : state) {
+        auto future = executor->Invoke<std::vector<uint32_t>>(
+            [&] { return std::vector<uint32_t>(size, 1); });
+        for (int i = 0; i < 16; ++i) {
+            future = executor->Then<std::vector<uint32_t>>(future, [future, take] {
+                auto buffer = take ? future->Take() : future->Get();
+                for (auto& x : buffer) {
+                    x = x * 3 + 1;
+                }
+                return buffer;
+            });
+        }
+        benchmark::DoNotOptimize(future->GetRef().front());
+    }
+    state.SetBytesProcessed(state.iterations() * 16 * (1 << 20));
+}
+
+BENCHMARK(BenchmarkLargeResultChain)
+    ->Args({1, 0})
+    ->Args({1, 1})
+    ->Args({4, 0})
+    ->Args({4, 1})
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
 class Latch {
 public:
     Latch(size_t count) : counter_(count) {
@@ -112,4 +225,1150 @@ BENCHMARK(BenchmarkScalableTimers)
     ->Args({5, 100000})
     ->Unit(benchmark::kMillisecond);
 
+// range(1) external threads hammer Submit at the same time
+static void BenchmarkExternalSubmit(benchmark::State& state) {
+    auto executor = MakeThreadPoolExecutor(state.range(0));
+    const int producers = state.range(1);
+    const int tasks_per_producer = 10000;
+    for (auto _ : state) {
+        Latch latch(producers * tasks_per_producer);
+        std::vector<std::thread> threads;
+        for (int i = 0; i < producers; ++i) {
+            threads.emplace_back([&] {
+                for (int j = 0; j < tasks_per_producer; ++j) {
+                    executor->Submit(std::make_shared<LatchSignaler>(&latch));
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        latch.Wait();
+    }
+    state.SetItemsProcessed(state.iterations() * producers * tasks_per_producer);
+}
+
+BENCHMARK(BenchmarkExternalSubmit)
+    ->Args({4, 1})
+    ->Args({4, 16})
+    ->Args({8, 16})
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+// Periodic job done by hand: every run submits a fresh task with a time trigger
+class ResubmittingTask : public Task {
+public:
+    ResubmittingTask(Executor* executor, std::atomic<int>* runs, std::atomic<bool>* stopped)
+        : executor_(executor), runs_(runs), stopped_(stopped) {
+    }
+
+    virtual void Run() override {
+        if (stopped_->load()) {
+            return;
+        }
+        ++*runs_;
+        auto next = std::make_shared<ResubmittingTask>(executor_, runs_, stopped_);
+        next->SetTimeTrigger(std::chrono::system_clock::now() + std::chrono::milliseconds(1));
+        executor_->Submit(next);
+    }
+
+private:
+    Executor* executor_;
+    std::atomic<int>* runs_;
+    std::atomic<bool>* stopped_;
+};
+
+static void WaitForRuns(const std::atomic<int>& runs, int count) {
+    while (runs.load() < count) {
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+}
+
+// range(1) jobs with 1 ms period, every iteration waits for 10 runs of each
+static void BenchmarkPeriodicJobs(benchmark::State& state) {
+    // Canceled jobs may still be finishing a run, so the counter outlives the executor
+    std::atomic<int> runs{0};
+    auto executor = MakeThreadPoolExecutor(state.range(0));
+    for (auto _ : state) {
+        int target = runs.load() + state.range(1) * 10;
+        std::vector<std::shared_ptr<PeriodicTask>> jobs;
+        for (int i = 0; i < state.range(1); ++i) {
+            jobs.push_back(
+                executor->SchedulePeriodic([&] { ++runs; }, std::chrono::milliseconds(1)));
+        }
+        WaitForRuns(runs, target);
+        for (auto& job : jobs) {
+            job->Cancel();
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(1) * 10);
+}
+
+BENCHMARK(BenchmarkPeriodicJobs)
+    ->Args({2, 1000})
+    ->Args({4, 5000})
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+static void BenchmarkResubmittingJobs(benchmark::State& state) {
+    std::atomic<int> runs{0};
+    std::vector<std::unique_ptr<std::atomic<bool>>> stop_flags;
+    auto executor = MakeThreadPoolExecutor(state.range(0));
+    for (auto _ : state) {
+        int target = runs.load() + state.range(1) * 10;
+        auto& stopped = *stop_flags.emplace_back(std::make_unique<std::atomic<bool>>(false));
+        for (int i = 0; i < state.range(1); ++i) {
+            auto job = std::make_shared<ResubmittingTask>(executor.get(), &runs, &stopped);
+            job->SetTimeTrigger(std::chrono::system_clock::now() + std::chrono::milliseconds(1));
+            executor->Submit(job);
+        }
+        WaitForRuns(runs, target);
+        stopped = true;
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(1) * 10);
+}
+
+BENCHMARK(BenchmarkResubmittingJobs)
+    ->Args({2, 1000})
+    ->Args({4, 5000})
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+// Same Map/Filter/Batch pipeline streamed through bounded buffers and materialized in vectors
+static void BenchmarkStreamPipeline(benchmark::State& state) {
+    auto executor = MakeThreadPoolExecutor(state.range(0));
+    const int count = state.range(1);
+    for (auto _ : state) {
+        auto stream = MakeAsyncStream<int>(
+                          executor,
+                          [i = 0, count]() mutable -> std::optional<int> {
+                              if (i == count) {
+                                  return std::nullopt;
+                              }
+                              return i++;
+                          },
+                          1024)
+                          .Map([](int x) { return x * 3; })
+                          .Filter([](const int& x) { return x % 2 == 0; })
+                          .Batch(64);
+        int64_t sum = 0;
+        while (auto batch = stream.Next()) {
+            for (int x : *batch) {
+                sum += x;
+            }
+        }
+        benchmark::DoNotOptimize(sum);
+    }
+    state.SetItemsProcessed(state.iterations() * count);
+}
+
+BENCHMARK(BenchmarkStreamPipeline)
+    ->Args({2, 1000000})
+    ->Args({4, 1000000})
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+static void BenchmarkMaterializedPipeline(benchmark::State& state) {
+    auto executor = MakeThreadPoolExecutor(state.range(0));
+    const int count = state.range(1);
+    for (auto _ : state) {
+        auto source = executor->Invoke<std::vector<int>>([count] {
+            std::vector<int> all(count);
+            for (int i = 0; i < count; ++i) {
+                all[i] = i;
+            }
+            return all;
+        });
+        auto mapped = executor->Then<std::vector<int>>(source, [source] {
+            auto all = source->Get();
+            for (auto& x : all) {
+                x *= 3;
+            }
+            return all;
+        });
+        auto batches = executor->Then<std::vector<std::vector<int>>>(mapped, [mapped] {
+            std::vector<std::vector<int>> result(1);
+            for (int x : mapped->Get()) {
+                if (x % 2 != 0) {
+                    continue;
+                }
+                if (result.back().size() == 64) {
+                    result.emplace_back();
+                }
+                result.back().push_back(x);
+            }
+            return result;
+        });
+        int64_t sum = 0;
+        for (const auto& batch : batches->Get()) {
+            for (int x : batch) {
+                sum += x;
+            }
+        }
+        benchmark::DoNotOptimize(sum);
+    }
+    state.SetItemsProcessed(state.iterations() * count);
+}
+
+BENCHMARK(BenchmarkMaterializedPipeline)
+    ->Args({2, 1000000})
+    ->Args({4, 1000000})
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+// Submit-to-start latency of every task run during the benchmark
+class LatencyRecorder {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    void StartIteration(size_t count) {
+        first_ = samples_.size();
+        samples_.resize(first_ + count);
+    }
+
+    void Record(size_t index, Clock::time_point submitted) {
+        samples_[first_ + index] = (Clock::now() - submitted).count();
+    }
+
+    void Report(benchmark::State& state) {
+        if (samples_.empty()) {
+            return;
+        }
+        std::sort(samples_.begin(), samples_.end());
+        auto percentile = [&](double p) {
+            return samples_[static_cast<size_t>(p * (samples_.size() - 1))] / 1000.0;
+        };
+        state.counters["p50_us"] = percentile(0.5);
+        state.counters["p99_us"] = percentile(0.99);
+        state.counters["p999_us"] = percentile(0.999);
+    }
+
+private:
+    size_t first_ = 0;
+    std::vector<int64_t> samples_;
+};
+
+static void SpinFor(std::chrono::nanoseconds duration) {
+    auto end = std::chrono::steady_clock::now() + duration;
+    while (std::chrono::steady_clock::now() < end) {
+    }
+}
+
+// Every kLargeTaskPeriod-th task of the mixed workload spins for kLargeTaskWork
+const int kLargeTaskPeriod = 16;
+const auto kLargeTaskWork = std::chrono::microseconds(50);
+
+static std::chrono::nanoseconds MixedTaskWork(size_t index) {
+    if (index % kLargeTaskPeriod == 0) {
+        return kLargeTaskWork;
+    }
+    return std::chrono::nanoseconds(0);
+}
+
+class TimedTask : public Task {
+public:
+    TimedTask(LatencyRecorder* recorder, Latch* latch, size_t index,
+              std::chrono::nanoseconds work)
+        : recorder_(recorder), latch_(latch), index_(index), work_(work) {
+    }
+
+    virtual void Run() override {
+        recorder_->Record(index_, submitted_);
+        SpinFor(work_);
+        latch_->Signal();
+    }
+
+    void MarkSubmitted() {
+        submitted_ = LatencyRecorder::Clock::now();
+    }
+
+private:
+    LatencyRecorder* recorder_;
+    Latch* latch_;
+    size_t index_;
+    std::chrono::nanoseconds work_;
+    LatencyRecorder::Clock::time_point submitted_;
+};
+
+static void BenchmarkThenChain(benchmark::State& state) {
+    auto executor = MakeThreadPoolExecutor(state.range(0));
+    for (auto _ : state) {
+        auto future = executor->Invoke<int>([] { return 0; });
+        for (int i = 0; i < state.range(1); ++i) {
+            future = executor->Then<int>(future, [future] { return future->Get() + 1; });
+        }
+        benchmark::DoNotOptimize(future->Get());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(1));
+}
+
+BENCHMARK(BenchmarkThenChain)
+    ->Args({1, 1000})
+    ->Args({4, 1000})
+    ->Args({1, 10000})
+    ->Args({4, 10000})
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+// The chain is built before its head finishes, so every stage is ready when the previous
+// one completes and runs fused with it on the same worker
+static void BenchmarkReadyThenChain(benchmark::State& state) {
+    auto executor = MakeThreadPoolExecutor(state.range(0));
+    for (auto _ : state) {
+        state.PauseTiming();
+        std::promise<void> start;
+        auto started = start.get_future().share();
+        auto future = executor->Invoke<int>([started] {
+            started.wait();
+            return 0;
+        });
+        for (int i = 0; i < state.range(1); ++i) {
+            future = executor->Then<int>(future, [future] { return future->Get() + 1; });
+        }
+        state.ResumeTiming();
+        start.set_value();
+        benchmark::DoNotOptimize(future->Get());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(1));
+}
+
+BENCHMARK(BenchmarkReadyThenChain)
+    ->Args({1, 1000})
+    ->Args({4, 1000})
+    ->Args({1, 10000})
+    ->Args({4, 10000})
+    ->Unit(benchmark::kMillisecond);
+
+static void BenchmarkWhenAll(benchmark::State& state) {
+    auto executor = MakeThreadPoolExecutor(state.range(0));
+    for (auto _ : state) {
+        std::vector<FuturePtr<int>> all;
+        all.reserve(state.range(1));
+        for (int i = 0; i < state.range(1); ++i) {
+            all.push_back(executor->Invoke<int>([i] { return i; }));
+        }
+        benchmark::DoNotOptimize(executor->WhenAll(all)->Get().size());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(1));
+}
+
+BENCHMARK(BenchmarkWhenAll)
+    ->Args({1, 10000})
+    ->Args({4, 10000})
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+// Half of the futures wait for a slow one and miss the deadline
+static void BenchmarkWhenAllBeforeDeadline(benchmark::State& state) {
+    auto executor = MakeThreadPoolExecutor(state.range(0));
+    for (auto _ : state) {
+        auto deadline = std::chrono::system_clock::now() + std::chrono::milliseconds(1);
+        auto slow = executor->Invoke<Unit>([] {
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+            return Unit{};
+        });
+        std::vector<FuturePtr<int>> all;
+        for (int i = 0; i < state.range(1); ++i) {
+            if (i % 2 == 0) {
+                all.push_back(executor->Invoke<int>([i] { return i; }));
+            } else {
+                all.push_back(executor->Then<int>(slow, [i] { return i; }));
+            }
+        }
+        benchmark::DoNotOptimize(executor->WhenAllBeforeDeadline(all, deadline)->Get().size());
+        slow->Wait();
+    }
+}
+
+BENCHMARK(BenchmarkWhenAllBeforeDeadline)
+    ->Args({2, 1000})
+    ->Args({4, 1000})
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+// Every node depends on up to range(2) random earlier nodes, the sink depends on all of them
+static void BenchmarkRandomDag(benchmark::State& state) {
+    auto executor = MakeThreadPoolExecutor(state.range(0));
+    std::mt19937 gen(42);
+    for (auto _ : state) {
+        std::vector<std::shared_ptr<EmptyTask>> nodes(state.range(1));
+        auto sink = std::make_shared<EmptyTask>();
+        for (size_t i = 0; i < nodes.size(); ++i) {
+            nodes[i] = std::make_shared<EmptyTask>();
+            for (int j = 0; i > 0 && j < state.range(2); ++j) {
+                nodes[i]->AddDependency(nodes[gen() % i]);
+            }
+            sink->AddDependency(nodes[i]);
+        }
+        for (auto& node : nodes) {
+            executor->Submit(node);
+        }
+        executor->Submit(sink);
+        sink->Wait();
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(1));
+}
+
+BENCHMARK(BenchmarkRandomDag)
+    ->Args({1, 1000, 3})
+    ->Args({4, 1000, 3})
+    ->Args({4, 1000, 10})
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+// The same DAG of range(1) nodes, each depending on up to 3 earlier ones, either rebuilt from
+// Task objects for every request or frozen once into a TaskGraph
+static std::vector<std::pair<uint32_t, uint32_t>> MakeRequestDagEdges(size_t size) {
+    std::mt19937 gen(42);
+    std::vector<std::pair<uint32_t, uint32_t>> edges;
+    for (uint32_t i = 1; i < size; ++i) {
+        for (int j = 0; j < 3; ++j) {
+            edges.emplace_back(gen() % i, i);
+        }
+    }
+    return edges;
+}
+
+static void BenchmarkRebuiltDag(benchmark::State& state) {
+    auto executor = MakeThreadPoolExecutor(state.range(0));
+    auto edges = MakeRequestDagEdges(state.range(1));
+    for (auto _ : state) {
+        std::vector<std::shared_ptr<EmptyTask>> nodes(state.range(1));
+        for (auto& node : nodes) {
+            node = std::make_shared<EmptyTask>();
+        }
+        for (auto [from, to] : edges) {
+            nodes[to]->AddDependency(nodes[from]);
+        }
+        for (auto& node : nodes) {
+            executor->Submit(node);
+        }
+        for (auto& node : nodes) {
+            node->Wait();
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(1));
+}
+
+BENCHMARK(BenchmarkRebuiltDag)
+    ->Args({1, 40})
+    ->Args({4, 40})
+    ->Unit(benchmark::kMicrosecond)
+    ->UseRealTime();
+
+static void BenchmarkStaticTaskGraph(benchmark::State& state) {
+    auto executor = MakeThreadPoolExecutor(state.range(0));
+    TaskGraph graph;
+    for (int i = 0; i < state.range(1); ++i) {
+        graph.AddNode([] {});
+    }
+    for (auto [from, to] : MakeRequestDagEdges(state.range(1))) {
+        graph.AddEdge(from, to);
+    }
+    graph.Freeze();
+    for (auto _ : state) {
+        executor->Run(graph);
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(1));
+}
+
+BENCHMARK(BenchmarkStaticTaskGraph)
+    ->Args({1, 40})
+    ->Args({4, 40})
+    ->Unit(benchmark::kMicrosecond)
+    ->UseRealTime();
+
+// Echo server side of one connection: drains the socket, writes everything back
+// and waits for the next request
+class EchoTask : public Task {
+public:
+    EchoTask(int fd, Executor* executor) : fd_(fd), executor_(executor) {
+    }
+
+    void Run() override {
+        char buffer[4096];
+        ssize_t size;
+        while ((size = read(fd_, buffer, sizeof(buffer))) > 0) {
+            benchmark::DoNotOptimize(write(fd_, buffer, size));
+        }
+        if (size == 0) {
+            return;
+        }
+        executor_->OnReadable(fd_, std::make_shared<EchoTask>(fd_, executor_));
+    }
+
+private:
+    int fd_;
+    Executor* executor_;
+};
+
+const size_t kEchoMessageSize = 64;
+
+// One round: the client sends a message on every connection, then reads all the replies
+static void EchoRound(const std::vector<int>& clients) {
+    char message[kEchoMessageSize] = {};
+    for (int fd : clients) {
+        benchmark::DoNotOptimize(write(fd, message, sizeof(message)));
+    }
+    for (int fd : clients) {
+        size_t received = 0;
+        while (received < sizeof(message)) {
+            auto size = read(fd, message, sizeof(message) - received);
+            if (size <= 0) {
+                return;
+            }
+            received += size;
+        }
+    }
+}
+
+static std::pair<std::vector<int>, std::vector<int>> MakeConnections(int count,
+                                                                     bool nonblocking_server) {
+    std::vector<int> clients, servers;
+    for (int i = 0; i < count; ++i) {
+        int fds[2];
+        socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+        if (nonblocking_server) {
+            fcntl(fds[1], F_SETFL, fcntl(fds[1], F_GETFL) | O_NONBLOCK);
+        }
+        clients.push_back(fds[0]);
+        servers.push_back(fds[1]);
+    }
+    return {clients, servers};
+}
+
+static void BenchmarkEchoReactor(benchmark::State& state) {
+    auto executor = MakeThreadPoolExecutor(state.range(0));
+    auto [clients, servers] = MakeConnections(state.range(1), true);
+    for (int fd : servers) {
+        executor->OnReadable(fd, std::make_shared<EchoTask>(fd, executor.get()));
+    }
+    for (auto _ : state) {
+        EchoRound(clients);
+    }
+    executor.reset();
+    for (int fd : clients) {
+        close(fd);
+    }
+    for (int fd : servers) {
+        close(fd);
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(1));
+}
+
+BENCHMARK(BenchmarkEchoReactor)
+    ->Args({1, 16})
+    ->Args({4, 16})
+    ->Args({4, 256})
+    ->Unit(benchmark::kMicrosecond)
+    ->UseRealTime();
+
+static void BenchmarkEchoThreadPerConnection(benchmark::State& state) {
+    auto [clients, servers] = MakeConnections(state.range(1), false);
+    std::vector<std::thread> threads;
+    for (int fd : servers) {
+        threads.emplace_back([fd] {
+            char buffer[4096];
+            ssize_t size;
+            while ((size = read(fd, buffer, sizeof(buffer))) > 0) {
+                benchmark::DoNotOptimize(write(fd, buffer, size));
+            }
+        });
+    }
+    for (auto _ : state) {
+        EchoRound(clients);
+    }
+    for (int fd : clients) {
+        close(fd);
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    for (int fd : servers) {
+        close(fd);
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(1));
+}
+
+BENCHMARK(BenchmarkEchoThreadPerConnection)
+    ->Args({0, 16})
+    ->Args({0, 256})
+    ->Unit(benchmark::kMicrosecond)
+    ->UseRealTime();
+
+class ForkTask : public Task {
+public:
+    ForkTask(int depth, Latch* latch, Executor* executor)
+        : depth_(depth), latch_(latch), executor_(executor) {
+    }
+
+    virtual void Run() override {
+        if (depth_ == 0) {
+            latch_->Signal();
+            return;
+        }
+        for (int i = 0; i < 2; ++i) {
+            executor_->Submit(std::make_shared<ForkTask>(depth_ - 1, latch_, executor_));
+        }
+    }
+
+private:
+    int depth_;
+    Latch* latch_;
+    Executor* executor_;
+};
+
+static void BenchmarkForkJoin(benchmark::State& state) {
+    auto executor = MakeThreadPoolExecutor(state.range(0));
+    for (auto _ : state) {
+        Latch latch(1 << state.range(1));
+        executor->Submit(std::make_shared<ForkTask>(state.range(1), &latch, executor.get()));
+        latch.Wait();
+    }
+    state.SetItemsProcessed(state.iterations() * ((2 << state.range(1)) - 1));
+}
+
+BENCHMARK(BenchmarkForkJoin)
+    ->Args({1, 8})
+    ->Args({4, 8})
+    ->Args({1, 14})
+    ->Args({4, 14})
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+static int ForkJoinAsync(int depth) {
+    if (depth == 0) {
+        return 1;
+    }
+    auto left = std::async(std::launch::async, ForkJoinAsync, depth - 1);
+    auto right = std::async(std::launch::async, ForkJoinAsync, depth - 1);
+    return left.get() + right.get();
+}
+
+static void BenchmarkForkJoinAsync(benchmark::State& state) {
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(ForkJoinAsync(state.range(0)));
+    }
+    state.SetItemsProcessed(state.iterations() * ((2 << state.range(0)) - 1));
+}
+
+BENCHMARK(BenchmarkForkJoinAsync)->Arg(8)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+static int ForkJoinInline(int depth) {
+    benchmark::DoNotOptimize(depth);
+    if (depth == 0) {
+        return 1;
+    }
+    return ForkJoinInline(depth - 1) + ForkJoinInline(depth - 1);
+}
+
+static void BenchmarkForkJoinSingleThread(benchmark::State& state) {
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(ForkJoinInline(state.range(0)));
+    }
+    state.SetItemsProcessed(state.iterations() * ((2 << state.range(0)) - 1));
+}
+
+BENCHMARK(BenchmarkForkJoinSingleThread)->Arg(8)->Arg(14)->Unit(benchmark::kMillisecond);
+
+// Mostly empty tasks with a large one every kLargeTaskPeriod, reports start latency percentiles
+static void BenchmarkMixedTasks(benchmark::State& state) {
+    auto executor = MakeThreadPoolExecutor(state.range(0));
+    LatencyRecorder recorder;
+    for (auto _ : state) {
+        Latch latch(state.range(1));
+        recorder.StartIteration(state.range(1));
+        for (int i = 0; i < state.range(1); ++i) {
+            auto task = std::make_shared<TimedTask>(&recorder, &latch, i, MixedTaskWork(i));
+            task->MarkSubmitted();
+            executor->Submit(task);
+        }
+        latch.Wait();
+    }
+    recorder.Report(state);
+    state.SetItemsProcessed(state.iterations() * state.range(1));
+}
+
+BENCHMARK(BenchmarkMixedTasks)
+    ->Args({1, 10000})
+    ->Args({4, 10000})
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+static void BenchmarkMixedTasksAsync(benchmark::State& state) {
+    LatencyRecorder recorder;
+    for (auto _ : state) {
+        Latch latch(state.range(0));
+        recorder.StartIteration(state.range(0));
+        std::vector<std::future<void>> futures;
+        futures.reserve(state.range(0));
+        for (int i = 0; i < state.range(0); ++i) {
+            auto submitted = LatencyRecorder::Clock::now();
+            futures.push_back(std::async(std::launch::async, [&, i, submitted] {
+                recorder.Record(i, submitted);
+                SpinFor(MixedTaskWork(i));
+                latch.Signal();
+            }));
+        }
+        latch.Wait();
+    }
+    recorder.Report(state);
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+BENCHMARK(BenchmarkMixedTasksAsync)->Arg(10000)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+static void BenchmarkMixedTasksSingleThread(benchmark::State& state) {
+    LatencyRecorder recorder;
+    for (auto _ : state) {
+        recorder.StartIteration(state.range(0));
+        auto submitted = LatencyRecorder::Clock::now();
+        for (int i = 0; i < state.range(0); ++i) {
+            recorder.Record(i, submitted);
+            SpinFor(MixedTaskWork(i));
+        }
+    }
+    recorder.Report(state);
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+BENCHMARK(BenchmarkMixedTasksSingleThread)->Arg(10000)->Unit(benchmark::kMillisecond);
+
+// range(1) sleep-bound tasks of 2ms among 512 CPU-bound tasks of 20us on range(0) workers;
+// range(2) == 1 wraps the sleeps into BlockingScope
+static void BenchmarkBlockingMix(benchmark::State& state) {
+    auto executor = MakeThreadPoolExecutor(state.range(0));
+    const int sleepers = state.range(1);
+    const int cpu_tasks = 512;
+    const bool scoped = state.range(2);
+    const int total = sleepers + cpu_tasks;
+    for (auto _ : state) {
+        std::vector<FuturePtr<Unit>> all;
+        for (int i = 0; i < total; ++i) {
+            // Exactly sleepers of them, evenly spread
+            if ((i + 1) * sleepers / total != i * sleepers / total) {
+                all.push_back(executor->Invoke<Unit>([scoped] {
+                    std::optional<BlockingScope> scope;
+                    if (scoped) {
+                        scope.emplace();
+                    }
+                    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+                    return Unit{};
+                }));
+            } else {
+                all.push_back(executor->Invoke<Unit>([] {
+                    SpinFor(std::chrono::microseconds(20));
+                    return Unit{};
+                }));
+            }
+        }
+        for (auto& future : all) {
+            future->Get();
+        }
+    }
+}
+
+BENCHMARK(BenchmarkBlockingMix)
+    ->Args({4, 32, 0})
+    ->Args({4, 32, 1})
+    ->Args({4, 128, 0})
+    ->Args({4, 128, 1})
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+class CounterTask : public Task {
+public:
+    CounterTask(uint64_t* counter, std::mutex* lock, Latch* latch)
+        : counter_(counter), lock_(lock), latch_(latch) {
+    }
+
+    void Run() override {
+        std::optional<std::lock_guard<std::mutex>> guard;
+        if (lock_) {
+            guard.emplace(*lock_);
+        }
+        ++*counter_;
+        SpinFor(std::chrono::microseconds(1));
+        guard.reset();
+        latch_->Signal();
+    }
+
+private:
+    uint64_t* counter_;
+    std::mutex* lock_;
+    Latch* latch_;
+};
+
+// Keys drawn from Zipf(range(1) / 100) over 1M keys, sampled by binary search over the CDF
+static std::vector<uint32_t> MakeZipfKeys(size_t count, double s) {
+    const size_t universe = 1 << 20;
+    std::vector<double> cdf(universe);
+    double sum = 0;
+    for (size_t i = 0; i < universe; ++i) {
+        sum += 1.0 / std::pow(i + 1, s);
+        cdf[i] = sum;
+    }
+    std::mt19937 gen(42);
+    std::uniform_real_distribution<double> dist(0, sum);
+    std::vector<uint32_t> keys(count);
+    for (auto& key : keys) {
+        key = std::lower_bound(cdf.begin(), cdf.end(), dist(gen)) - cdf.begin();
+    }
+    return keys;
+}
+
+// Per-key counters updated by 64k tasks on range(0) workers; range(2) == 1 orders them with
+// KeyedExecutor, range(2) == 0 submits them directly and takes one of 4096 striped mutexes
+static void BenchmarkKeyedCounters(benchmark::State& state) {
+    auto executor = MakeThreadPoolExecutor(state.range(0));
+    const size_t count = 1 << 16;
+    const bool keyed_mode = state.range(2);
+    auto keys = MakeZipfKeys(count, state.range(1) / 100.0);
+    std::vector<uint64_t> counters(1 << 20);
+    std::vector<std::mutex> stripes(4096);
+    KeyedExecutor<uint32_t> keyed(executor);
+    for (auto _ : state) {
+        Latch latch(count);
+        for (auto key : keys) {
+            if (keyed_mode) {
+                keyed.Submit(key, std::make_shared<CounterTask>(&counters[key], nullptr, &latch));
+            } else {
+                executor->Submit(std::make_shared<CounterTask>(&counters[key],
+                                                               &stripes[key % stripes.size()],
+                                                               &latch));
+            }
+        }
+        latch.Wait();
+    }
+}
+
+BENCHMARK(BenchmarkKeyedCounters)
+    ->Args({1, 99, 0})
+    ->Args({1, 99, 1})
+    ->Args({4, 0, 0})
+    ->Args({4, 0, 1})
+    ->Args({4, 99, 0})
+    ->Args({4, 99, 1})
+    ->Args({4, 120, 0})
+    ->Args({4, 120, 1})
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+class SpinningSignaler : public Task {
+public:
+    SpinningSignaler(std::chrono::nanoseconds duration, Latch* latch)
+        : duration_(duration), latch_(latch) {
+    }
+
+    void Run() override {
+        SpinFor(duration_);
+        if (latch_) {
+            latch_->Signal();
+        }
+    }
+
+private:
+    std::chrono::nanoseconds duration_;
+    Latch* latch_;
+};
+
+// A noisy tenant floods 20k tasks of 10us, then a quiet tenant submits 64 tasks; measures how
+// long the quiet tenant waits for them. range(1) == 1 puts both into equal-weight groups of a
+// FairExecutor, range(1) == 0 submits both straight into the Executor.
+static void BenchmarkNoisyNeighbour(benchmark::State& state) {
+    auto executor = MakeThreadPoolExecutor(state.range(0));
+    const bool fair_mode = state.range(1);
+    FairExecutor fair(executor, state.range(0));
+    auto noisy = fair.AddGroup("noisy", 1);
+    auto quiet = fair.AddGroup("quiet", 1);
+    for (auto _ : state) {
+        state.PauseTiming();
+        Latch noisy_done(20000);
+        for (int i = 0; i < 20000; ++i) {
+            auto task = std::make_shared<SpinningSignaler>(std::chrono::microseconds(10),
+                                                           &noisy_done);
+            if (fair_mode) {
+                fair.Submit(noisy, std::move(task));
+            } else {
+                executor->Submit(std::move(task));
+            }
+        }
+        state.ResumeTiming();
+
+        Latch quiet_done(64);
+        for (int i = 0; i < 64; ++i) {
+            auto task = std::make_shared<SpinningSignaler>(std::chrono::microseconds(10),
+                                                           &quiet_done);
+            if (fair_mode) {
+                fair.Submit(quiet, std::move(task));
+            } else {
+                executor->Submit(std::move(task));
+            }
+        }
+        quiet_done.Wait();
+
+        state.PauseTiming();
+        noisy_done.Wait();
+        state.ResumeTiming();
+    }
+}
+
+BENCHMARK(BenchmarkNoisyNeighbour)
+    ->Args({4, 0})
+    ->Args({4, 1})
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+static size_t ResidentBytes() {
+    long pages = 0;
+    long resident = 0;
+    if (FILE* statm = fopen("/proc/self/statm", "r")) {
+        if (fscanf(statm, "%ld %ld", &pages, &resident) != 2) {
+            resident = 0;
+        }
+        fclose(statm);
+    }
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+class GatedTask : public Task {
+public:
+    GatedTask(Task* gate, std::atomic<int>* parked, Latch* done)
+        : gate_(gate), parked_(parked), done_(done) {
+    }
+
+    void Run() override {
+        ++*parked_;
+        gate_->Wait();
+        done_->Signal();
+    }
+
+private:
+    Task* gate_;
+    std::atomic<int>* parked_;
+    Latch* done_;
+};
+
+// range(0) tasks park in Wait on one gate on a fiber executor with 8 workers, then the gate
+// opens. range(1) == 1 puts a guard page under every stack: a guarded stack is two mappings,
+// so vm.max_map_count (65530 by default) caps those runs at ~32k fibers.
+static void BenchmarkBlockedFibers(benchmark::State& state) {
+    const int blocked = state.range(0);
+    FiberOptions options;
+    options.guard_page = state.range(1);
+    options.max_cached_stacks = blocked;
+    auto executor = MakeFiberExecutor(8, options);
+    size_t resident = 0;
+    for (auto _ : state) {
+        auto gate = std::make_shared<EmptyTask>();
+        std::atomic<int> parked{0};
+        Latch done(blocked);
+        auto before = ResidentBytes();
+        for (int i = 0; i < blocked; ++i) {
+            executor->Submit(std::make_shared<GatedTask>(gate.get(), &parked, &done));
+        }
+        while (parked.load() < blocked) {
+            std::this_thread::yield();
+        }
+        resident = std::max(resident, ResidentBytes() - std::min(before, ResidentBytes()));
+        gate->Invoke();
+        done.Wait();
+    }
+    state.counters["stacks"] = executor->FiberStacks();
+    state.counters["rss_per_task"] = 1.0 * resident / blocked;
+}
+
+BENCHMARK(BenchmarkBlockedFibers)
+    ->Args({10000, 1})
+    ->Args({10000, 0})
+    ->Args({100000, 0})
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+// Chain of range(0) tasks each Get-ing the previous one from inside a task, on a fiber
+// executor (range(1) == 1) or a thread pool big enough to block a thread per link
+static void BenchmarkGetInsideTasks(benchmark::State& state) {
+    const int links = state.range(0);
+    auto executor =
+        state.range(1) ? MakeFiberExecutor(4) : MakeThreadPoolExecutor(links + 1);
+    auto raw = executor.get();
+    for (auto _ : state) {
+        auto gate = std::make_shared<EmptyTask>();
+        FuturePtr<int> last = raw->Invoke<int>([gate] {
+            gate->Wait();
+            return 0;
+        });
+        for (int i = 1; i < links; ++i) {
+            last = raw->Invoke<int>([last] { return last->Get() + 1; });
+        }
+        gate->Invoke();
+        benchmark::DoNotOptimize(last->Get());
+    }
+}
+
+BENCHMARK(BenchmarkGetInsideTasks)
+    ->Args({64, 0})
+    ->Args({64, 1})
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+class MicroTask : public Task {
+public:
+    void Run() override {
+        SpinFor(std::chrono::nanoseconds(200));
+    }
+};
+
+// 100k tasks of 200ns on range(0) workers: one Submit per task when range(1) == 0,
+// AdaptiveSubmitter batches when range(1) == 1, ParallelFor over the range when range(1) == 2
+static void BenchmarkMicrotasks(benchmark::State& state) {
+    const int count = 100000;
+    auto executor = MakeThreadPoolExecutor(state.range(0));
+    const int mode = state.range(1);
+    AdaptiveSubmitter submitter(executor);
+    std::vector<std::shared_ptr<Task>> tasks(count);
+    for (auto _ : state) {
+        if (mode == 0) {
+            for (auto& task : tasks) {
+                task = std::make_shared<MicroTask>();
+                executor->Submit(task);
+            }
+            for (auto& task : tasks) {
+                task->Wait();
+            }
+        } else if (mode == 1) {
+            for (int i = 0; i < count; ++i) {
+                submitter.Submit([] { SpinFor(std::chrono::nanoseconds(200)); });
+            }
+            submitter.Wait();
+        } else {
+            ParallelFor(*executor, 0, count,
+                        [](size_t) { SpinFor(std::chrono::nanoseconds(200)); });
+        }
+    }
+    if (mode == 1) {
+        state.counters["grain"] = submitter.Tuner().Grain();
+    }
+}
+
+BENCHMARK(BenchmarkMicrotasks)
+    ->Args({1, 0})
+    ->Args({1, 1})
+    ->Args({1, 2})
+    ->Args({4, 0})
+    ->Args({4, 1})
+    ->Args({4, 2})
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+// BenchmarkRandomDag with a TraceRecorder installed when range(1) == 1
+static void BenchmarkRecordedDag(benchmark::State& state) {
+    auto executor = MakeThreadPoolExecutor(state.range(0));
+    auto edges = MakeRequestDagEdges(1000);
+    TraceRecorder recorder;
+    if (state.range(1)) {
+        recorder.Start();
+    }
+    for (auto _ : state) {
+        std::vector<std::shared_ptr<EmptyTask>> nodes(1000);
+        for (auto& node : nodes) {
+            node = std::make_shared<EmptyTask>();
+        }
+        for (auto [from, to] : edges) {
+            nodes[to]->AddDependency(nodes[from]);
+        }
+        for (auto& node : nodes) {
+            executor->Submit(node);
+        }
+        for (auto& node : nodes) {
+            node->Wait();
+        }
+        if (state.range(1)) {
+            state.PauseTiming();
+            recorder.Stop();
+            recorder.Start();
+            state.ResumeTiming();
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * 1000);
+}
+
+BENCHMARK(BenchmarkRecordedDag)
+    ->Args({4, 0})
+    ->Args({4, 1})
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+// Replays a synthetic trace of 100k requests, each a chain of four tasks of the mixed
+// workload submitted every 2us, on 8 virtual cores: FIFO, LIFO, work stealing and EDF
+// for range(0) == 0..3
+static void BenchmarkSimulator(benchmark::State& state) {
+    Trace trace;
+    for (uint32_t request = 0; request < 100000; ++request) {
+        for (uint32_t step = 0; step < 4; ++step) {
+            TraceTask task{.submit_ns = request * 2000ull,
+                           .duration_ns = uint64_t(MixedTaskWork(request + step).count() + 500)};
+            if (step) {
+                task.dependencies.push_back(trace.tasks.size() - 1);
+            }
+            trace.tasks.push_back(std::move(task));
+        }
+    }
+    std::unique_ptr<SimPolicy> policy;
+    switch (state.range(0)) {
+        case 0:
+            policy = MakeFifoPolicy();
+            break;
+        case 1:
+            policy = MakeLifoPolicy();
+            break;
+        case 2:
+            policy = MakeWorkStealingPolicy();
+            break;
+        default:
+            policy = MakeEdfPolicy();
+    }
+    SimResult result;
+    for (auto _ : state) {
+        result = Simulate(trace, *policy, 8);
+    }
+    state.SetItemsProcessed(state.iterations() * trace.tasks.size());
+    state.counters["makespan_ms"] = result.makespan_ns / 1e6;
+    state.counters["p50_us"] = result.p50_latency_ns / 1e3;
+    state.counters["p99_us"] = result.p99_latency_ns / 1e3;
+}
+
+BENCHMARK(BenchmarkSimulator)->DenseRange(0, 3)->Unit(benchmark::kMillisecond);
+
+// 100k empty tasks submitted and waited for, with a Watchdog polling every millisecond
+// when range(1) == 1
+static void BenchmarkWatchdogOverhead(benchmark::State& state) {
+    auto executor = MakeThreadPoolExecutor(state.range(0));
+    std::optional<Watchdog> watchdog;
+    if (state.range(1)) {
+        WatchdogOptions options;
+        options.poll_interval = std::chrono::milliseconds(1);
+        watchdog.emplace(*executor, [](const StallReport&) {}, options);
+    }
+    std::vector<std::shared_ptr<Task>> tasks(100000);
+    for (auto _ : state) {
+        for (auto& task : tasks) {
+            task = std::make_shared<EmptyTask>();
+            executor->Submit(task);
+        }
+        for (auto& task : tasks) {
+            task->Wait();
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * tasks.size());
+}
+
+BENCHMARK(BenchmarkWatchdogOverhead)
+    ->Args({1, 0})
+    ->Args({1, 1})
+    ->Args({4, 0})
+    ->Args({4, 1})
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
 BENCHMARK_MAIN();
@@ -0,0 +1,263 @@
+#include "simulator.h"
+
+#include <algorithm>
+#include <deque>
+#include <queue>
+#include <random>
+#include <stdexcept>
+
+namespace {
+
+class FifoPolicy : public SimPolicy {
+public:
+    void Push(uint32_t task, int) override {
+        queue_.push_back(task);
+    }
+
+    std::optional<uint32_t> Pop(int) override {
+        if (queue_.empty()) {
+            return std::nullopt;
+        }
+        auto task = queue_.front();
+        queue_.pop_front();
+        return task;
+    }
+
+private:
+    std::deque<uint32_t> queue_;
+};
+
+class LifoPolicy : public SimPolicy {
+public:
+    void Push(uint32_t task, int) override {
+        stack_.push_back(task);
+    }
+
+    std::optional<uint32_t> Pop(int) override {
+        if (stack_.empty()) {
+            return std::nullopt;
+        }
+        auto task = stack_.back();
+        stack_.pop_back();
+        return task;
+    }
+
+private:
+    std::vector<uint32_t> stack_;
+};
+
+class WorkStealingPolicy : public SimPolicy {
+public:
+    explicit WorkStealingPolicy(uint64_t seed) : seed_(seed) {
+    }
+
+    void Start(const Trace&, int cores) override {
+        injected_.clear();
+        local_.assign(cores, {});
+        random_.seed(seed_);
+    }
+
+    void Push(uint32_t task, int core) override {
+        if (core < 0) {
+            injected_.push_back(task);
+        } else {
+            local_[core].push_back(task);
+        }
+    }
+
+    std::optional<uint32_t> Pop(int core) override {
+        auto& own = local_[core];
+        if (!own.empty()) {
+            auto task = own.back();
+            own.pop_back();
+            return task;
+        }
+        if (!injected_.empty()) {
+            auto task = injected_.front();
+            injected_.pop_front();
+            return task;
+        }
+        auto cores = local_.size();
+        auto first = random_() % cores;
+        for (size_t i = 0; i < cores; ++i) {
+            auto& victim = local_[(first + i) % cores];
+            if (!victim.empty()) {
+                auto task = victim.front();
+                victim.pop_front();
+                return task;
+            }
+        }
+        return std::nullopt;
+    }
+
+private:
+    uint64_t seed_;
+    std::mt19937_64 random_;
+    std::deque<uint32_t> injected_;
+    std::vector<std::deque<uint32_t>> local_;
+};
+
+class EdfPolicy : public SimPolicy {
+public:
+    explicit EdfPolicy(std::function<uint64_t(const TraceTask&)> deadline)
+        : deadline_(std::move(deadline)) {
+    }
+
+    void Start(const Trace& trace, int) override {
+        deadlines_.clear();
+        deadlines_.reserve(trace.tasks.size());
+        for (const auto& task : trace.tasks) {
+            deadlines_.push_back(deadline_ ? deadline_(task) : task.submit_ns);
+        }
+        queue_ = {};
+    }
+
+    void Push(uint32_t task, int) override {
+        queue_.emplace(deadlines_[task], task);
+    }
+
+    std::optional<uint32_t> Pop(int) override {
+        if (queue_.empty()) {
+            return std::nullopt;
+        }
+        auto task = queue_.top().second;
+        queue_.pop();
+        return task;
+    }
+
+private:
+    std::function<uint64_t(const TraceTask&)> deadline_;
+    std::vector<uint64_t> deadlines_;
+    // Ties go to the lower index, that is to the earlier submission
+    std::priority_queue<std::pair<uint64_t, uint32_t>, std::vector<std::pair<uint64_t, uint32_t>>,
+                        std::greater<>>
+        queue_;
+};
+
+}  // namespace
+
+std::unique_ptr<SimPolicy> MakeFifoPolicy() {
+    return std::make_unique<FifoPolicy>();
+}
+
+std::unique_ptr<SimPolicy> MakeLifoPolicy() {
+    return std::make_unique<LifoPolicy>();
+}
+
+std::unique_ptr<SimPolicy> MakeWorkStealingPolicy(uint64_t seed) {
+    return std::make_unique<WorkStealingPolicy>(seed);
+}
+
+std::unique_ptr<SimPolicy> MakeEdfPolicy(std::function<uint64_t(const TraceTask&)> deadline) {
+    return std::make_unique<EdfPolicy>(std::move(deadline));
+}
+
+SimResult Simulate(const Trace& trace, SimPolicy& policy, int cores) {
+    if (cores <= 0) {
+        throw std::invalid_argument("Simulation needs at least one core");
+    }
+    const auto& tasks = trace.tasks;
+    auto size = tasks.size();
+    SimResult result;
+    if (!size) {
+        return result;
+    }
+
+    // Successors of task i are successors[first_successor[i]..[i + 1]). A task waits for its
+    // dependencies and for its own submission.
+    std::vector<uint32_t> first_successor(size + 1, 0);
+    std::vector<uint32_t> pending(size);
+    for (size_t i = 0; i < size; ++i) {
+        pending[i] = tasks[i].dependencies.size() + 1;
+        for (auto dep : tasks[i].dependencies) {
+            if (dep >= size) {
+                throw std::runtime_error("Trace has a dependency out of range");
+            }
+            ++first_successor[dep + 1];
+        }
+    }
+    for (size_t i = 0; i < size; ++i) {
+        first_successor[i + 1] += first_successor[i];
+    }
+    std::vector<uint32_t> successors(first_successor.back());
+    std::vector<uint32_t> next_slot(first_successor.begin(), first_successor.end() - 1);
+    for (uint32_t i = 0; i < size; ++i) {
+        for (auto dep : tasks[i].dependencies) {
+            successors[next_slot[dep]++] = i;
+        }
+    }
+
+    std::vector<uint32_t> arrivals(size);
+    for (uint32_t i = 0; i < size; ++i) {
+        arrivals[i] = i;
+    }
+    std::stable_sort(arrivals.begin(), arrivals.end(), [&tasks](uint32_t lhs, uint32_t rhs) {
+        return tasks[lhs].submit_ns < tasks[rhs].submit_ns;
+    });
+
+    policy.Start(trace, cores);
+    auto release = [&](uint32_t task, int core) {
+        if (--pending[task] == 0) {
+            policy.Push(task, core);
+        }
+    };
+
+    // Finish time and core of running tasks, ties are resolved by core index
+    std::priority_queue<std::pair<uint64_t, int>, std::vector<std::pair<uint64_t, int>>,
+                        std::greater<>>
+        running;
+    std::vector<std::optional<uint32_t>> on_core(cores);
+    std::vector<uint64_t> latencies;
+    latencies.reserve(size);
+    size_t next_arrival = 0;
+    while (latencies.size() < size) {
+        auto now = UINT64_MAX;
+        if (next_arrival < size) {
+            now = tasks[arrivals[next_arrival]].submit_ns;
+        }
+        if (!running.empty()) {
+            now = std::min(now, running.top().first);
+        }
+        if (now == UINT64_MAX) {
+            throw std::runtime_error("Trace has tasks that never become ready");
+        }
+
+        while (!running.empty() && running.top().first == now) {
+            auto core = running.top().second;
+            running.pop();
+            auto task = *std::exchange(on_core[core], std::nullopt);
+            latencies.push_back(now - tasks[task].submit_ns);
+            for (auto i = first_successor[task]; i < first_successor[task + 1]; ++i) {
+                release(successors[i], core);
+            }
+        }
+        while (next_arrival < size && tasks[arrivals[next_arrival]].submit_ns == now) {
+            release(arrivals[next_arrival++], -1);
+        }
+        for (int core = 0; core < cores; ++core) {
+            if (on_core[core]) {
+                continue;
+            }
+            if (auto task = policy.Pop(core)) {
+                on_core[core] = task;
+                running.emplace(now + tasks[*task].duration_ns, core);
+                result.busy_ns += tasks[*task].duration_ns;
+            }
+        }
+        result.makespan_ns = now - tasks[arrivals[0]].submit_ns;
+    }
+
+    result.utilization = result.makespan_ns
+                             ? double(result.busy_ns) / (double(result.makespan_ns) * cores)
+                             : 1.0;
+    std::sort(latencies.begin(), latencies.end());
+    double sum = 0;
+    for (auto latency : latencies) {
+        sum += latency;
+    }
+    result.mean_latency_ns = sum / size;
+    result.p50_latency_ns = latencies[(size - 1) / 2];
+    result.p99_latency_ns = latencies[(size - 1) * 99 / 100];
+    result.max_latency_ns = latencies.back();
+    return result;
+}
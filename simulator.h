@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+
+#include "trace.h"
+
+// Scheduling policy of the simulator: decides which ready task an idle virtual core runs.
+// Calls are made in a deterministic order, so a deterministic policy gives the same result
+// for the same trace every time.
+class SimPolicy {
+public:
+    virtual ~SimPolicy() = default;
+
+    // Called once before a simulation
+    virtual void Start(const Trace& trace, int cores) {
+        (void)trace;
+        (void)cores;
+    }
+
+    // task became ready. core is the core whose task finishing made it ready,
+    // -1 for a task that became ready on submission
+    virtual void Push(uint32_t task, int core) = 0;
+
+    // Next task for the idle core, nullopt leaves it idle until something changes
+    virtual std::optional<uint32_t> Pop(int core) = 0;
+};
+
+// One shared queue in order of readiness, like the injection queue of Executor
+std::unique_ptr<SimPolicy> MakeFifoPolicy();
+
+// One shared stack, the newest ready task first
+std::unique_ptr<SimPolicy> MakeLifoPolicy();
+
+// A deque per core: a core pushes tasks it made ready and pops them newest first,
+// submitted tasks go to a shared queue, an idle core takes from the shared queue first
+// and then steals the oldest task of a victim picked with a seeded generator
+std::unique_ptr<SimPolicy> MakeWorkStealingPolicy(uint64_t seed = 1);
+
+// Earliest deadline first. The deadline of a task is its submit time unless deadline
+// is given, so tasks of older submissions go first whatever the order they became ready.
+std::unique_ptr<SimPolicy> MakeEdfPolicy(
+    std::function<uint64_t(const TraceTask& task)> deadline = {});
+
+struct SimResult {
+    // From the first submission to the last finish
+    uint64_t makespan_ns{0};
+    // Sum of run times over all cores
+    uint64_t busy_ns{0};
+    double utilization{0};
+    // Latency of a task is the time from its submission to its finish
+    double mean_latency_ns{0};
+    uint64_t p50_latency_ns{0};
+    uint64_t p99_latency_ns{0};
+    uint64_t max_latency_ns{0};
+};
+
+// Replays the trace on cores virtual cores in virtual time: tasks arrive at their recorded
+// submit times, become ready when their dependencies have finished and run for their
+// recorded durations, scheduling itself costs nothing. Submissions made from inside tasks
+// replay at their recorded times as well. Throws std::runtime_error if some tasks never
+// become ready, which takes a dependency cycle.
+SimResult Simulate(const Trace& trace, SimPolicy& policy, int cores);
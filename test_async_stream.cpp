@@ -0,0 +1,130 @@
+#include <gtest/gtest.h>
+
+#include <thread>
+#include <chrono>
+#include <atomic>
+
+#include <async_stream.h>
+
+struct AsyncStreamTest : public ::testing::Test {
+    std::shared_ptr<Executor> pool;
+
+    AsyncStreamTest() {
+        pool = MakeThreadPoolExecutor(2);
+    }
+};
+
+static std::function<std::optional<int>()> Range(int n, std::atomic<int>* produced = nullptr) {
+    return [i = 0, n, produced]() mutable -> std::optional<int> {
+        if (i == n) {
+            return std::nullopt;
+        }
+        if (produced) {
+            ++*produced;
+        }
+        return i++;
+    };
+}
+
+TEST_F(AsyncStreamTest, ProducesAllItems) {
+    auto stream = MakeAsyncStream<int>(pool, Range(1000), 16);
+
+    for (int i = 0; i < 1000; ++i) {
+        ASSERT_EQ(stream.Next(), i);
+    }
+    ASSERT_EQ(stream.Next(), std::nullopt);
+    ASSERT_EQ(stream.Next(), std::nullopt);
+}
+
+TEST_F(AsyncStreamTest, ProducerStopsAtCapacity) {
+    std::atomic<int> produced{0};
+    auto stream = MakeAsyncStream<int>(pool, Range(1000, &produced), 10);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    EXPECT_EQ(produced.load(), 10);
+
+    for (int i = 0; i < 5; ++i) {
+        stream.Next();
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    EXPECT_EQ(produced.load(), 15);
+}
+
+TEST_F(AsyncStreamTest, SuspendedProducerDoesNotHoldWorker) {
+    auto single = MakeThreadPoolExecutor(1);
+    auto stream = MakeAsyncStream<int>(single, Range(1000), 4);
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+    auto future = single->Invoke<int>([] { return 42; });
+    ASSERT_EQ(future->Get(), 42);
+    ASSERT_EQ(stream.Next(), 0);
+}
+
+TEST_F(AsyncStreamTest, MapFilterBatch) {
+    auto stream = MakeAsyncStream<int>(pool, Range(100), 8)
+                      .Map([](int x) { return x * 3; })
+                      .Filter([](const int& x) { return x % 2 == 0; })
+                      .Batch(16);
+
+    std::vector<int> all;
+    std::vector<size_t> sizes;
+    while (auto batch = stream.Next()) {
+        sizes.push_back(batch->size());
+        all.insert(all.end(), batch->begin(), batch->end());
+    }
+
+    ASSERT_EQ(sizes, (std::vector<size_t>{16, 16, 16, 2}));
+    for (size_t i = 0; i < all.size(); ++i) {
+        ASSERT_EQ(all[i], static_cast<int>(i) * 6);
+    }
+}
+
+TEST_F(AsyncStreamTest, MapChangesType) {
+    auto stream = MakeAsyncStream<int>(pool, Range(3), 2).Map([](int x) {
+        return std::string(x + 1, 'a');
+    });
+
+    ASSERT_EQ(stream.Next(), "a");
+    ASSERT_EQ(stream.Next(), "aa");
+    ASSERT_EQ(stream.Next(), "aaa");
+    ASSERT_EQ(stream.Next(), std::nullopt);
+}
+
+TEST_F(AsyncStreamTest, ExceptionPropagates) {
+    auto stream = MakeAsyncStream<int>(pool, Range(10), 4).Map([](int x) {
+        if (x == 5) {
+            throw std::logic_error("Test");
+        }
+        return x;
+    });
+
+    for (int i = 0; i < 5; ++i) {
+        ASSERT_EQ(stream.Next(), i);
+    }
+    ASSERT_THROW(stream.Next(), std::logic_error);
+}
+
+TEST_F(AsyncStreamTest, EmptyBatchIsRejected) {
+    auto stream = MakeAsyncStream<int>(pool, Range(10), 4);
+    ASSERT_THROW(stream.Batch(0), std::invalid_argument);
+}
+
+TEST_F(AsyncStreamTest, ShutdownEndsStream) {
+    auto single = MakeThreadPoolExecutor(1);
+    auto stream = MakeAsyncStream<int>(single, Range(1000), 4);
+    ASSERT_EQ(stream.Next(), 0);
+    single->StartShutdown();
+    single->WaitShutdown();
+
+    // Draining the buffer resumes the producer on the closed executor
+    int items = 1;
+    try {
+        while (stream.Next()) {
+            ++items;
+        }
+        FAIL() << "Stream ended without an error";
+    } catch (const std::runtime_error&) {
+    }
+    // The first item and at most a full buffer
+    ASSERT_LE(items, 5);
+}
@@ -3,6 +3,8 @@
 #include <thread>
 #include <chrono>
 #include <atomic>
+#include <future>
+#include <random>
 
 #include <executors.h>
 
@@ -95,6 +97,28 @@ TEST_P(ExecutorsTest, CancelSingleTask) {
     EXPECT_FALSE(task->IsFailed());
 }
 
+TEST_P(ExecutorsTest, CancelRunningTaskWaitsForRun) {
+    std::promise<void> start;
+    std::atomic<bool> ran{false};
+    auto future = pool->Invoke<Unit>([&] {
+        start.set_value();
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        ran = true;
+        return Unit{};
+    });
+    start.get_future().wait();
+
+    future->Cancel();
+    EXPECT_TRUE(future->IsCanceled());
+    EXPECT_FALSE(future->IsFinished());
+    future->Wait();
+
+    EXPECT_TRUE(ran.load());
+    EXPECT_TRUE(future->IsCanceled());
+    EXPECT_FALSE(future->IsCompleted());
+    EXPECT_THROW(future->Get(), std::runtime_error);
+}
+
 TEST_P(ExecutorsTest, TaskWithSingleDependency) {
     auto task = std::make_shared<TestTask>();
     auto dependency = std::make_shared<TestTask>();
@@ -354,6 +378,51 @@ TEST_P(ExecutorsTest, CancelAfterDetroyOfExecutor) {
     second->Cancel();
 }
 
+TEST_P(ExecutorsTest, SubmitRacesShutdown) {
+    // A task is run, canceled in the queue or rejected by Submit, but always finished.
+    // Every second one depends on the one before, so it is scheduled by a worker.
+    const int submitters = 4;
+    for (int round = 0; round < 10; ++round) {
+        auto executor = GetParam()();
+        std::vector<std::vector<std::shared_ptr<TestTask>>> tasks(submitters);
+        std::atomic<int> started{0};
+        std::atomic<bool> stop{false};
+        std::vector<std::thread> threads;
+        for (int i = 0; i < submitters; ++i) {
+            threads.emplace_back([&, i] {
+                ++started;
+                while (!stop.load()) {
+                    auto first = std::make_shared<TestTask>();
+                    auto second = std::make_shared<TestTask>();
+                    second->AddDependency(first);
+                    tasks[i].push_back(first);
+                    tasks[i].push_back(second);
+                    executor->Submit(first);
+                    executor->Submit(second);
+                }
+            });
+        }
+        while (started.load() < submitters) {
+            std::this_thread::yield();
+        }
+        std::this_thread::sleep_for(std::chrono::microseconds(500));
+        executor->StartShutdown();
+        executor->WaitShutdown();
+        stop = true;
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        executor.reset();
+
+        for (const auto& submitted : tasks) {
+            for (const auto& task : submitted) {
+                ASSERT_TRUE(task->IsFinished());
+                ASSERT_EQ(task->completed, task->IsCompleted());
+            }
+        }
+    }
+}
+
 struct RecursiveGrowingTask : public Task {
     RecursiveGrowingTask(int n, int fanout, std::shared_ptr<Executor> executor)
         : n_(n), fanout_(fanout), executor_(executor) {
@@ -384,7 +453,293 @@ TEST_P(ExecutorsTest, NoDeadlockWhenSubmittingFromTaskBody) {
     pool->WaitShutdown();
 }
 
+TEST_P(ExecutorsTest, PeriodicTask) {
+    std::atomic<int> runs{0};
+    auto task = pool->SchedulePeriodic([&] { ++runs; }, std::chrono::milliseconds(10));
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(105));
+    task->Cancel();
+    task->Wait();
+    int runs_at_cancel = runs.load();
+    std::this_thread::sleep_for(std::chrono::milliseconds(30));
+
+    EXPECT_GE(runs_at_cancel, 5);
+    EXPECT_LE(runs_at_cancel, 10);
+    EXPECT_LE(runs.load(), runs_at_cancel + 1);
+    EXPECT_TRUE(task->IsCanceled());
+}
+
+TEST_P(ExecutorsTest, PeriodicTaskOverrunDoesNotPileUp) {
+    std::atomic<int> running{0};
+    std::atomic<bool> overlapped{false};
+    for (auto policy : {PeriodicPolicy::kFixedRate, PeriodicPolicy::kFixedDelay}) {
+        auto task = pool->SchedulePeriodic(
+            [&] {
+                if (++running > 1) {
+                    overlapped = true;
+                }
+                std::this_thread::sleep_for(std::chrono::milliseconds(20));
+                --running;
+            },
+            std::chrono::milliseconds(5), policy);
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        task->Cancel();
+        // Cancel does not interrupt a run that has already started
+        while (running.load()) {
+            std::this_thread::yield();
+        }
+
+        EXPECT_FALSE(overlapped.load());
+        EXPECT_LE(task->RunCount(), 5u);
+    }
+}
+
+TEST_P(ExecutorsTest, FailingPeriodicTaskStops) {
+    std::atomic<int> runs{0};
+    auto task = pool->SchedulePeriodic(
+        [&] {
+            ++runs;
+            throw std::logic_error("Failed");
+        },
+        std::chrono::milliseconds(1));
+
+    task->Wait();
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+    EXPECT_TRUE(task->IsFailed());
+    EXPECT_EQ(runs.load(), 1);
+}
+
+TEST_P(ExecutorsTest, PeriodicTaskNeedsPositivePeriod) {
+    for (auto policy : {PeriodicPolicy::kFixedRate, PeriodicPolicy::kFixedDelay}) {
+        EXPECT_THROW(pool->SchedulePeriodic([] {}, std::chrono::milliseconds(0), policy),
+                     std::invalid_argument);
+        EXPECT_THROW(pool->SchedulePeriodic([] {}, std::chrono::milliseconds(-5), policy),
+                     std::invalid_argument);
+    }
+}
+
+TEST_P(ExecutorsTest, ShutdownCancelsTimers) {
+    auto timed = std::make_shared<TestTask>();
+    timed->SetTimeTrigger(std::chrono::system_clock::now() + std::chrono::hours(1));
+    pool->Submit(timed);
+    auto periodic = pool->SchedulePeriodic([] {}, std::chrono::hours(1));
+
+    std::thread waiter([&] {
+        timed->Wait();
+        periodic->Wait();
+    });
+    pool->StartShutdown();
+    waiter.join();
+
+    EXPECT_TRUE(timed->IsCanceled());
+    EXPECT_TRUE(periodic->IsCanceled());
+
+    auto late = std::make_shared<TestTask>();
+    late->SetTimeTrigger(std::chrono::system_clock::now() + std::chrono::hours(1));
+    pool->Submit(late);
+    EXPECT_TRUE(late->IsCanceled());
+}
+
+TEST_P(ExecutorsTest, TaskGraphRespectsEdges) {
+    const int n = 40;
+    TaskGraph graph;
+    std::atomic<int> clock{0};
+    std::vector<std::atomic<int>> finished_at(n);
+    for (int i = 0; i < n; ++i) {
+        graph.AddNode([&, i] { finished_at[i] = ++clock; });
+    }
+    std::vector<std::pair<int, int>> edges;
+    std::mt19937 random(7);
+    for (int i = 1; i < n; ++i) {
+        edges.emplace_back(i / 2, i);
+        edges.emplace_back(std::uniform_int_distribution<int>(0, i - 1)(random), i);
+    }
+    for (auto [from, to] : edges) {
+        graph.AddEdge(from, to);
+    }
+
+    for (int run = 0; run < 20; ++run) {
+        clock = 0;
+        pool->Run(graph);
+
+        EXPECT_EQ(clock.load(), n);
+        for (auto [from, to] : edges) {
+            EXPECT_LT(finished_at[from].load(), finished_at[to].load());
+        }
+    }
+}
+
+TEST_P(ExecutorsTest, TaskGraphFailureSkipsRest) {
+    TaskGraph graph;
+    std::atomic<int> runs{0};
+    auto a = graph.AddNode([&] { ++runs; });
+    auto b = graph.AddNode([&] {
+        ++runs;
+        throw std::logic_error("Failed");
+    });
+    auto c = graph.AddNode([&] { ++runs; });
+    graph.AddEdge(a, b);
+    graph.AddEdge(b, c);
+
+    EXPECT_THROW(pool->Run(graph), std::logic_error);
+    EXPECT_EQ(runs.load(), 2);
+    EXPECT_THROW(pool->Run(graph), std::logic_error);
+    EXPECT_EQ(runs.load(), 4);
+}
+
+TEST_P(ExecutorsTest, TaskGraphEndsOnShutdown) {
+    const int n = 200;
+    TaskGraph graph;
+    std::atomic<int> runs{0};
+    for (int i = 0; i < n; ++i) {
+        graph.AddNode([&] {
+            ++runs;
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        });
+        if (i > 0) {
+            graph.AddEdge(i - 1, i);
+        }
+    }
+
+    std::thread shutdown([&] {
+        while (runs.load() < 10) {
+            std::this_thread::yield();
+        }
+        pool->StartShutdown();
+    });
+    EXPECT_THROW(pool->Run(graph), std::runtime_error);
+    shutdown.join();
+    EXPECT_LT(runs.load(), n);
+}
+
+TEST_P(ExecutorsTest, BlockingScopeKeepsWorkersRunning) {
+    // More blocked tasks than workers in any of the pools
+    const int blocked = 12;
+    std::promise<void> release;
+    auto released = release.get_future().share();
+    std::atomic<int> entered{0};
+    std::vector<FuturePtr<Unit>> waiting;
+    for (int i = 0; i < blocked; ++i) {
+        waiting.push_back(pool->SpawnBlocking<Unit>([&, released] {
+            ++entered;
+            released.wait();
+            return Unit{};
+        }));
+    }
+    while (entered.load() < blocked) {
+        std::this_thread::yield();
+    }
+
+    auto task = std::make_shared<TestTask>();
+    pool->Submit(task);
+    task->Wait();
+    EXPECT_TRUE(task->completed);
+
+    release.set_value();
+    for (auto& future : waiting) {
+        future->Get();
+    }
+}
+
+TEST_P(ExecutorsTest, CompensatingWorkersRetire) {
+    for (int i = 0; i < 100; ++i) {
+        EXPECT_EQ(pool->SpawnBlocking<int>([i] {
+                          std::this_thread::sleep_for(std::chrono::microseconds(50));
+                          return i;
+                      })->Get(),
+                  i);
+    }
+}
+
+TEST(BlockingScope, IdleCompensatingWorkerRetires) {
+    const int workers = 2;
+    auto pool = MakeThreadPoolExecutor(workers);
+    pool->SpawnBlocking<Unit>([] {
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            return Unit{};
+        })->Get();
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (pool->IdleWorkers() < workers && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::yield();
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    EXPECT_EQ(pool->IdleWorkers(), workers);
+}
+
+TEST(BlockingScope, NoOpOutsideOfExecutor) {
+    BlockingScope scope;
+    BlockingScope nested;
+}
+
+TEST(TaskGraph, RejectsCycles) {
+    TaskGraph graph;
+    auto a = graph.AddNode([] {});
+    auto b = graph.AddNode([] {});
+    graph.AddEdge(a, b);
+    graph.AddEdge(b, a);
+
+    EXPECT_THROW(graph.Freeze(), std::logic_error);
+}
+
+TEST(TaskGraph, FrozenAfterFirstRun) {
+    auto pool = MakeThreadPoolExecutor(2);
+    TaskGraph graph;
+    std::atomic<int> runs{0};
+    graph.AddNode([&] { ++runs; });
+    pool->Run(graph);
+    pool->Run(graph);
+
+    EXPECT_EQ(runs.load(), 2);
+    EXPECT_THROW(graph.AddNode([] {}), std::logic_error);
+}
+
 INSTANTIATE_TEST_CASE_P(ThreadPool, ExecutorsTest,
                         ::testing::Values([] { return MakeThreadPoolExecutor(1); },
                                           [] { return MakeThreadPoolExecutor(2); },
                                           [] { return MakeThreadPoolExecutor(10); }));
+
+INSTANTIATE_TEST_CASE_P(FiberPool, ExecutorsTest,
+                        ::testing::Values([] { return MakeFiberExecutor(1); },
+                                          [] { return MakeFiberExecutor(4); }));
+
+TEST(InjectionQueue, ManyProducersManyConsumers) {
+    const int producers = 4;
+    const int consumers = 4;
+    const int values_per_producer = 100000;
+
+    InjectionQueue<int> queue;
+    std::atomic<int64_t> sum{0};
+    std::atomic<int> taken{0};
+    std::vector<std::thread> threads;
+    for (int i = 0; i < consumers; ++i) {
+        threads.emplace_back([&] {
+            while (auto value = queue.Take()) {
+                sum += *value;
+                ++taken;
+            }
+        });
+    }
+    for (int i = 0; i < producers; ++i) {
+        threads.emplace_back([&] {
+            for (int j = 1; j <= values_per_producer; ++j) {
+                ASSERT_TRUE(queue.Put(j));
+            }
+        });
+    }
+    for (int i = consumers; i < consumers + producers; ++i) {
+        threads[i].join();
+    }
+    while (taken.load() != producers * values_per_producer) {
+        std::this_thread::yield();
+    }
+    queue.Close();
+    for (int i = 0; i < consumers; ++i) {
+        threads[i].join();
+    }
+
+    EXPECT_EQ(sum.load(), int64_t{producers} * values_per_producer * (values_per_producer + 1) / 2);
+    EXPECT_FALSE(queue.Put(0));
+}
@@ -0,0 +1,155 @@
+#include <gtest/gtest.h>
+
+#include <thread>
+#include <chrono>
+#include <atomic>
+
+#include <fair_executor.h>
+
+struct FairExecutorTest : public ::testing::Test {
+    std::shared_ptr<Executor> pool;
+
+    FairExecutorTest() {
+        pool = MakeThreadPoolExecutor(4);
+    }
+};
+
+static void Spin(std::chrono::microseconds duration) {
+    auto end = std::chrono::steady_clock::now() + duration;
+    while (std::chrono::steady_clock::now() < end) {
+    }
+}
+
+class SpinTask : public Task {
+public:
+    explicit SpinTask(std::chrono::microseconds duration, std::atomic<int>* running = nullptr,
+                      std::atomic<int>* max_running = nullptr)
+        : duration_(duration), running_(running), max_running_(max_running) {
+    }
+
+    void Run() override {
+        if (running_) {
+            int now = ++*running_;
+            int seen = max_running_->load();
+            while (seen < now && !max_running_->compare_exchange_weak(seen, now)) {
+            }
+        }
+        Spin(duration_);
+        if (running_) {
+            --*running_;
+        }
+    }
+
+private:
+    std::chrono::microseconds duration_;
+    std::atomic<int>* running_;
+    std::atomic<int>* max_running_;
+};
+
+TEST_F(FairExecutorTest, WeightsSplitRunTime) {
+    FairExecutor fair(pool, 1);
+    auto heavy = fair.AddGroup("heavy", 3);
+    auto light = fair.AddGroup("light", 1);
+    std::vector<std::shared_ptr<Task>> tasks;
+    for (int i = 0; i < 2000; ++i) {
+        for (auto group : {heavy, light}) {
+            tasks.push_back(std::make_shared<SpinTask>(std::chrono::microseconds(50)));
+            fair.Submit(group, tasks.back());
+        }
+    }
+    while (fair.Stats(heavy).completed + fair.Stats(light).completed < 800) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    auto heavy_stats = fair.Stats(heavy);
+    auto light_stats = fair.Stats(light);
+    EXPECT_EQ(heavy_stats.name, "heavy");
+    EXPECT_GT(heavy_stats.queued, 0u);
+    EXPECT_GT(light_stats.queued, 0u);
+    double ratio = 1.0 * heavy_stats.run_time.count() / light_stats.run_time.count();
+    EXPECT_GT(ratio, 2.0);
+    EXPECT_LT(ratio, 4.5);
+}
+
+TEST_F(FairExecutorTest, FloodDoesNotStarveOthers) {
+    FairExecutor fair(pool, 2);
+    auto noisy = fair.AddGroup("noisy", 1);
+    auto quiet = fair.AddGroup("quiet", 1);
+    for (int i = 0; i < 5000; ++i) {
+        fair.Submit(noisy, std::make_shared<SpinTask>(std::chrono::microseconds(20)));
+    }
+    std::vector<std::shared_ptr<Task>> quiet_tasks;
+    for (int i = 0; i < 20; ++i) {
+        quiet_tasks.push_back(std::make_shared<SpinTask>(std::chrono::microseconds(20)));
+        fair.Submit(quiet, quiet_tasks.back());
+    }
+    for (auto& task : quiet_tasks) {
+        task->Wait();
+        EXPECT_TRUE(task->IsCompleted());
+    }
+    EXPECT_LT(fair.Stats(noisy).completed, 2500u);
+    EXPECT_GT(fair.Stats(quiet).queue_time.count(), 0);
+}
+
+TEST_F(FairExecutorTest, MaxRunningCap) {
+    FairExecutor fair(pool, 4);
+    auto capped = fair.AddGroup("capped", 1, 1);
+    auto other = fair.AddGroup("other", 1);
+    std::atomic<int> running{0};
+    std::atomic<int> max_running{0};
+    std::vector<std::shared_ptr<Task>> tasks;
+    for (int i = 0; i < 200; ++i) {
+        tasks.push_back(
+            std::make_shared<SpinTask>(std::chrono::microseconds(50), &running, &max_running));
+        fair.Submit(capped, tasks.back());
+        tasks.push_back(std::make_shared<SpinTask>(std::chrono::microseconds(50)));
+        fair.Submit(other, tasks.back());
+    }
+    for (auto& task : tasks) {
+        task->Wait();
+        EXPECT_TRUE(task->IsCompleted());
+    }
+    EXPECT_EQ(max_running.load(), 1);
+    // Stats are updated once the runner is back from the task
+    while (fair.Stats(capped).completed < 200) {
+        std::this_thread::yield();
+    }
+    EXPECT_EQ(fair.Stats(capped).running, 0u);
+}
+
+TEST_F(FairExecutorTest, FailingTask) {
+    FairExecutor fair(pool, 2);
+    auto group = fair.AddGroup("group", 1);
+    class FailingTask : public Task {
+    public:
+        void Run() override {
+            throw std::logic_error("Failed");
+        }
+    };
+    auto failing = std::make_shared<FailingTask>();
+    fair.Submit(group, failing);
+    failing->Wait();
+    EXPECT_TRUE(failing->IsFailed());
+
+    EXPECT_THROW(fair.AddGroup("zero", 0), std::invalid_argument);
+    EXPECT_THROW(fair.Submit(42, failing), std::out_of_range);
+}
+
+TEST_F(FairExecutorTest, ShutdownCancelsQueued) {
+    FairExecutor fair(pool, 1);
+    auto group = fair.AddGroup("group", 1);
+    std::vector<std::shared_ptr<Task>> tasks;
+    for (int i = 0; i < 1000; ++i) {
+        tasks.push_back(std::make_shared<SpinTask>(std::chrono::microseconds(100)));
+        fair.Submit(group, tasks.back());
+    }
+    pool->StartShutdown();
+    pool->WaitShutdown();
+
+    auto late = std::make_shared<SpinTask>(std::chrono::microseconds(0));
+    fair.Submit(group, late);
+    EXPECT_TRUE(late->IsCanceled());
+    for (auto& task : tasks) {
+        EXPECT_TRUE(task->IsFinished());
+    }
+}
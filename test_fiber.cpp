@@ -0,0 +1,211 @@
+#include <gtest/gtest.h>
+
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include <future>
+
+#include <async_stream.h>
+#include <executors.h>
+
+class GateTask : public Task {
+public:
+    void Run() override {
+    }
+};
+
+class WaitingTask : public Task {
+public:
+    WaitingTask(std::shared_ptr<Task> gate, std::atomic<int>* started)
+        : gate_(std::move(gate)), started_(started) {
+    }
+
+    void Run() override {
+        ++*started_;
+        gate_->Wait();
+    }
+
+private:
+    std::shared_ptr<Task> gate_;
+    std::atomic<int>* started_;
+};
+
+static void WaitFor(const std::atomic<int>& value, int expected) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    while (value.load() < expected && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
+
+TEST(StackPool, ReusesAndLimitsStacks) {
+    FiberOptions options;
+    options.stack_size = 1000;
+    options.max_stacks = 2;
+    options.max_cached_stacks = 1;
+    StackPool pool(options);
+
+    auto first = pool.Allocate();
+    auto second = pool.Allocate();
+    ASSERT_NE(first.base, nullptr);
+    ASSERT_NE(second.base, nullptr);
+    EXPECT_GE(first.size, 1000u);
+    first.base[0] = first.base[first.size - 1] = 1;
+    EXPECT_EQ(pool.Allocate().base, nullptr);
+    EXPECT_EQ(pool.Mapped(), 2u);
+
+    pool.Release(first);
+    pool.Release(second);
+    EXPECT_EQ(pool.Mapped(), 1u);
+    auto again = pool.Allocate();
+    EXPECT_EQ(again.base, first.base);
+    pool.Release(again);
+}
+
+TEST(FiberExecutor, ThousandsOfBlockedTasksOnTwoWorkers) {
+    auto pool = MakeFiberExecutor(2);
+    auto gate = std::make_shared<GateTask>();
+    std::atomic<int> started{0};
+    std::vector<std::shared_ptr<Task>> tasks;
+    for (int i = 0; i < 2000; ++i) {
+        tasks.push_back(std::make_shared<WaitingTask>(gate, &started));
+        pool->Submit(tasks.back());
+    }
+
+    WaitFor(started, 2000);
+    ASSERT_EQ(started.load(), 2000);
+    EXPECT_GE(pool->FiberStacks(), 2000u);
+    gate->Invoke();
+    for (auto& task : tasks) {
+        task->Wait();
+        EXPECT_TRUE(task->IsCompleted());
+    }
+}
+
+TEST(FiberExecutor, GetInsideTaskOnOneWorker) {
+    auto pool = MakeFiberExecutor(1);
+    // Tasks must not own the executor, the last reference would be dropped by a worker
+    auto executor = pool.get();
+    auto outer = pool->Invoke<int>([executor] {
+        int sum = 0;
+        for (int i = 0; i < 100; ++i) {
+            sum += executor->Invoke<int>([i] { return i; })->Get();
+        }
+        return sum;
+    });
+    EXPECT_EQ(outer->Get(), 4950);
+
+    auto failing = pool->Invoke<int>([executor] {
+        return executor->Invoke<int>([]() -> int { throw std::logic_error("Failed"); })->Get();
+    });
+    EXPECT_THROW(failing->Get(), std::logic_error);
+}
+
+TEST(FiberExecutor, StreamConsumerOnOneWorker) {
+    auto pool = MakeFiberExecutor(1);
+    auto stream = MakeAsyncStream<int>(
+        pool, [i = 0]() mutable -> std::optional<int> {
+            return i < 1000 ? std::optional<int>(i++) : std::nullopt;
+        },
+        8);
+    auto consumer = pool->Invoke<int>([&stream] {
+        int sum = 0;
+        while (auto item = stream.Next()) {
+            sum += *item;
+        }
+        return sum;
+    });
+    EXPECT_EQ(consumer->Get(), 999 * 1000 / 2);
+}
+
+TEST(FiberExecutor, BlockingScopeDoesNotPark) {
+    auto pool = MakeFiberExecutor(2);
+    auto checked = pool->Invoke<bool>([] {
+        bool outside = Scheduler::CanPark();
+        BlockingScope scope;
+        return outside && !Scheduler::CanPark();
+    });
+    EXPECT_TRUE(checked->Get());
+    EXPECT_FALSE(Scheduler::CanPark());
+}
+
+TEST(FiberExecutor, OutOfStacksRunsOnWorker) {
+    FiberOptions options;
+    options.max_stacks = 1;
+    auto pool = MakeFiberExecutor(4, options);
+    std::atomic<int> counter{0};
+    std::vector<FuturePtr<Unit>> all;
+    for (int i = 0; i < 1000; ++i) {
+        all.push_back(pool->Invoke<Unit>([&counter] {
+            ++counter;
+            return Unit{};
+        }));
+    }
+    for (auto& future : all) {
+        future->Get();
+    }
+    EXPECT_EQ(counter.load(), 1000);
+    EXPECT_LE(pool->FiberStacks(), 1u);
+}
+
+TEST(FiberExecutor, ShutdownWithParkedTasks) {
+    auto pool = MakeFiberExecutor(2);
+    auto gate = std::make_shared<GateTask>();
+    std::atomic<int> started{0};
+    std::vector<std::shared_ptr<Task>> tasks;
+    for (int i = 0; i < 100; ++i) {
+        tasks.push_back(std::make_shared<WaitingTask>(gate, &started));
+        pool->Submit(tasks.back());
+    }
+    WaitFor(started, 100);
+    pool->StartShutdown();
+    pool->WaitShutdown();
+    pool.reset();
+
+    // Like blocked threads, parked tasks go on once the gate opens
+    gate->Invoke();
+    for (auto& task : tasks) {
+        EXPECT_TRUE(task->IsCompleted());
+    }
+}
+
+TEST(FiberExecutor, ShutdownResumesQueuedFiber) {
+    auto pool = MakeFiberExecutor(1);
+    auto gate = std::make_shared<GateTask>();
+    std::atomic<int> started{0};
+    std::atomic<bool> unwound{false};
+    struct Unwind {
+        ~Unwind() {
+            *flag = true;
+        }
+        std::atomic<bool>* flag;
+    };
+    auto parked = pool->Invoke<Unit>([&] {
+        Unwind unwind{&unwound};
+        ++started;
+        gate->Wait();
+        return Unit{};
+    });
+    WaitFor(started, 1);
+    while (pool->IdleWorkers() != 1) {
+        std::this_thread::yield();
+    }
+
+    // Blocks the only worker, so the fiber stays queued once the gate opens
+    std::promise<void> release;
+    auto released = release.get_future().share();
+    auto blocker = pool->Invoke<Unit>([&started, released] {
+        ++started;
+        released.wait();
+        return Unit{};
+    });
+    WaitFor(started, 2);
+    gate->Invoke();
+
+    pool->StartShutdown();
+    EXPECT_TRUE(parked->IsCompleted());
+    EXPECT_TRUE(unwound.load());
+
+    release.set_value();
+    pool->WaitShutdown();
+    EXPECT_TRUE(blocker->IsCompleted());
+}
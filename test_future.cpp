@@ -3,6 +3,7 @@
 #include <thread>
 #include <chrono>
 #include <atomic>
+#include <future>
 
 #include <executors.h>
 
@@ -38,6 +39,66 @@ TEST_F(FutureTest, InvokeException) {
     ASSERT_THROW(future->Get(), std::logic_error);
 }
 
+TEST_F(FutureTest, MoveOnlyResult) {
+    auto future = pool->Invoke<std::unique_ptr<int>>([] { return std::make_unique<int>(42); });
+    auto next = pool->Then<int>(future, [future] { return *future->GetRef() + 1; });
+
+    EXPECT_EQ(next->Get(), 43);
+    auto value = future->Take();
+    ASSERT_TRUE(value);
+    EXPECT_EQ(*value, 42);
+}
+
+struct NoDefault {
+    explicit NoDefault(int value) : value(value) {
+    }
+
+    int value;
+};
+
+TEST_F(FutureTest, NonDefaultConstructibleResult) {
+    auto future = pool->Invoke<NoDefault>([] { return NoDefault(7); });
+    auto all = pool->WhenAll<NoDefault>({future, future});
+
+    EXPECT_EQ(future->Get().value, 7);
+    auto results = all->Get();
+    ASSERT_EQ(results.size(), 2u);
+    EXPECT_EQ(results[1].value, 7);
+}
+
+struct CopyCounter {
+    CopyCounter(std::atomic<int>* copies) : copies(copies) {
+    }
+
+    CopyCounter(const CopyCounter& other) : copies(other.copies) {
+        ++*copies;
+    }
+
+    CopyCounter(CopyCounter&& other) = default;
+
+    std::atomic<int>* copies;
+};
+
+TEST_F(FutureTest, GetRefAndTakeDoNotCopy) {
+    std::atomic<int> copies{0};
+    auto future = pool->Invoke<CopyCounter>([&] { return CopyCounter(&copies); });
+
+    EXPECT_EQ(future->GetRef().copies, &copies);
+    auto value = std::move(*future).Get();
+    EXPECT_EQ(value.copies, &copies);
+    EXPECT_EQ(copies.load(), 0);
+
+    future->Get();
+    EXPECT_EQ(copies.load(), 1);
+}
+
+TEST_F(FutureTest, TakeRethrows) {
+    auto future = pool->Invoke<std::unique_ptr<int>>(
+        []() -> std::unique_ptr<int> { throw std::logic_error("Test"); });
+
+    EXPECT_THROW(future->Take(), std::logic_error);
+}
+
 TEST_F(FutureTest, Then) {
     auto future_a = pool->Invoke<std::string>([]() { return std::string("Foo Bar"); });
 
@@ -66,6 +127,68 @@ TEST_F(FutureTest, ThenIsNonBlocking) {
     EXPECT_LE(std::chrono::duration_cast<std::chrono::milliseconds>(delta).count(), 50);
 }
 
+TEST_F(FutureTest, LongReadyThenChain) {
+    // The whole chain is built before the first stage finishes, so every stage
+    // becomes ready on the worker that ran the previous one
+    const int n = 10000;
+    std::promise<void> start;
+    auto started = start.get_future().share();
+    auto future = pool->Invoke<int>([started] {
+        started.wait();
+        return 0;
+    });
+    for (int i = 0; i < n; ++i) {
+        future = pool->Then<int>(future, [future] { return future->Get() + 1; });
+    }
+    start.set_value();
+
+    EXPECT_EQ(future->Get(), n);
+}
+
+TEST_F(FutureTest, ThenRunsOnWorkerOfPredecessor) {
+    // Shorter than Scheduler::kMaxLifoStreak, so no stage is sent to the shared queue
+    const int n = 10;
+    std::promise<void> start;
+    auto started = start.get_future().share();
+    std::vector<std::thread::id> threads(n + 1);
+    auto future = pool->Invoke<Unit>([&threads, started] {
+        started.wait();
+        threads[0] = std::this_thread::get_id();
+        return Unit{};
+    });
+    for (int i = 1; i <= n; ++i) {
+        future = pool->Then<Unit>(future, [&threads, i] {
+            threads[i] = std::this_thread::get_id();
+            return Unit{};
+        });
+    }
+    start.set_value();
+    future->Get();
+
+    for (int i = 1; i <= n; ++i) {
+        EXPECT_EQ(threads[i], threads[0]) << "stage " << i;
+    }
+}
+
+TEST_F(FutureTest, ThenFanOut) {
+    std::promise<void> start;
+    auto started = start.get_future().share();
+    auto root = pool->Invoke<int>([started] {
+        started.wait();
+        return 1;
+    });
+    std::vector<FuturePtr<int>> all;
+    for (int i = 0; i < 10; ++i) {
+        all.push_back(pool->Then<int>(root, [root, i] { return root->Get() + i; }));
+    }
+    start.set_value();
+
+    auto results = pool->WhenAll(all)->Get();
+    for (int i = 0; i < 10; ++i) {
+        EXPECT_EQ(results[i], i + 1);
+    }
+}
+
 TEST_F(FutureTest, WhenAll) {
     const size_t n = 100;
     std::atomic<size_t> count{0};
@@ -0,0 +1,142 @@
+#include <gtest/gtest.h>
+
+#include <thread>
+#include <chrono>
+#include <atomic>
+
+#include <grain.h>
+
+static uint64_t Ticks(std::chrono::nanoseconds duration) {
+    return duration.count() * GrainTuner::TicksPerNanosecond();
+}
+
+TEST(GrainTuner, ConvergesToTargetTime) {
+    GrainPolicy policy;
+    policy.target_time = std::chrono::microseconds(20);
+    GrainTuner tuner(policy);
+    EXPECT_EQ(tuner.Grain(), policy.initial_grain);
+
+    for (int i = 0; i < 100; ++i) {
+        tuner.Record(Ticks(std::chrono::nanoseconds(200 * 50)), 50);
+    }
+    EXPECT_NEAR(tuner.ItemTime().count(), 200, 20);
+    EXPECT_NEAR(tuner.Grain(), 100, 10);
+
+    // Large items go one per batch
+    for (int i = 0; i < 100; ++i) {
+        tuner.Record(Ticks(std::chrono::milliseconds(1)), 1);
+    }
+    EXPECT_EQ(tuner.Grain(), 1u);
+}
+
+TEST(GrainTuner, PolicyOverride) {
+    GrainPolicy policy;
+    policy.max_grain = 64;
+    policy.grain = [](std::chrono::nanoseconds item_time) {
+        return item_time < std::chrono::microseconds(1) ? 1000 : 7;
+    };
+    GrainTuner tuner(policy);
+    tuner.Record(Ticks(std::chrono::microseconds(5)), 1);
+    EXPECT_EQ(tuner.Grain(), 7u);
+    for (int i = 0; i < 100; ++i) {
+        tuner.Record(Ticks(std::chrono::nanoseconds(10)), 1);
+    }
+    EXPECT_EQ(tuner.Grain(), 64u);
+}
+
+TEST(AdaptiveSubmitter, BatchesMicrotasks) {
+    auto pool = MakeThreadPoolExecutor(4);
+    std::atomic<int> counter{0};
+    {
+        AdaptiveSubmitter submitter(pool);
+        for (int i = 0; i < 100000; ++i) {
+            submitter.Submit([&counter] { ++counter; });
+        }
+        submitter.Wait();
+        EXPECT_EQ(counter.load(), 100000);
+        EXPECT_GT(submitter.Tuner().Grain(), 8u);
+
+        // Destructor flushes the partial batch
+        submitter.Submit([&counter] { ++counter; });
+    }
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    while (counter.load() < 100001 && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    EXPECT_EQ(counter.load(), 100001);
+}
+
+TEST(AdaptiveSubmitter, RethrowsFirstError) {
+    auto pool = MakeThreadPoolExecutor(2);
+    AdaptiveSubmitter submitter(pool);
+    std::atomic<int> counter{0};
+    for (int i = 0; i < 100; ++i) {
+        submitter.Submit([&counter, i] {
+            ++counter;
+            if (i == 50) {
+                throw std::logic_error("Failed");
+            }
+        });
+    }
+    EXPECT_THROW(submitter.Wait(), std::logic_error);
+    EXPECT_EQ(counter.load(), 100);
+    EXPECT_NO_THROW(submitter.Wait());
+}
+
+TEST(ParallelFor, VisitsEveryIndexOnce) {
+    auto pool = MakeThreadPoolExecutor(4);
+    const size_t n = 1000000;
+    std::vector<std::atomic<uint8_t>> hits(n);
+    ParallelFor(*pool, 0, n, [&hits](size_t i) { ++hits[i]; });
+    for (size_t i = 0; i < n; ++i) {
+        ASSERT_EQ(hits[i].load(), 1) << i;
+    }
+
+    std::atomic<int> calls{0};
+    ParallelFor(*pool, 5, 5, [&calls](size_t) { ++calls; });
+    EXPECT_EQ(calls.load(), 0);
+}
+
+TEST(ParallelFor, RethrowsAndStops) {
+    auto pool = MakeThreadPoolExecutor(4);
+    std::atomic<size_t> calls{0};
+    EXPECT_THROW(ParallelFor(*pool, 0, 1000000,
+                             [&calls](size_t i) {
+                                 ++calls;
+                                 if (i == 10) {
+                                     throw std::runtime_error("Failed");
+                                 }
+                             }),
+                 std::runtime_error);
+    EXPECT_LT(calls.load(), 1000000u);
+}
+
+TEST(ParallelFor, FinishesAcrossShutdown) {
+    auto pool = MakeThreadPoolExecutor(4);
+    const size_t n = 1000000;
+    std::atomic<size_t> calls{0};
+    ParallelFor(*pool, 0, n, [&pool, &calls](size_t) {
+        if (++calls == 1000) {
+            pool->StartShutdown();
+        }
+    });
+    EXPECT_EQ(calls.load(), n);
+    pool->WaitShutdown();
+}
+
+TEST(ParallelFor, NestedInsideTasks) {
+    auto pool = MakeFiberExecutor(2);
+    auto executor = pool.get();
+    std::atomic<size_t> sum{0};
+    std::vector<FuturePtr<Unit>> outer;
+    for (int t = 0; t < 8; ++t) {
+        outer.push_back(pool->Invoke<Unit>([executor, &sum] {
+            ParallelFor(*executor, 0, 10000, [&sum](size_t i) { sum += i; });
+            return Unit{};
+        }));
+    }
+    for (auto& future : outer) {
+        future->Get();
+    }
+    EXPECT_EQ(sum.load(), 8u * 9999 * 10000 / 2);
+}
@@ -0,0 +1,132 @@
+#include <gtest/gtest.h>
+
+#include <thread>
+#include <chrono>
+#include <atomic>
+
+#include <keyed_executor.h>
+
+struct KeyedExecutorTest : public ::testing::Test {
+    std::shared_ptr<Executor> pool;
+
+    KeyedExecutorTest() {
+        pool = MakeThreadPoolExecutor(4);
+    }
+};
+
+class FunctionTask : public Task {
+public:
+    explicit FunctionTask(std::function<void()> fn) : fn_(std::move(fn)) {
+    }
+
+    void Run() override {
+        fn_();
+    }
+
+private:
+    std::function<void()> fn_;
+};
+
+TEST_F(KeyedExecutorTest, PerKeyOrder) {
+    const int producers = 4;
+    const int keys_per_producer = 250;
+    const int tasks_per_key = 40;
+    KeyedExecutor<int> keyed(pool, 64);
+
+    // Plain ints: tasks of one key never run concurrently
+    std::vector<int> last_seen(producers * keys_per_producer, -1);
+    std::atomic<int> out_of_order{0};
+    std::vector<std::shared_ptr<Task>> tasks;
+    std::mutex tasks_lock;
+
+    std::vector<std::thread> threads;
+    for (int p = 0; p < producers; ++p) {
+        threads.emplace_back([&, p] {
+            std::vector<std::shared_ptr<Task>> mine;
+            for (int i = 0; i < tasks_per_key; ++i) {
+                for (int k = p * keys_per_producer; k < (p + 1) * keys_per_producer; ++k) {
+                    auto task = std::make_shared<FunctionTask>([&, k, i] {
+                        if (last_seen[k] != i - 1) {
+                            ++out_of_order;
+                        }
+                        last_seen[k] = i;
+                    });
+                    keyed.Submit(k, task);
+                    mine.push_back(task);
+                }
+            }
+            auto guard = std::lock_guard(tasks_lock);
+            tasks.insert(tasks.end(), mine.begin(), mine.end());
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    for (auto& task : tasks) {
+        task->Wait();
+    }
+
+    EXPECT_EQ(out_of_order.load(), 0);
+    for (int seen : last_seen) {
+        EXPECT_EQ(seen, tasks_per_key - 1);
+    }
+}
+
+TEST_F(KeyedExecutorTest, DifferentKeysRunInParallel) {
+    KeyedExecutor<int> keyed(pool);
+    int other = 1;
+    while (keyed.MailboxOf(other) == keyed.MailboxOf(0)) {
+        ++other;
+    }
+
+    std::atomic<bool> released{false};
+    auto blocked = std::make_shared<FunctionTask>([&] {
+        while (!released) {
+            std::this_thread::yield();
+        }
+    });
+    auto releaser = std::make_shared<FunctionTask>([&] { released = true; });
+    keyed.Submit(0, blocked);
+    keyed.Submit(other, releaser);
+
+    blocked->Wait();
+    EXPECT_TRUE(releaser->IsCompleted());
+}
+
+TEST_F(KeyedExecutorTest, FailedTaskDoesNotStopKey) {
+    KeyedExecutor<std::string> keyed(pool);
+    auto failing = std::make_shared<FunctionTask>([] { throw std::logic_error("Failed"); });
+    auto next = std::make_shared<FunctionTask>([] {});
+    keyed.Submit("account", failing);
+    keyed.Submit("account", next);
+
+    next->Wait();
+    EXPECT_TRUE(failing->IsFailed());
+    EXPECT_TRUE(next->IsCompleted());
+}
+
+TEST_F(KeyedExecutorTest, ShutdownFinishesPendingTasks) {
+    std::atomic<bool> released{false};
+    auto blocked = std::make_shared<FunctionTask>([&] {
+        while (!released) {
+            std::this_thread::yield();
+        }
+    });
+    std::vector<std::shared_ptr<Task>> pending;
+    {
+        KeyedExecutor<int> keyed(pool);
+        keyed.Submit(1, blocked);
+        for (int i = 0; i < 10; ++i) {
+            pending.push_back(std::make_shared<FunctionTask>([] {}));
+            keyed.Submit(1, pending.back());
+        }
+    }
+    pool->StartShutdown();
+    released = true;
+    pool->WaitShutdown();
+    pool.reset();
+
+    for (auto& task : pending) {
+        EXPECT_TRUE(task->IsFinished());
+    }
+}
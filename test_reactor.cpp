@@ -0,0 +1,223 @@
+#include <gtest/gtest.h>
+
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include <filesystem>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <executors.h>
+
+struct ReactorTest : public ::testing::Test {
+    std::shared_ptr<Executor> pool;
+
+    ReactorTest() {
+        pool = MakeThreadPoolExecutor(2);
+    }
+};
+
+class FlagTask : public Task {
+public:
+    void Run() override {
+        ran = true;
+    }
+
+    std::atomic<bool> ran{false};
+};
+
+struct Pipe {
+    Pipe() {
+        int fds[2];
+        EXPECT_EQ(pipe2(fds, O_NONBLOCK), 0);
+        read_end = fds[0];
+        write_end = fds[1];
+    }
+
+    ~Pipe() {
+        close(read_end);
+        close(write_end);
+    }
+
+    int read_end;
+    int write_end;
+};
+
+TEST_F(ReactorTest, PipeReadable) {
+    Pipe pipe;
+    auto task = std::make_shared<FlagTask>();
+    pool->OnReadable(pipe.read_end, task);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    EXPECT_FALSE(task->ran);
+
+    ASSERT_EQ(write(pipe.write_end, "x", 1), 1);
+    task->Wait();
+    EXPECT_TRUE(task->IsCompleted());
+    pool->Forget(pipe.read_end);
+}
+
+TEST_F(ReactorTest, AlreadyReadableFiresRightAway) {
+    Pipe pipe;
+    ASSERT_EQ(write(pipe.write_end, "x", 1), 1);
+
+    for (int i = 0; i < 3; ++i) {
+        auto task = std::make_shared<FlagTask>();
+        pool->OnReadable(pipe.read_end, task);
+        task->Wait();
+        EXPECT_TRUE(task->IsCompleted());
+    }
+    pool->Forget(pipe.read_end);
+}
+
+TEST_F(ReactorTest, ReadAndWriteWaitersOnOneFd) {
+    int fds[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds), 0);
+    auto reader = std::make_shared<FlagTask>();
+    auto writer = std::make_shared<FlagTask>();
+    pool->OnReadable(fds[0], reader);
+    pool->OnWritable(fds[0], writer);
+
+    writer->Wait();
+    EXPECT_FALSE(reader->IsFinished());
+    ASSERT_EQ(write(fds[1], "x", 1), 1);
+    reader->Wait();
+    EXPECT_TRUE(reader->IsCompleted());
+
+    auto waiting = std::make_shared<FlagTask>();
+    pool->OnReadable(fds[1], waiting);
+    EXPECT_THROW(pool->OnReadable(fds[1], std::make_shared<FlagTask>()), std::logic_error);
+    pool->Forget(fds[0]);
+    pool->Forget(fds[1]);
+    EXPECT_TRUE(waiting->IsCanceled());
+    close(fds[0]);
+    close(fds[1]);
+}
+
+TEST_F(ReactorTest, EventFd) {
+    int fd = eventfd(0, EFD_NONBLOCK);
+    ASSERT_GE(fd, 0);
+    auto task = std::make_shared<FlagTask>();
+    pool->OnReadable(fd, task);
+
+    uint64_t one = 1;
+    ASSERT_EQ(write(fd, &one, sizeof(one)), static_cast<ssize_t>(sizeof(one)));
+    task->Wait();
+    EXPECT_TRUE(task->IsCompleted());
+    pool->Forget(fd);
+    close(fd);
+}
+
+TEST_F(ReactorTest, LoopbackSocket) {
+    int listener = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    ASSERT_GE(listener, 0);
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    ASSERT_EQ(bind(listener, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)), 0);
+    ASSERT_EQ(listen(listener, 16), 0);
+    socklen_t len = sizeof(addr);
+    ASSERT_EQ(getsockname(listener, reinterpret_cast<sockaddr*>(&addr), &len), 0);
+
+    auto accepted = std::make_shared<FlagTask>();
+    pool->OnReadable(listener, accepted);
+    int client = socket(AF_INET, SOCK_STREAM, 0);
+    ASSERT_EQ(connect(client, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)), 0);
+    accepted->Wait();
+    int server = accept4(listener, nullptr, nullptr, SOCK_NONBLOCK);
+    ASSERT_GE(server, 0);
+
+    auto readable = std::make_shared<FlagTask>();
+    pool->OnReadable(server, readable);
+    ASSERT_EQ(write(client, "ping", 4), 4);
+    readable->Wait();
+    char buffer[4];
+    EXPECT_EQ(read(server, buffer, 4), 4);
+
+    // Peer shutdown wakes the reader as well
+    auto hangup = std::make_shared<FlagTask>();
+    pool->OnReadable(server, hangup);
+    close(client);
+    hangup->Wait();
+    EXPECT_TRUE(hangup->IsCompleted());
+
+    pool->Forget(server);
+    pool->Forget(listener);
+    close(server);
+    close(listener);
+}
+
+TEST_F(ReactorTest, ManyFdsAtOnce) {
+    const int n = 500;
+    std::vector<std::unique_ptr<Pipe>> pipes;
+    std::vector<std::shared_ptr<FlagTask>> tasks;
+    for (int i = 0; i < n; ++i) {
+        pipes.push_back(std::make_unique<Pipe>());
+        tasks.push_back(std::make_shared<FlagTask>());
+        pool->OnReadable(pipes[i]->read_end, tasks[i]);
+    }
+    for (int i = n - 1; i >= 0; --i) {
+        ASSERT_EQ(write(pipes[i]->write_end, "x", 1), 1);
+    }
+    for (int i = 0; i < n; ++i) {
+        tasks[i]->Wait();
+        EXPECT_TRUE(tasks[i]->IsCompleted());
+        pool->Forget(pipes[i]->read_end);
+    }
+}
+
+TEST_F(ReactorTest, ForgetAndShutdownCancel) {
+    Pipe pipe;
+    auto forgotten = std::make_shared<FlagTask>();
+    pool->OnReadable(pipe.read_end, forgotten);
+    pool->Forget(pipe.read_end);
+    EXPECT_TRUE(forgotten->IsCanceled());
+
+    auto pending = std::make_shared<FlagTask>();
+    pool->OnWritable(pipe.read_end, pending);
+    pool->StartShutdown();
+    pool->WaitShutdown();
+    EXPECT_TRUE(pending->IsCanceled());
+
+    auto late = std::make_shared<FlagTask>();
+    pool->OnReadable(pipe.read_end, late);
+    EXPECT_TRUE(late->IsCanceled());
+}
+
+static int CountThreads() {
+    auto tasks = std::filesystem::directory_iterator("/proc/self/task");
+    return std::distance(begin(tasks), end(tasks));
+}
+
+TEST(ReactorStartTest, ThreadsStartOnFirstUse) {
+    auto before = CountThreads();
+    auto pool = MakeThreadPoolExecutor(2);
+    EXPECT_EQ(CountThreads(), before + 2);
+
+    Pipe pipe;
+    pool->Forget(pipe.read_end);
+    auto task = std::make_shared<FlagTask>();
+    pool->OnReadable(pipe.read_end, task);
+    EXPECT_EQ(CountThreads(), before + 3);
+
+    auto periodic = pool->SchedulePeriodic([] {}, std::chrono::milliseconds(10));
+    EXPECT_EQ(CountThreads(), before + 4);
+    periodic->Cancel();
+    pool->Forget(pipe.read_end);
+}
+
+TEST(ReactorStartTest, UnusedReactorCancelsAfterShutdown) {
+    auto pool = MakeThreadPoolExecutor(1);
+    pool->StartShutdown();
+    pool->WaitShutdown();
+
+    Pipe pipe;
+    auto task = std::make_shared<FlagTask>();
+    pool->OnReadable(pipe.read_end, task);
+    EXPECT_TRUE(task->IsCanceled());
+}
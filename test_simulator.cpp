@@ -0,0 +1,104 @@
+#include <gtest/gtest.h>
+
+#include <thread>
+#include <chrono>
+
+#include <simulator.h>
+
+static Trace MakeTrace(std::vector<TraceTask> tasks) {
+    return Trace{std::move(tasks)};
+}
+
+TEST(Simulator, IndependentTasks) {
+    auto trace = MakeTrace({{0, 10, {}}, {0, 10, {}}, {0, 10, {}}, {0, 10, {}}});
+    auto policy = MakeFifoPolicy();
+    auto result = Simulate(trace, *policy, 2);
+    EXPECT_EQ(result.makespan_ns, 20u);
+    EXPECT_EQ(result.busy_ns, 40u);
+    EXPECT_DOUBLE_EQ(result.utilization, 1.0);
+    EXPECT_DOUBLE_EQ(result.mean_latency_ns, 15.0);
+    EXPECT_EQ(result.p50_latency_ns, 10u);
+    EXPECT_EQ(result.max_latency_ns, 20u);
+
+    result = Simulate(trace, *policy, 8);
+    EXPECT_EQ(result.makespan_ns, 10u);
+    EXPECT_DOUBLE_EQ(result.utilization, 0.5);
+}
+
+TEST(Simulator, ChainRunsSequentially) {
+    auto trace = MakeTrace({{0, 5, {}}, {0, 5, {0}}, {3, 5, {1}}, {100, 1, {}}});
+    auto policy = MakeWorkStealingPolicy();
+    auto result = Simulate(trace, *policy, 4);
+    EXPECT_EQ(result.makespan_ns, 101u);
+    EXPECT_EQ(result.busy_ns, 16u);
+    // The third task waits for the chain and the last one for its submission
+    EXPECT_EQ(result.max_latency_ns, 12u);
+}
+
+TEST(Simulator, FifoAndLifoOrder) {
+    // One long task holds the core while two short ones arrive
+    auto trace = MakeTrace({{0, 10, {}}, {1, 1, {}}, {2, 1, {}}});
+    auto fifo = MakeFifoPolicy();
+    auto lifo = MakeLifoPolicy();
+    auto fifo_result = Simulate(trace, *fifo, 1);
+    auto lifo_result = Simulate(trace, *lifo, 1);
+    EXPECT_EQ(fifo_result.makespan_ns, 12u);
+    EXPECT_EQ(lifo_result.makespan_ns, 12u);
+    EXPECT_EQ(fifo_result.max_latency_ns, 10u);
+    EXPECT_EQ(lifo_result.max_latency_ns, 11u);
+}
+
+TEST(Simulator, EdfDeadlines) {
+    auto trace = MakeTrace({{0, 10, {}}, {0, 1, {}}, {0, 2, {}}});
+    auto by_submit = MakeEdfPolicy();
+    EXPECT_DOUBLE_EQ(Simulate(trace, *by_submit, 1).mean_latency_ns, (10 + 11 + 13) / 3.0);
+
+    auto shortest_first = MakeEdfPolicy([](const TraceTask& task) { return task.duration_ns; });
+    EXPECT_DOUBLE_EQ(Simulate(trace, *shortest_first, 1).mean_latency_ns, (1 + 3 + 13) / 3.0);
+}
+
+TEST(Simulator, WorkStealingSpreadsForks) {
+    std::vector<TraceTask> tasks{{0, 1, {}}};
+    for (int i = 0; i < 8; ++i) {
+        tasks.push_back({0, 10, {0}});
+    }
+    auto trace = MakeTrace(std::move(tasks));
+    auto policy = MakeWorkStealingPolicy(7);
+    auto result = Simulate(trace, *policy, 4);
+    EXPECT_EQ(result.makespan_ns, 21u);
+
+    // Deterministic for the same seed
+    auto again = Simulate(trace, *policy, 4);
+    EXPECT_EQ(again.makespan_ns, result.makespan_ns);
+    EXPECT_EQ(again.mean_latency_ns, result.mean_latency_ns);
+}
+
+TEST(Simulator, RejectsCycles) {
+    auto trace = MakeTrace({{0, 1, {1}}, {0, 1, {0}}});
+    auto policy = MakeFifoPolicy();
+    EXPECT_THROW(Simulate(trace, *policy, 1), std::runtime_error);
+    EXPECT_THROW(Simulate(trace, *policy, 0), std::invalid_argument);
+    EXPECT_EQ(Simulate(Trace{}, *policy, 1).makespan_ns, 0u);
+}
+
+TEST(Simulator, ReplaysRecordedTrace) {
+    auto pool = MakeThreadPoolExecutor(1);
+    TraceRecorder recorder;
+    recorder.Start();
+    std::vector<FuturePtr<int>> all;
+    for (int i = 0; i < 8; ++i) {
+        all.push_back(pool->Invoke<int>([i] {
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+            return i;
+        }));
+    }
+    pool->WhenAll(all)->Get();
+    auto trace = recorder.Stop();
+    ASSERT_EQ(trace.tasks.size(), 9u);
+
+    auto policy = MakeFifoPolicy();
+    auto one = Simulate(trace, *policy, 1);
+    auto four = Simulate(trace, *policy, 4);
+    EXPECT_GE(one.makespan_ns, 16'000'000u);
+    EXPECT_LT(four.makespan_ns * 2, one.makespan_ns);
+}
@@ -0,0 +1,111 @@
+#include <gtest/gtest.h>
+
+#include <thread>
+#include <chrono>
+#include <future>
+#include <sstream>
+
+#include <trace.h>
+
+TEST(TraceRecorder, RecordsDagOfFutures) {
+    auto pool = MakeThreadPoolExecutor(2);
+    TraceRecorder recorder;
+    recorder.Start();
+
+    auto first = pool->Invoke<int>([] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        return 1;
+    });
+    auto second = pool->Invoke<int>([] { return 2; });
+    auto sum = pool->Invoke<int>([] { return 0; });
+    auto joined = pool->WhenAll(std::vector<FuturePtr<int>>{first, second});
+    auto then = pool->Then<int, std::vector<int>>(joined, [] { return 3; });
+    then->Get();
+    sum->Get();
+
+    auto trace = recorder.Stop();
+    ASSERT_EQ(trace.tasks.size(), 5u);
+    for (size_t i = 1; i < trace.tasks.size(); ++i) {
+        EXPECT_LE(trace.tasks[i - 1].submit_ns, trace.tasks[i].submit_ns);
+    }
+    EXPECT_GE(trace.tasks[0].duration_ns, 5'000'000u);
+    EXPECT_TRUE(trace.tasks[1].dependencies.empty());
+    EXPECT_EQ(trace.tasks[3].dependencies, (std::vector<uint32_t>{0, 1}));
+    EXPECT_EQ(trace.tasks[4].dependencies, (std::vector<uint32_t>{3}));
+
+    // Nothing is recorded once stopped
+    pool->Invoke<int>([] { return 4; })->Get();
+    EXPECT_TRUE(recorder.Stop().tasks.empty());
+}
+
+TEST(TraceRecorder, DropsTasksThatDidNotRun) {
+    auto pool = MakeThreadPoolExecutor(1);
+    TraceRecorder recorder;
+    recorder.Start();
+
+    std::promise<void> open;
+    auto opened = open.get_future().share();
+    auto blocker = pool->Invoke<int>([opened] {
+        opened.wait();
+        return 1;
+    });
+    auto canceled = pool->Invoke<int>([] { return 2; });
+    canceled->Cancel();
+    // Never submitted, the edge to it is dropped
+    auto outside = std::make_shared<Future<int>>();
+    auto after = pool->Then<int, int>(outside, [] { return 3; });
+    outside->Cancel();
+    open.set_value();
+    blocker->Get();
+    after->Get();
+
+    auto trace = recorder.Stop();
+    ASSERT_EQ(trace.tasks.size(), 2u);
+    EXPECT_TRUE(trace.tasks[1].dependencies.empty());
+}
+
+TEST(TraceRecorder, OneObserverAtATime) {
+    TraceRecorder first;
+    TraceRecorder second;
+    first.Start();
+    EXPECT_THROW(second.Start(), std::logic_error);
+    first.Stop();
+    second.Start();
+    second.Stop();
+}
+
+TEST(Trace, SaveAndLoad) {
+    Trace trace;
+    trace.tasks.push_back({.submit_ns = 100, .duration_ns = 5000});
+    trace.tasks.push_back({.submit_ns = 90, .duration_ns = 0, .dependencies = {0}});
+    trace.tasks.push_back({.submit_ns = 1ull << 40, .duration_ns = 7, .dependencies = {0, 1}});
+    // A dependency on a later task is legal in the format
+    trace.tasks[0].dependencies.push_back(2);
+
+    std::stringstream buffer;
+    trace.Save(buffer);
+    EXPECT_LT(buffer.str().size(), 32u);
+    EXPECT_EQ(Trace::Load(buffer), trace);
+
+    std::stringstream empty;
+    Trace{}.Save(empty);
+    EXPECT_TRUE(Trace::Load(empty).tasks.empty());
+}
+
+TEST(Trace, RejectsMalformedInput) {
+    std::stringstream garbage("not a trace");
+    EXPECT_THROW(Trace::Load(garbage), std::runtime_error);
+
+    Trace trace;
+    trace.tasks.push_back({.submit_ns = 1, .duration_ns = 2, .dependencies = {}});
+    std::stringstream buffer;
+    trace.Save(buffer);
+    auto bytes = buffer.str();
+    std::stringstream truncated(bytes.substr(0, bytes.size() - 1));
+    EXPECT_THROW(Trace::Load(truncated), std::runtime_error);
+
+    trace.tasks[0].dependencies.push_back(5);
+    std::stringstream out_of_range;
+    trace.Save(out_of_range);
+    EXPECT_THROW(Trace::Load(out_of_range), std::runtime_error);
+}
@@ -0,0 +1,127 @@
+#include <gtest/gtest.h>
+
+#include <thread>
+#include <chrono>
+#include <atomic>
+
+#include <watchdog.h>
+
+class StuckTask : public Task {
+public:
+    explicit StuckTask(std::chrono::milliseconds duration) : duration_(duration) {
+    }
+
+    void Run() override {
+        // Spins rather than sleeps, the sampling signal must not cut it short
+        auto end = std::chrono::steady_clock::now() + duration_;
+        while (std::chrono::steady_clock::now() < end) {
+        }
+    }
+
+private:
+    std::chrono::milliseconds duration_;
+};
+
+class ShortTask : public Task {
+public:
+    void Run() override {
+    }
+};
+
+static WatchdogOptions FastOptions() {
+    WatchdogOptions options;
+    options.threshold = std::chrono::milliseconds(50);
+    options.poll_interval = std::chrono::milliseconds(5);
+    return options;
+}
+
+TEST(Watchdog, ReportsStuckTaskOnce) {
+    auto pool = MakeThreadPoolExecutor(2);
+    std::mutex lock;
+    std::vector<StallReport> reports;
+    Watchdog watchdog(
+        *pool,
+        [&](const StallReport& report) {
+            auto guard = std::lock_guard(lock);
+            reports.push_back(report);
+        },
+        FastOptions());
+
+    auto stuck = std::make_shared<StuckTask>(std::chrono::milliseconds(400));
+    stuck->SetLabel("request #42");
+    pool->Submit(stuck);
+    std::vector<std::shared_ptr<Task>> quick;
+    for (int i = 0; i < 1000; ++i) {
+        quick.push_back(std::make_shared<ShortTask>());
+        pool->Submit(quick.back());
+    }
+    stuck->Wait();
+    for (auto& task : quick) {
+        task->Wait();
+    }
+
+    auto guard = std::lock_guard(lock);
+    ASSERT_EQ(reports.size(), 1u);
+    EXPECT_EQ(watchdog.Stalls(), 1u);
+    EXPECT_EQ(reports[0].type_name, "StuckTask");
+    EXPECT_EQ(reports[0].label, "request #42");
+    EXPECT_GE(reports[0].running_for, std::chrono::milliseconds(50));
+    EXPECT_FALSE(reports[0].stack.empty());
+    EXPECT_EQ(reports[0].Symbols().size(), reports[0].stack.size());
+}
+
+TEST(Watchdog, IdleWorkersAreNotStalled) {
+    auto pool = MakeThreadPoolExecutor(4);
+    Watchdog watchdog(*pool, [](const StallReport&) {}, FastOptions());
+    auto task = std::make_shared<ShortTask>();
+    pool->Submit(task);
+    task->Wait();
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    EXPECT_EQ(watchdog.Stalls(), 0u);
+}
+
+TEST(Watchdog, FutureTypeAndBlockingWorkers) {
+    auto pool = MakeThreadPoolExecutor(1);
+    std::atomic<int> reported{0};
+    std::string type_name;
+    Watchdog watchdog(
+        *pool,
+        [&](const StallReport& report) {
+            type_name = report.type_name;
+            ++reported;
+        },
+        FastOptions());
+
+    // Reported through the compensating worker as well
+    auto blocking = pool->SpawnBlocking<int>([] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(300));
+        return 1;
+    });
+    EXPECT_EQ(blocking->Get(), 1);
+    EXPECT_EQ(reported.load(), 1);
+    EXPECT_EQ(type_name, "Future<int>");
+}
+
+TEST(Watchdog, StuckTaskOnFiber) {
+    auto pool = MakeFiberExecutor(2);
+    std::atomic<int> reported{0};
+    Watchdog watchdog(
+        *pool, [&](const StallReport& report) { reported += report.type_name == "StuckTask"; },
+        FastOptions());
+
+    auto gate = std::make_shared<ShortTask>();
+    // Parks on the gate, then hangs after it is resumed
+    auto parked = pool->Invoke<int>([gate] {
+        gate->Wait();
+        StuckTask(std::chrono::milliseconds(300)).Run();
+        return 0;
+    });
+    auto stuck = std::make_shared<StuckTask>(std::chrono::milliseconds(300));
+    pool->Submit(stuck);
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    pool->Submit(gate);
+    parked->Get();
+    stuck->Wait();
+    EXPECT_EQ(reported.load(), 1);
+    EXPECT_EQ(watchdog.Stalls(), 2u);
+}
@@ -0,0 +1,223 @@
+#include "trace.h"
+
+#include <algorithm>
+#include <fstream>
+#include <stdexcept>
+
+namespace {
+
+constexpr char kMagic[4] = {'T', 'R', 'C', '1'};
+
+void WriteVarint(std::ostream& out, uint64_t value) {
+    while (value >= 0x80) {
+        out.put(static_cast<char>(value | 0x80));
+        value >>= 7;
+    }
+    out.put(static_cast<char>(value));
+}
+
+uint64_t ReadVarint(std::istream& in) {
+    uint64_t value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        auto byte = in.get();
+        if (byte == std::istream::traits_type::eof()) {
+            throw std::runtime_error("Trace is truncated");
+        }
+        value |= uint64_t(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            return value;
+        }
+    }
+    throw std::runtime_error("Trace has a malformed varint");
+}
+
+uint64_t ZigZag(int64_t value) {
+    return (uint64_t(value) << 1) ^ uint64_t(value >> 63);
+}
+
+int64_t UnZigZag(uint64_t value) {
+    return int64_t(value >> 1) ^ -int64_t(value & 1);
+}
+
+}  // namespace
+
+void Trace::Save(std::ostream& out) const {
+    out.write(kMagic, sizeof(kMagic));
+    WriteVarint(out, tasks.size());
+    uint64_t previous_submit = 0;
+    for (size_t i = 0; i < tasks.size(); ++i) {
+        const auto& task = tasks[i];
+        WriteVarint(out, ZigZag(task.submit_ns - previous_submit));
+        previous_submit = task.submit_ns;
+        WriteVarint(out, task.duration_ns);
+        WriteVarint(out, task.dependencies.size());
+        // Dependencies are usually the tasks right before this one
+        for (auto dep : task.dependencies) {
+            WriteVarint(out, ZigZag(int64_t(i) - dep));
+        }
+    }
+    if (!out) {
+        throw std::runtime_error("Failed to write the trace");
+    }
+}
+
+void Trace::Save(const std::string& path) const {
+    std::ofstream out(path, std::ios::binary);
+    if (!out) {
+        throw std::runtime_error("Failed to open " + path);
+    }
+    Save(out);
+}
+
+Trace Trace::Load(std::istream& in) {
+    char magic[sizeof(kMagic)];
+    if (!in.read(magic, sizeof(magic)) || !std::equal(magic, magic + sizeof(magic), kMagic)) {
+        throw std::runtime_error("Not a trace");
+    }
+    Trace trace;
+    auto size = ReadVarint(in);
+    if (size > UINT32_MAX) {
+        throw std::runtime_error("Trace is too large");
+    }
+    uint64_t submit = 0;
+    for (uint64_t i = 0; i < size; ++i) {
+        TraceTask task;
+        submit += UnZigZag(ReadVarint(in));
+        task.submit_ns = submit;
+        task.duration_ns = ReadVarint(in);
+        auto deps = ReadVarint(in);
+        for (uint64_t j = 0; j < deps; ++j) {
+            auto dep = int64_t(i) - UnZigZag(ReadVarint(in));
+            if (dep < 0 || uint64_t(dep) >= size) {
+                throw std::runtime_error("Trace has a dependency out of range");
+            }
+            task.dependencies.push_back(dep);
+        }
+        trace.tasks.push_back(std::move(task));
+    }
+    return trace;
+}
+
+Trace Trace::Load(const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        throw std::runtime_error("Failed to open " + path);
+    }
+    return Load(in);
+}
+
+TraceRecorder::~TraceRecorder() {
+    if (recording_) {
+        Stop();
+    }
+}
+
+void TraceRecorder::Start() {
+    {
+        auto guard = std::lock_guard(lock_);
+        ids_.clear();
+        entries_.clear();
+        origin_ = Clock::now();
+    }
+    if (auto previous = SetTaskObserver(this)) {
+        SetTaskObserver(previous);
+        throw std::logic_error("Another task observer is installed");
+    }
+    recording_ = true;
+}
+
+Trace TraceRecorder::Stop() {
+    if (recording_) {
+        SetTaskObserver(nullptr);
+        recording_ = false;
+    }
+
+    auto guard = std::lock_guard(lock_);
+    std::vector<uint32_t> kept;
+    for (uint32_t id = 0; id < entries_.size(); ++id) {
+        if (entries_[id].submitted && entries_[id].finished) {
+            kept.push_back(id);
+        }
+    }
+    std::stable_sort(kept.begin(), kept.end(), [this](uint32_t lhs, uint32_t rhs) {
+        return entries_[lhs].submit_ns < entries_[rhs].submit_ns;
+    });
+    std::vector<uint32_t> index(entries_.size(), UINT32_MAX);
+    for (uint32_t i = 0; i < kept.size(); ++i) {
+        index[kept[i]] = i;
+    }
+
+    Trace trace;
+    trace.tasks.reserve(kept.size());
+    for (auto id : kept) {
+        auto& entry = entries_[id];
+        TraceTask task{.submit_ns = entry.submit_ns, .duration_ns = entry.duration_ns};
+        for (auto dep : entry.dependencies) {
+            if (index[dep] != UINT32_MAX) {
+                task.dependencies.push_back(index[dep]);
+            }
+        }
+        trace.tasks.push_back(std::move(task));
+    }
+    ids_.clear();
+    entries_.clear();
+    return trace;
+}
+
+uint64_t TraceRecorder::Now() const {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - origin_).count();
+}
+
+uint32_t TraceRecorder::IdOf(const Task* task, bool submitting) {
+    auto [it, inserted] = ids_.try_emplace(task, entries_.size());
+    if (!inserted && submitting && entries_[it->second].submitted) {
+        it->second = entries_.size();
+        inserted = true;
+    }
+    if (inserted) {
+        entries_.emplace_back();
+    }
+    return it->second;
+}
+
+void TraceRecorder::OnSubmit(const Task& task,
+                             const std::vector<std::shared_ptr<Task>>& dependencies) {
+    auto now = Now();
+    auto guard = std::lock_guard(lock_);
+    auto id = IdOf(&task, true);
+    entries_[id].submitted = true;
+    entries_[id].submit_ns = now;
+    for (const auto& dep : dependencies) {
+        // A dependency submitted later gets its id now
+        auto dep_id = IdOf(dep.get(), false);
+        entries_[id].dependencies.push_back(dep_id);
+    }
+}
+
+void TraceRecorder::OnStart(const Task& task) {
+    auto now = Now();
+    auto guard = std::lock_guard(lock_);
+    auto it = ids_.find(&task);
+    if (it == ids_.end()) {
+        return;
+    }
+    auto& entry = entries_[it->second];
+    if (entry.submitted && !entry.started) {
+        entry.started = true;
+        entry.start_ns = now;
+    }
+}
+
+void TraceRecorder::OnFinish(const Task& task) {
+    auto now = Now();
+    auto guard = std::lock_guard(lock_);
+    auto it = ids_.find(&task);
+    if (it == ids_.end()) {
+        return;
+    }
+    auto& entry = entries_[it->second];
+    if (entry.started && !entry.finished) {
+        entry.finished = true;
+        entry.duration_ns = now - entry.start_ns;
+    }
+}
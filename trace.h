@@ -0,0 +1,86 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <iosfwd>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "executors.h"
+
+// One task of a recorded DAG
+struct TraceTask {
+    // Since the start of recording
+    uint64_t submit_ns{0};
+    // Wall time of Run, a task parked on a fiber is charged the time it was parked
+    uint64_t duration_ns{0};
+    // Indices of tasks this one waited for
+    std::vector<uint32_t> dependencies{};
+
+    bool operator==(const TraceTask&) const = default;
+};
+
+// Tasks ordered by submit time
+struct Trace {
+    std::vector<TraceTask> tasks;
+
+    // Compact binary format: varint deltas, a few bytes per task and edge.
+    // Throw std::runtime_error on I/O errors and on malformed input.
+    void Save(std::ostream& out) const;
+    void Save(const std::string& path) const;
+    static Trace Load(std::istream& in);
+    static Trace Load(const std::string& path);
+
+    bool operator==(const Trace&) const = default;
+};
+
+// Records tasks submitted to any Executor between Start and Stop, with their submit times,
+// run times and dependency edges. Tasks that did not finish running by Stop are dropped, and
+// so are edges to them. Triggers and time triggers are not recorded, such tasks replay as
+// ready at submission.
+class TraceRecorder : public TaskObserver {
+public:
+    TraceRecorder() = default;
+    ~TraceRecorder() override;
+
+    TraceRecorder(const TraceRecorder&) = delete;
+    TraceRecorder& operator=(const TraceRecorder&) = delete;
+
+    // Throws std::logic_error if another observer is installed
+    void Start();
+
+    // Call it once the recorded tasks are finished, a task still running keeps using
+    // the recorder
+    Trace Stop();
+
+    void OnSubmit(const Task& task,
+                  const std::vector<std::shared_ptr<Task>>& dependencies) override;
+    void OnStart(const Task& task) override;
+    void OnFinish(const Task& task) override;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Entry {
+        uint64_t submit_ns{0};
+        uint64_t start_ns{0};
+        uint64_t duration_ns{0};
+        std::vector<uint32_t> dependencies;
+        bool submitted{false};
+        bool started{false};
+        bool finished{false};
+    };
+
+    uint64_t Now() const;
+
+    // Id of the task at this address, an address seen submitted before belongs to a new task
+    uint32_t IdOf(const Task* task, bool submitting);
+
+    bool recording_{false};
+    Clock::time_point origin_;
+    std::mutex lock_;
+    std::unordered_map<const Task*, uint32_t> ids_;
+    std::vector<Entry> entries_;
+};
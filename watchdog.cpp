@@ -0,0 +1,219 @@
+#include "watchdog.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <typeinfo>
+
+#include <cxxabi.h>
+#include <execinfo.h>
+
+namespace {
+
+constexpr int kMaxStackDepth = 128;
+constexpr size_t kMaxLabel = 128;
+// A worker that does not answer within this time is reported without a sample
+constexpr auto kSampleTimeout = std::chrono::seconds(1);
+
+// Phases of a request, in the low bits of SampleRequest::state
+constexpr uint64_t kOpen = 0;
+constexpr uint64_t kWriting = 1;
+constexpr uint64_t kDone = 2;
+constexpr uint64_t kAbandoned = 3;
+constexpr uint64_t kPhaseMask = 3;
+constexpr uint64_t kNextRequest = 4;
+
+// The signal handler finds the one pending request of the process here
+struct SampleRequest {
+    // Sequence number of the request above its phase. The handler writes only after
+    // moving an open request to kWriting, and Sample abandons only an open one, so a late
+    // signal never writes into a request Sample has given up on or into the next one.
+    std::atomic<uint64_t> state{kDone};
+    std::atomic<Scheduler::WorkerSlot*> slot{nullptr};
+    uint64_t running{0};
+    int depth{0};
+    // Filled by the handler
+    void* stack[kMaxStackDepth];
+    int frames{0};
+    const std::type_info* type{nullptr};
+    char label[kMaxLabel];
+    size_t label_size{0};
+};
+
+SampleRequest request;
+std::mutex request_lock;
+
+void OnSampleSignal(int) {
+    // Loaded before the slot: the slot of the next request is stored after this one is
+    // closed, then the claim below fails
+    auto ticket = request.state.load(std::memory_order_acquire);
+    auto slot = request.slot.load(std::memory_order_acquire);
+    if ((ticket & kPhaseMask) != kOpen || !slot || !pthread_equal(slot->thread, pthread_self())) {
+        return;
+    }
+    auto expected = ticket;
+    if (!request.state.compare_exchange_strong(expected, ticket | kWriting,
+                                               std::memory_order_acquire)) {
+        return;
+    }
+    auto saved_errno = errno;
+    // The slot still points at the task, so it is alive: the worker is interrupted inside
+    // it and lets go of it only after moving the slot on
+    if (slot->running.load(std::memory_order_relaxed) == request.running) {
+        auto task = reinterpret_cast<const Task*>(request.running &
+                                                  Scheduler::WorkerSlot::kTaskMask);
+        request.type = &typeid(*task);
+        const auto& label = task->Label();
+        request.label_size = std::min(label.size(), kMaxLabel);
+        std::memcpy(request.label, label.data(), request.label_size);
+        request.frames = request.depth ? backtrace(request.stack, request.depth) : 0;
+    }
+    request.state.store(ticket | kDone, std::memory_order_release);
+    errno = saved_errno;
+}
+
+std::string Demangle(const char* name) {
+    int status = 0;
+    auto demangled = abi::__cxa_demangle(name, nullptr, nullptr, &status);
+    if (status != 0) {
+        return name;
+    }
+    std::string result(demangled);
+    std::free(demangled);
+    return result;
+}
+
+}  // namespace
+
+std::vector<std::string> StallReport::Symbols() const {
+    std::vector<std::string> symbols;
+    if (stack.empty()) {
+        return symbols;
+    }
+    auto names = backtrace_symbols(stack.data(), stack.size());
+    if (!names) {
+        return symbols;
+    }
+    symbols.assign(names, names + stack.size());
+    std::free(names);
+    return symbols;
+}
+
+Watchdog::Watchdog(Executor& executor, Callback on_stall, WatchdogOptions options)
+    : scheduler_(executor.scheduler_), on_stall_(std::move(on_stall)), options_(options) {
+    // The first backtrace loads libgcc, which must not happen inside the signal handler
+    void* frame;
+    backtrace(&frame, 1);
+
+    struct sigaction action {};
+    action.sa_handler = &OnSampleSignal;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART;
+    if (sigaction(options_.signal, &action, nullptr) != 0) {
+        throw std::invalid_argument("Watchdog can't handle this signal");
+    }
+    monitor_ = std::thread([this] { MonitorLoop(); });
+}
+
+Watchdog::~Watchdog() {
+    {
+        auto guard = std::lock_guard(lock_);
+        stopped_ = true;
+        stop_requested_.notify_one();
+    }
+    monitor_.join();
+}
+
+void Watchdog::MonitorLoop() {
+    auto interval = options_.poll_interval;
+    if (interval.count() == 0) {
+        interval = std::max(options_.threshold / 4, std::chrono::milliseconds(1));
+    }
+    auto guard = std::unique_lock(lock_);
+    while (!stop_requested_.wait_for(guard, interval, [this] { return stopped_; })) {
+        guard.unlock();
+        Check();
+        guard.lock();
+    }
+}
+
+void Watchdog::Check() {
+    auto now = std::chrono::steady_clock::now();
+    struct Stalled {
+        Scheduler::WorkerSlot* slot;
+        uint64_t running;
+        std::chrono::nanoseconds running_for;
+    };
+    std::vector<Stalled> stalled;
+    for (auto& entry : watched_) {
+        entry.second.seen = false;
+    }
+    scheduler_->ForEachWorker([&](Scheduler::WorkerSlot& slot) {
+        auto running = slot.running.load(std::memory_order_relaxed);
+        auto it = std::find_if(watched_.begin(), watched_.end(),
+                               [&slot](const auto& entry) { return entry.first == &slot; });
+        if (it == watched_.end()) {
+            watched_.push_back({&slot, {running, now, false, true}});
+            return;
+        }
+        auto& watched = it->second;
+        watched.seen = true;
+        if (watched.running != running) {
+            watched = {running, now, false, true};
+            return;
+        }
+        if (!running || watched.reported || now - watched.since < options_.threshold) {
+            return;
+        }
+        watched.reported = true;
+        // Sampled once the worker slots are unlocked, a sample may take kSampleTimeout
+        slot.pins.fetch_add(1);
+        stalled.push_back({&slot, running, now - watched.since});
+    });
+    // Slots of workers that have exited
+    std::erase_if(watched_, [](const auto& entry) { return !entry.second.seen; });
+
+    for (const auto& worker : stalled) {
+        auto report = Sample(*worker.slot, worker.running);
+        worker.slot->pins.fetch_sub(1);
+        report.running_for = worker.running_for;
+        stalls_.fetch_add(1, std::memory_order_relaxed);
+        on_stall_(report);
+    }
+}
+
+StallReport Watchdog::Sample(Scheduler::WorkerSlot& slot, uint64_t running) {
+    auto guard = std::lock_guard(request_lock);
+    request.running = running;
+    request.depth = std::clamp(options_.stack_depth, 0, kMaxStackDepth);
+    request.frames = 0;
+    request.type = nullptr;
+    request.label_size = 0;
+    request.slot.store(&slot, std::memory_order_release);
+    auto ticket = (request.state.load() & ~kPhaseMask) + kNextRequest;
+    request.state.store(ticket, std::memory_order_release);
+    if (pthread_kill(slot.thread, options_.signal) == 0) {
+        auto deadline = std::chrono::steady_clock::now() + kSampleTimeout;
+        while (request.state.load(std::memory_order_acquire) == ticket &&
+               std::chrono::steady_clock::now() < deadline) {
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+        }
+    }
+    // A handler that has claimed the request is about to finish it
+    auto expected = ticket;
+    if (!request.state.compare_exchange_strong(expected, ticket | kAbandoned)) {
+        while (request.state.load(std::memory_order_acquire) != (ticket | kDone)) {
+            std::this_thread::yield();
+        }
+    }
+    request.slot.store(nullptr);
+
+    StallReport report;
+    if (request.state.load(std::memory_order_acquire) == (ticket | kDone) && request.type) {
+        report.type_name = Demangle(request.type->name());
+        report.label.assign(request.label, request.label_size);
+        report.stack.assign(request.stack, request.stack + request.frames);
+    }
+    return report;
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "executors.h"
+
+struct WatchdogOptions {
+    // A task running longer than this is reported once
+    std::chrono::milliseconds threshold{1000};
+    // How often workers are checked, threshold / 4 if zero
+    std::chrono::milliseconds poll_interval{0};
+    // Frames in the stack sample, 0 skips sampling
+    int stack_depth = 32;
+    // Delivered to a stalled worker to take its stack sample. Its handler is installed
+    // process-wide and never removed. A system call interrupted by it may fail with EINTR.
+    int signal = SIGURG;
+};
+
+struct StallReport {
+    // Demangled dynamic type of the task, empty if it finished before it could be sampled
+    std::string type_name;
+    std::string label;
+    // Lower bound on how long the task has been running
+    std::chrono::nanoseconds running_for{0};
+    // Return addresses of the worker's stack at sampling time, innermost first
+    std::vector<void*> stack;
+
+    // Frames as backtrace_symbols prints them, link with -rdynamic to see function names
+    std::vector<std::string> Symbols() const;
+};
+
+// Detects tasks that hang on a worker of an Executor. Every worker publishes the task it
+// runs with one relaxed store per task (three for a task on a fiber), a monitor thread
+// reads the slots every poll interval and reports a task once it has been running for
+// longer than the threshold: the worker is signaled to take a backtrace() of its own stack,
+// then on_stall is called on the monitor thread. A continuation fused into the frame of
+// its predecessor is reported as the predecessor, with its own frames on the stack.
+class Watchdog {
+public:
+    using Callback = std::function<void(const StallReport&)>;
+
+    Watchdog(Executor& executor, Callback on_stall, WatchdogOptions options = {});
+    ~Watchdog();
+
+    Watchdog(const Watchdog&) = delete;
+    Watchdog& operator=(const Watchdog&) = delete;
+
+    // Tasks reported so far
+    uint64_t Stalls() const {
+        return stalls_.load(std::memory_order_relaxed);
+    }
+
+private:
+    struct Watched {
+        uint64_t running;
+        std::chrono::steady_clock::time_point since;
+        bool reported;
+        bool seen;
+    };
+
+    void MonitorLoop();
+
+    void Check();
+
+    // Signals the worker and waits for its sample, the caller keeps the slot pinned
+    StallReport Sample(Scheduler::WorkerSlot& slot, uint64_t running);
+
+    std::shared_ptr<Scheduler> scheduler_;
+    Callback on_stall_;
+    WatchdogOptions options_;
+    std::atomic<uint64_t> stalls_{0};
+    std::vector<std::pair<Scheduler::WorkerSlot*, Watched>> watched_;
+
+    std::mutex lock_;
+    std::condition_variable stop_requested_;
+    bool stopped_{false};
+    std::thread monitor_;
+};